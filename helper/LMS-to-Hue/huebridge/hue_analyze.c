@@ -2,6 +2,13 @@
 #include "hue_bridge.h"
 
 #include "log_util.h"
+#include "cpu_util.h"
+
+#if CPU_X86
+#include <immintrin.h>
+#elif CPU_NEON && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #define REAL 0
 #define IMG 1
@@ -9,6 +16,145 @@
 extern log_level    huebridge_loglevel;
 static log_level    *loglevel = &huebridge_loglevel;
 
+static struct {
+    char *name;
+    void (*window)(double *out, double *in, double *multiplier, int count);
+    double (*magnitude_sum)(fftw_complex *in, int count);
+} analyze_kernels;
+
+static void _window_scalar(double *out, double *in, double *multiplier, int count) {
+    for (int i = 0; i < count; i++)
+        out[i] = multiplier[i] * in[i];
+}
+
+static double _magnitude_sum_scalar(fftw_complex *in, int count) {
+    double sum = 0;
+
+    for (int i = 0; i < count; i++)
+        sum += hypot(in[i][REAL], in[i][IMG]);
+
+    return sum;
+}
+
+#if CPU_X86
+__attribute__((target("sse2")))
+static void _window_sse2(double *out, double *in, double *multiplier, int count) {
+    int i;
+
+    for (i = 0; i + 2 <= count; i += 2)
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(multiplier + i), _mm_loadu_pd(in + i)));
+    for (; i < count; i++)
+        out[i] = multiplier[i] * in[i];
+}
+
+__attribute__((target("sse2")))
+static double _magnitude_sum_sse2(fftw_complex *in, int count) {
+    __m128d acc = _mm_setzero_pd();
+    double sum[2];
+    int i;
+
+    for (i = 0; i + 2 <= count; i += 2) {
+        __m128d a = _mm_loadu_pd(in[i]), b = _mm_loadu_pd(in[i + 1]);
+        a = _mm_mul_pd(a, a);
+        b = _mm_mul_pd(b, b);
+        acc = _mm_add_pd(acc, _mm_sqrt_pd(_mm_add_pd(_mm_unpacklo_pd(a, b), _mm_unpackhi_pd(a, b))));
+    }
+    _mm_storeu_pd(sum, acc);
+    for (; i < count; i++)
+        sum[0] += hypot(in[i][REAL], in[i][IMG]);
+
+    return sum[0] + sum[1];
+}
+
+__attribute__((target("avx2,fma")))
+static void _window_avx2(double *out, double *in, double *multiplier, int count) {
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4)
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(multiplier + i), _mm256_loadu_pd(in + i)));
+    for (; i < count; i++)
+        out[i] = multiplier[i] * in[i];
+}
+
+__attribute__((target("avx2,fma")))
+static double _magnitude_sum_avx2(fftw_complex *in, int count) {
+    __m256d acc = _mm256_setzero_pd();
+    double sum[4];
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m256d a = _mm256_loadu_pd(in[i]), b = _mm256_loadu_pd(in[i + 2]);
+        // order of bins does not matter as they are summed
+        __m256d re = _mm256_unpacklo_pd(a, b), im = _mm256_unpackhi_pd(a, b);
+        acc = _mm256_add_pd(acc, _mm256_sqrt_pd(_mm256_fmadd_pd(re, re, _mm256_mul_pd(im, im))));
+    }
+    _mm256_storeu_pd(sum, acc);
+    for (; i < count; i++)
+        sum[0] += hypot(in[i][REAL], in[i][IMG]);
+
+    return sum[0] + sum[1] + sum[2] + sum[3];
+}
+#endif
+
+#if CPU_NEON && defined(__aarch64__)
+static void _window_neon(double *out, double *in, double *multiplier, int count) {
+    int i;
+
+    for (i = 0; i + 2 <= count; i += 2)
+        vst1q_f64(out + i, vmulq_f64(vld1q_f64(multiplier + i), vld1q_f64(in + i)));
+    for (; i < count; i++)
+        out[i] = multiplier[i] * in[i];
+}
+
+static double _magnitude_sum_neon(fftw_complex *in, int count) {
+    float64x2_t acc = vdupq_n_f64(0);
+    double sum;
+    int i;
+
+    for (i = 0; i + 2 <= count; i += 2) {
+        float64x2x2_t v = vld2q_f64(in[i]);
+        acc = vaddq_f64(acc, vsqrtq_f64(vfmaq_f64(vmulq_f64(v.val[1], v.val[1]), v.val[0], v.val[0])));
+    }
+    sum = vgetq_lane_f64(acc, 0) + vgetq_lane_f64(acc, 1);
+    for (; i < count; i++)
+        sum += hypot(in[i][REAL], in[i][IMG]);
+
+    return sum;
+}
+#endif
+
+void hue_analyze_init(void) {
+    analyze_kernels.name = "scalar";
+    analyze_kernels.window = _window_scalar;
+    analyze_kernels.magnitude_sum = _magnitude_sum_scalar;
+
+#if CPU_X86
+    if ((cpu_features() & (CPU_HAS_AVX2 | CPU_HAS_FMA)) == (CPU_HAS_AVX2 | CPU_HAS_FMA)) {
+        analyze_kernels.name = "avx2";
+        analyze_kernels.window = _window_avx2;
+        analyze_kernels.magnitude_sum = _magnitude_sum_avx2;
+    }
+    else if (cpu_features() & CPU_HAS_SSE2) {
+        analyze_kernels.name = "sse2";
+        analyze_kernels.window = _window_sse2;
+        analyze_kernels.magnitude_sum = _magnitude_sum_sse2;
+    }
+#elif CPU_NEON && defined(__aarch64__)
+    if (cpu_features() & CPU_HAS_NEON) {
+        analyze_kernels.name = "neon";
+        analyze_kernels.window = _window_neon;
+        analyze_kernels.magnitude_sum = _magnitude_sum_neon;
+    }
+#endif
+
+    cpu_set_kernel("window", analyze_kernels.name);
+    cpu_set_kernel("magnitude", analyze_kernels.name);
+    // fftw selects its own codelets when planning, buffers are fftw_alloc'ed so aligned
+    cpu_set_kernel("fft", "fftw3");
+
+    LOG_INFO("using %s kernels for window and magnitude", analyze_kernels.name);
+}
+
 struct hueaudio_s *hue_audio_create(void) {
     struct hueaudio_s *p;
     p = malloc(sizeof(struct hueaudio_s));
@@ -147,10 +293,7 @@ bool hue_audio_destroy(struct hueaudio_s *p) {
     return true;
 }
 
-bool hue_write_to_fft_input_buffers(s16_t frames, s16_t *buf, struct hueaudio_s *p) {
-    if (frames == 0)
-        return false;
-
+static void _shift_fft_input_buffers(s16_t frames, struct hueaudio_s *p) {
     for (u16_t n = p->FFTbassbufferSize; n > frames; n = n - frames) {
         for (u16_t i = 1; i <= frames; i++) {
             p->in_bass_l_raw[n - i] = p->in_bass_l_raw[n - i - frames];
@@ -172,50 +315,103 @@ bool hue_write_to_fft_input_buffers(s16_t frames, s16_t *buf, struct hueaudio_s
                 p->in_treble_r_raw[n - i] = p->in_treble_r_raw[n - i - frames];
         }
     }
-    u16_t n = frames - 1;
-    for (u16_t i = 0; i < frames; i++) {
-        if (p->channels == MONO) {
-            if (p->mono_option == AVERAGE) {
-                p->in_bass_l_raw[n] = (buf[i * 2] + buf[i * 2 + 1]) / 2;
-            }
-            if (p->mono_option == LEFT) {
-                p->in_bass_l_raw[n] = buf[i * 2];
-            }
-            if (p->mono_option == RIGHT) {
-                p->in_bass_l_raw[n] = buf[i * 2 + 1];
-            }
-        }
-        // stereo storing channels in buffer
-        if (p->channels == STEREO) {
-            p->in_bass_l_raw[n] = buf[i * 2];
-            p->in_bass_r_raw[n] = buf[i * 2 + 1];
+}
 
-            p->in_mid_r_raw[n] = p->in_bass_r_raw[n];
-            p->in_treble_r_raw[n] = p->in_bass_r_raw[n];
+static void _apply_hann_window(struct hueaudio_s *p) {
+    analyze_kernels.window(p->in_bass_l, p->in_bass_l_raw, p->bass_multiplier, p->FFTbassbufferSize);
+    analyze_kernels.window(p->in_mid_l, p->in_mid_l_raw, p->mid_multiplier, p->FFTmidbufferSize);
+    analyze_kernels.window(p->in_treble_l, p->in_treble_l_raw, p->treble_multiplier, p->FFTtreblebufferSize);
+    if (p->channels == STEREO) {
+        analyze_kernels.window(p->in_bass_r, p->in_bass_r_raw, p->bass_multiplier, p->FFTbassbufferSize);
+        analyze_kernels.window(p->in_mid_r, p->in_mid_r_raw, p->mid_multiplier, p->FFTmidbufferSize);
+        analyze_kernels.window(p->in_treble_r, p->in_treble_r_raw, p->treble_multiplier, p->FFTtreblebufferSize);
+    }
+}
+
+static inline void _store_sample(u16_t n, double left, double right, struct hueaudio_s *p) {
+    if (p->channels == MONO) {
+        if (p->mono_option == AVERAGE) {
+            p->in_bass_l_raw[n] = (left + right) / 2;
+        }
+        if (p->mono_option == LEFT) {
+            p->in_bass_l_raw[n] = left;
+        }
+        if (p->mono_option == RIGHT) {
+            p->in_bass_l_raw[n] = right;
         }
+    }
+    // stereo storing channels in buffer
+    if (p->channels == STEREO) {
+        p->in_bass_l_raw[n] = left;
+        p->in_bass_r_raw[n] = right;
+
+        p->in_mid_r_raw[n] = p->in_bass_r_raw[n];
+        p->in_treble_r_raw[n] = p->in_bass_r_raw[n];
+    }
+
+    p->in_mid_l_raw[n] = p->in_bass_l_raw[n];
+    p->in_treble_l_raw[n] = p->in_bass_l_raw[n];
+}
 
-        p->in_mid_l_raw[n] = p->in_bass_l_raw[n];
-        p->in_treble_l_raw[n] = p->in_bass_l_raw[n];
+bool hue_write_to_fft_input_buffers(s16_t frames, s16_t *buf, struct hueaudio_s *p) {
+    if (frames == 0)
+        return false;
+
+    _shift_fft_input_buffers(frames, p);
+
+    u16_t n = frames - 1;
+    for (u16_t i = 0; i < frames; i++) {
+        _store_sample(n, buf[i * 2], buf[i * 2 + 1], p);
         n--;
     }
 
     // Hann Window
-    for (int i = 0; i < p->FFTbassbufferSize; i++) {
-        p->in_bass_l[i] = p->bass_multiplier[i] * p->in_bass_l_raw[i];
-        if (p->channels == STEREO)
-            p->in_bass_r[i] = p->bass_multiplier[i] * p->in_bass_r_raw[i];
+    _apply_hann_window(p);
+
+    return true;
+}
+
+// float frames in [-1.0, 1.0[ are scaled to the 16 bits range the bars are calibrated for
+bool hue_write_float_to_fft_input_buffers(s16_t frames, float *buf, struct hueaudio_s *p) {
+    if (frames == 0)
+        return false;
+
+    _shift_fft_input_buffers(frames, p);
+
+    u16_t n = frames - 1;
+    for (u16_t i = 0; i < frames; i++) {
+        _store_sample(n, buf[i * 2] * 32768.0, buf[i * 2 + 1] * 32768.0, p);
+        n--;
     }
-    for (int i = 0; i < p->FFTmidbufferSize; i++) {
-        p->in_mid_l[i] = p->mid_multiplier[i] * p->in_mid_l_raw[i];
-        if (p->channels == STEREO)
-            p->in_mid_r[i] = p->mid_multiplier[i] * p->in_mid_r_raw[i];
+
+    _apply_hann_window(p);
+
+    return true;
+}
+
+bool hue_write_silence_to_fft_input_buffers(s16_t frames, struct hueaudio_s *p) {
+    if (frames == 0)
+        return false;
+
+    // a span covering the largest window leaves nothing but zeros
+    if (frames >= p->FFTbassbufferSize) {
+        hue_set_fft_buffers_to_zero(p);
+        return true;
     }
-    for (int i = 0; i < p->FFTtreblebufferSize; i++) {
-        p->in_treble_l[i] = p->treble_multiplier[i] * p->in_treble_l_raw[i];
-        if (p->channels == STEREO)
-            p->in_treble_r[i] = p->treble_multiplier[i] * p->in_treble_r_raw[i];
+
+    _shift_fft_input_buffers(frames, p);
+
+    memset(p->in_bass_l_raw, 0, sizeof(double) * frames);
+    memset(p->in_mid_l_raw, 0, sizeof(double) * min(frames, p->FFTmidbufferSize));
+    memset(p->in_treble_l_raw, 0, sizeof(double) * min(frames, p->FFTtreblebufferSize));
+    if (p->channels == STEREO) {
+        memset(p->in_bass_r_raw, 0, sizeof(double) * frames);
+        memset(p->in_mid_r_raw, 0, sizeof(double) * min(frames, p->FFTmidbufferSize));
+        memset(p->in_treble_r_raw, 0, sizeof(double) * min(frames, p->FFTtreblebufferSize));
     }
 
+    _apply_hann_window(p);
+
     return true;
 }
 
@@ -399,20 +595,18 @@ static bool _separate_frequency_bands(struct hueaudio_s *p, int bass_cut_off_bar
     double temp;
 
     for (int n = 0; n < p->number_of_bars; n++) {
-        temp = 0;
+        fftw_complex *out;
+
+        if (n <= bass_cut_off_bar)
+            out = p->out_bass_l;
+        else if (n <= treble_cut_off_bar)
+            out = p->out_mid_l;
+        else
+            out = p->out_treble_l;
 
         // add up fft values within bands
         LOG_SDEBUG("VALUES: %d, %d", FFTbuffer_lower_cut_off[n], FFTbuffer_upper_cut_off[n]);
-        for (int i = FFTbuffer_lower_cut_off[n]; i <= FFTbuffer_upper_cut_off[n]; i++) {
-            if (n <= bass_cut_off_bar) 
-               temp += hypot(p->out_bass_l[i][REAL], (p->out_bass_l)[i][IMG]);
- 
-            else if (n > bass_cut_off_bar && n <= treble_cut_off_bar)
-               temp += hypot(p->out_mid_l[i][REAL], p->out_mid_l[i][IMG]);
- 
-            else if (n > treble_cut_off_bar)
-                temp += hypot(p->out_treble_l[i][REAL], p->out_treble_l[i][IMG]);
-        }
+        temp = analyze_kernels.magnitude_sum(out + FFTbuffer_lower_cut_off[n], FFTbuffer_upper_cut_off[n] - FFTbuffer_lower_cut_off[n] + 1);
 
         // getting average, multiply with sens and eq
         temp /= FFTbuffer_upper_cut_off[n] - FFTbuffer_lower_cut_off[n] + 1;
@@ -77,11 +77,14 @@ typedef struct hueaudio_s {
     fftw_plan p_treble_l, p_treble_r;
 } hueaudio_data_t;
 
+void hue_analyze_init(void);
 struct hueaudio_s *hue_audio_create(void);
 bool hue_audio_destroy(struct hueaudio_s *p);
 
 void hue_set_fft_buffers_to_zero(struct hueaudio_s *p);
 bool hue_write_to_fft_input_buffers(s16_t frames, s16_t buf[frames * 2], struct hueaudio_s *p);
+bool hue_write_float_to_fft_input_buffers(s16_t frames, float buf[frames * 2], struct hueaudio_s *p);
+bool hue_write_silence_to_fft_input_buffers(s16_t frames, struct hueaudio_s *p);
 bool hue_analyze_audio(struct hueaudio_s *p);
 
 #endif /* __HUE_AUDIO_H_ */
@@ -92,7 +92,7 @@ bool huebridge_start_at(struct huebridgecl_s *p, u64_t start_time) {
         false;
 
     pthread_mutex_lock(&p->Mutex);
-    p->start_ts = NTP2TS(start_time, 44100);
+    p->start_ts = NTP2TS(start_time, p->sample_rate);
     pthread_mutex_unlock(&p->Mutex);
 
     LOG_INFO("[%p]: set start time %u.%u (ts:%Lu)", p, SEC(start_time), FRAC(start_time), p->start_ts);
@@ -101,6 +101,47 @@ bool huebridge_start_at(struct huebridgecl_s *p, u64_t start_time) {
 }
 
 
+/*----------------------------------------------------------------------------*/
+bool huebridge_set_sample_rate(struct huebridgecl_s *p, u32_t sample_rate) {
+    u32_t old_rate;
+
+    if (!p || !sample_rate)
+        return false;
+
+    pthread_mutex_lock(&p->Mutex);
+
+    old_rate = p->sample_rate;
+    if (old_rate == sample_rate) {
+        pthread_mutex_unlock(&p->Mutex);
+        return true;
+    }
+
+    // timestamps count frames, so re-express them in the new rate
+    if (p->head_ts) p->head_ts = NTP2TS(TS2NTP(p->head_ts, old_rate), sample_rate);
+    if (p->first_ts) p->first_ts = NTP2TS(TS2NTP(p->first_ts, old_rate), sample_rate);
+    if (p->start_ts) p->start_ts = NTP2TS(TS2NTP(p->start_ts, old_rate), sample_rate);
+    if (p->pause_ts) p->pause_ts = NTP2TS(TS2NTP(p->pause_ts, old_rate), sample_rate);
+
+    p->sample_rate = sample_rate;
+    p->hueaudio->sampling_rate = sample_rate;
+
+    pthread_mutex_unlock(&p->Mutex);
+
+    LOG_INFO("[%p]: sample rate %u -> %u", p, old_rate, sample_rate);
+
+    return true;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool huebridge_mono_analysis(struct huebridgecl_s *p) {
+    if (!p || !p->hueaudio)
+        return false;
+
+    return p->hueaudio->channels == MONO && p->hueaudio->mono_option == AVERAGE;
+}
+
+
 /*----------------------------------------------------------------------------*/
 void huebridge_stop(struct huebridgecl_s *p) {
     if (!p)
@@ -130,7 +171,7 @@ bool huebridge_accept_frames(struct huebridgecl_s *p) {
     if (p->waiting) {
         u64_t now = get_ntp(NULL);
 
-        now_ts = NTP2TS(now, 44100);
+        now_ts = NTP2TS(now, p->sample_rate);
 
         // Not flushed yet, but we have time to wait, so pretend we are full
         if (p->StreamState != HUE_STREAM_WAITING && (!p->start_ts || p->start_ts > now_ts)) {
@@ -167,7 +208,7 @@ bool huebridge_accept_frames(struct huebridgecl_s *p) {
 
     // when paused, fix "now" at the time when it was paused.
     if (p->pause_ts) now_ts = p->pause_ts;
-    else now_ts = NTP2TS(get_ntp(NULL), 44100);
+    else now_ts = NTP2TS(get_ntp(NULL), p->sample_rate);
 
     if (now_ts >= p->head_ts + p->chunk_len) accept = true;
 
@@ -178,19 +219,21 @@ bool huebridge_accept_frames(struct huebridgecl_s *p) {
 
 
 /*----------------------------------------------------------------------------*/
-bool huebridge_process_chunk(struct huebridgecl_s *p, s16_t *sample, int frames, u64_t *playtime) {
-    if (!p || !sample) {
-        LOG_ERROR("[%p]: something went wrong (s:%p)", p, sample);
+// frames are either S16_LE or float (analysis_only)
+static bool _process_chunk(struct huebridgecl_s *p, s16_t *sample, float *fsample, int frames, u64_t *playtime) {
+    if (!p || (!sample && !fsample)) {
+        LOG_ERROR("[%p]: something went wrong (s:%p f:%p)", p, sample, fsample);
 
         return false;
     }
 
     pthread_mutex_lock(&p->Mutex);
 
-    *playtime = TS2NTP(p->head_ts, 44100);
+    *playtime = TS2NTP(p->head_ts, p->sample_rate);
     p->head_ts += p->chunk_len;
 
-    hue_write_to_fft_input_buffers(frames, sample, p->hueaudio);
+    if (fsample) hue_write_float_to_fft_input_buffers(frames, fsample, p->hueaudio);
+    else hue_write_to_fft_input_buffers(frames, sample, p->hueaudio);
     //hue_analyze_audio(p->hueaudio);
 
     pthread_mutex_unlock(&p->Mutex);
@@ -203,6 +246,36 @@ bool huebridge_process_chunk(struct huebridgecl_s *p, s16_t *sample, int frames,
     return true;
 }
 
+/*----------------------------------------------------------------------------*/
+bool huebridge_process_chunk(struct huebridgecl_s *p, s16_t *sample, int frames, u64_t *playtime) {
+    return _process_chunk(p, sample, NULL, frames, playtime);
+}
+
+/*----------------------------------------------------------------------------*/
+bool huebridge_process_float_chunk(struct huebridgecl_s *p, float *sample, int frames, u64_t *playtime) {
+    return _process_chunk(p, NULL, sample, frames, playtime);
+}
+
+/*----------------------------------------------------------------------------*/
+bool huebridge_process_silence(struct huebridgecl_s *p, int frames, u64_t *playtime) {
+    if (!p) {
+        LOG_ERROR("[%p]: something went wrong", p);
+
+        return false;
+    }
+
+    pthread_mutex_lock(&p->Mutex);
+
+    *playtime = TS2NTP(p->head_ts, p->sample_rate);
+    p->head_ts += p->chunk_len;
+
+    hue_write_silence_to_fft_input_buffers(frames, p->hueaudio);
+
+    pthread_mutex_unlock(&p->Mutex);
+
+    return true;
+}
+
 /*----------------------------------------------------------------------------*/
 bool huebridge_rest_init() {
     return hue_rest_init();
@@ -261,6 +334,7 @@ struct huebridgecl_s *huebridge_create(struct in_addr ipAddress, char *username,
     pthread_mutex_init(&huebridgecld->Mutex, NULL);
 
     huebridgecld->chunk_len = chunk_len;
+    huebridgecld->sample_rate = 44100;
     huebridge_sanitize(huebridgecld);
 
     huebridgecld->hueaudio = hue_audio_create();
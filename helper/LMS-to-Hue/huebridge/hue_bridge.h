@@ -63,6 +63,7 @@ typedef struct huebridgecl_s {
     huebridge_state_t ConnectionState;
     huebridge_state_t StreamState;
     u64_t head_ts, pause_ts, start_ts, first_ts;
+    u32_t sample_rate;
     float Volume;
     bool waiting;
     int chunk_len;
@@ -90,9 +91,13 @@ bool    huebridge_disconnect(struct huebridgecl_s *p);
 bool    huebridge_sanitize(struct huebridgecl_s *p);
 
 bool    huebridge_set_volume(struct huebridgecl_s *p, float vol);
+bool    huebridge_set_sample_rate(struct huebridgecl_s *p, u32_t sample_rate);
+bool    huebridge_mono_analysis(struct huebridgecl_s *p);
 
 bool    huebridge_accept_frames(struct huebridgecl_s *p);
 bool    huebridge_process_chunk(struct huebridgecl_s *p, s16_t *sample, int size, u64_t *playtime);
+bool    huebridge_process_float_chunk(struct huebridgecl_s *p, float *sample, int size, u64_t *playtime);
+bool    huebridge_process_silence(struct huebridgecl_s *p, int frames, u64_t *playtime);
 
 bool    huebridge_start_at(struct huebridgecl_s *p, u64_t start_time);
 void    huebridge_pause(struct huebridgecl_s *p);
@@ -104,9 +104,17 @@ void SaveConfig(char *name, void *ref, int mode) {
     XMLUpdateNode(doc, common, force, "enabled", "%d", (int) glMRConfig.Enabled);
     XMLUpdateNode(doc, common, force, "codecs", glDeviceParam.codecs);
     XMLUpdateNode(doc, common, force, "sample_rate", "%d", (int) glDeviceParam.sample_rate);
+    XMLUpdateNode(doc, common, force, "analysis_only", "%d", (int) glDeviceParam.analysis_only);
+    XMLUpdateNode(doc, common, force, "fast_start", "%d", (int) glDeviceParam.fast_start);
+    XMLUpdateNode(doc, common, force, "light_decode", "%d", (int) glDeviceParam.light_decode);
+    XMLUpdateNode(doc, common, force, "analysis_rate", "%d", (int) glDeviceParam.analysis_rate);
+    XMLUpdateNode(doc, common, force, "ktls", "%d", (int) glDeviceParam.ktls);
+    XMLUpdateNode(doc, common, force, "resume_retries", "%d", (int) glDeviceParam.resume_retries);
+    XMLUpdateNode(doc, common, force, "prefetch", "%d", (int) glDeviceParam.prefetch);
 #if defined(RESAMPLE)
     XMLUpdateNode(doc, common, force, "resample", "%d", (int) glDeviceParam.resample);
     XMLUpdateNode(doc, common, force, "resample_options", glDeviceParam.resample_options);
+    XMLUpdateNode(doc, common, force, "resample_threads", "%d", (int) glDeviceParam.resample_threads);
 #endif
     XMLUpdateNode(doc, common, force, "auto_play", "%d", (int) glMRConfig.AutoPlay);
     XMLUpdateNode(doc, common, force, "remove_timeout", "%d", (int) glMRConfig.RemoveTimeout);
@@ -199,6 +207,20 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
         strcpy(sq_conf->codecs, val);
     if (!strcmp(name, "sample_rate")) 
         sq_conf->sample_rate = atol(val);
+    if (!strcmp(name, "analysis_only"))
+        sq_conf->analysis_only = atol(val);
+    if (!strcmp(name, "fast_start"))
+        sq_conf->fast_start = atol(val);
+    if (!strcmp(name, "light_decode"))
+        sq_conf->light_decode = atol(val);
+    if (!strcmp(name, "analysis_rate"))
+        sq_conf->analysis_rate = atol(val);
+    if (!strcmp(name, "ktls"))
+        sq_conf->ktls = atol(val);
+    if (!strcmp(name, "resume_retries"))
+        sq_conf->resume_retries = atol(val);
+    if (!strcmp(name, "prefetch"))
+        sq_conf->prefetch = atol(val);
     if (!strcmp(name, "name")) 
         strcpy(sq_conf->name, val);
     if (!strcmp(name, "server"))
@@ -216,6 +238,8 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
         sq_conf->resample = atol(val);
     if (!strcmp(name, "resample_options"))
         strcpy(sq_conf->resample_options, val);
+    if (!strcmp(name, "resample_threads"))
+        sq_conf->resample_threads = atol(val);
 #endif
     if (!strcmp(name, "enabled"))
         Conf->Enabled = atol(val);
@@ -27,6 +27,7 @@
 #include "conf_util.h"
 #include "log_util.h"
 #include "util_common.h"
+#include "cpu_util.h"
 #include "hue_bridge.h"
 
 #define MODEL_NAME_STRING "Hue Entertainment Bridge"
@@ -63,6 +64,7 @@ static char                 glModelName[_STR_LEN_] = MODEL_NAME_STRING;
 char                        glInterface[16] = "?";
 static struct mDNShandle_s  *glmDNSsearchHandle;
 static bool                 glDeviceRegister = false;
+static bool                 glReportKernels = false;
 int                         glMigration = 0;
 
 static char                 *glLogFile;
@@ -110,10 +112,18 @@ sq_dev_param_t glDeviceParam = {
                                 "",
                                 { 0x00,0x00,0x00,0x00,0x00,0x00 },
                                 false,
+                                false,
+                                false,
+                                false,
+                                0,
+                                false,
+                                3,
+                                false,
 #if defined(RESAMPLE)
                                 96000,
                                 true,
                                 "",
+                                1,
 #else
                                 44100,
 #endif
@@ -148,6 +158,7 @@ static char usage[] =
                     "  -Z \t\t\tNOT interactive\n"
                     "  -k \t\t\tImmediate exit on SIGQUIT and SIGTERM\n"
                     "  -t \t\t\tLicense terms\n"
+                    "  -K \t\t\tReport CPU features and processing kernels in use, then exit\n"
                     "\n"
                     "Build options:"
 #if LINUX
@@ -173,6 +184,9 @@ static char usage[] =
 #endif
 #if WINEVENT
                     " WINEVENT"
+#endif
+#if BYTES_PER_FRAME == 4
+                    " S16"
 #endif
 		    "\n\n";
 
@@ -867,7 +881,7 @@ bool ParseArgs(int argc, char **argv) {
         if (strstr("stxdfpicbM", opt) && optind < argc - 1) {
             optarg = argv[optind + 1];
             optind += 2;
-        } else if (strstr("tzZIkr"
+        } else if (strstr("tzZIkrK"
 #if defined(RESAMPLE)
                           "uR"
 #endif
@@ -959,6 +973,9 @@ bool ParseArgs(int argc, char **argv) {
                     }
                 }
                 break;
+            case 'K':
+                glReportKernels = true;
+                break;
             case 't':
                 printf("%s", license);
 
@@ -1026,6 +1043,14 @@ int main(int argc, char *argv[])
         LOG_ERROR("\n\n!!!!!!!!!!!!!!!!!! ERROR LOADING CONFIG FILE !!!!!!!!!!!!!!!!!!!!!\n", NULL);
     }
 
+    if (glReportKernels) {
+        hue_analyze_init();
+        sq_init(glModelName);
+        cpu_print_kernels(stdout);
+        sq_end();
+        return(0);
+    }
+
     if (glDiscovery) {
         Start();
         sleep(MDNS_DISCOVERY_TIME + 1);
@@ -1061,6 +1086,7 @@ int main(int argc, char *argv[])
         }
     }
 
+    hue_analyze_init();
     sq_init(glModelName);
 
     if (!Start()) {
@@ -25,6 +25,13 @@
 
 #define BLOCK_SIZE (4096 * BYTES_PER_FRAME)
 
+// 8 bits decoded samples are a single byte, moved to top of internal sample
+#if BYTES_PER_FRAME == 4
+#define ALAC_SAMPLE(b) ((ISAMPLE_T) ((u32_t) (b) << 8))
+#else
+#define ALAC_SAMPLE(b) ((ISAMPLE_T) ((u32_t) (b) << 24))
+#endif
+
 struct chunk_table {
 	u32_t sample, offset;
 };
@@ -52,18 +59,29 @@ struct alac {
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
-#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
-#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#else
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -71,7 +89,7 @@ static log_level *loglevel = &decode_loglevel;
 // read mp4 header to extract config data
 static int read_mp4_header(struct thread_ctx_s *ctx) {
 	struct alac *l = ctx->decode.handle;
-	size_t bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	size_t bytes = _buf_cont_read(ctx->streambuf);
 	char type[5];
 	u32_t len;
 
@@ -294,8 +312,10 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 	bool endstream;
 	u8_t *iptr;
 	u32_t frames, block_size;
+	stream_state state;
 
 	LOCK_S;
+	state = STREAM_STATE(ctx);
 
 	// data not reached yet
 	if (l->consume) {
@@ -316,11 +336,10 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 
 		if (found == 1) {
 			LOG_INFO("[%p]: sample_rate: %u channels: %u", ctx, l->sample_rate, l->channels);
-			bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+			bytes = _buf_cont_read(ctx->streambuf);
 			LOG_INFO("[%p]: setting track_start", ctx);
 			LOCK_O;
-			// don't use next_sample_rate
-			ctx->output.current_sample_rate = decode_newstream(l->sample_rate, ctx->output.supported_rates, ctx);
+			ctx->output.next_sample_rate = decode_newstream(l->sample_rate, ctx->output.supported_rates, ctx);
 			ctx->output.track_start = ctx->outputbuf->writep;
 
 			if (ctx->output.fade_mode) _checkfade(true, ctx);
@@ -342,7 +361,7 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 	block_size = l->default_block_size ? l->default_block_size : l->block_size[l->block_index];
 
 	// stream terminated
-	if (ctx->stream.state <= DISCONNECT && (bytes == 0 || block_size == 0)) {
+	if (state <= DISCONNECT && (bytes == 0 || block_size == 0)) {
 		UNLOCK_S;
 		LOG_DEBUG("[%p]: end of stream", ctx);
 		return DECODE_COMPLETE;
@@ -434,15 +453,15 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 
 	while (frames > 0) {
 		size_t f, count;
-		s16_t *optr;
+		ISAMPLE_T *optr;
 
 		IF_DIRECT(
 			f = min(frames, _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME);
-			optr = (s16_t *)ctx->outputbuf->writep;
+			optr = (ISAMPLE_T *)ctx->outputbuf->writep;
 		);
 		IF_PROCESS(
 			f = min(frames, ctx->process.max_in_frames - ctx->process.in_frames);
-			optr = (s16_t *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
+			optr = (ISAMPLE_T *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
 		);
 
 		f = min(f, frames);
@@ -450,28 +469,20 @@ static decode_state alac_decode(struct thread_ctx_s *ctx) {
 
 		if (l->sample_size == 8) {
 			while (count--) {
-				*optr++ = (*(u16_t*) iptr) << 8;
-				*optr++ = (*(u16_t*) (iptr + 1)) << 8;
+				*optr++ = ALAC_SAMPLE(*iptr);
+				*optr++ = ALAC_SAMPLE(*(iptr + 1));
 				iptr += 2;
 			}
 		} else if (l->sample_size == 16) {
-			while (count--) {
-				*optr++ = (*(u16_t*) iptr);
-				*optr++ = (*(u16_t*) (iptr + 2));
-				iptr += 4;
-			}
+			// decoder output is little endian pcm
+			_unpack_s16(optr, iptr, f, 2, false);
+			iptr += f * 4;
 		} else if (l->sample_size == 24) {
-			while (count--) {
-				*optr++ = (*(u16_t*) iptr) >> 8;
-				*optr++ = (*(u16_t*) (iptr + 3)) >> 8;
-				iptr += 6;
-			}
+			_unpack_s24(optr, iptr, f, false);
+			iptr += f * 6;
 		} else if (l->sample_size == 32) {
-			while (count--) {
-				*optr++ = (*(u16_t*) iptr) >> 16;
-				*optr++ = (*(u16_t*) (iptr + 4)) >> 16;
-				iptr += 8;
-			}
+			_unpack_s32(optr, iptr, f, false);
+			iptr += f * 8;
 		} else {
 			LOG_ERROR("[%p]: unsupported bits per sample: %u", ctx, l->sample_size);
 		}
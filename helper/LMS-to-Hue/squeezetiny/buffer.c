@@ -21,9 +21,131 @@
 
 // fifo bufffers 
 
+#include <stddef.h>
 #include "squeezelite.h"
 
-// _* called with muxtex locked
+#if MIRROR_BUF || MMAP_FILE
+#include <sys/mman.h>
+#endif
+
+#if MMAP_FILE
+#include <sys/stat.h>
+#endif
+
+#if MIRROR_BUF
+#include <sys/syscall.h>
+#if !defined(SYS_memfd_create)
+#undef MIRROR_BUF
+#define MIRROR_BUF 0
+#endif
+#endif
+
+/*
+ With MIRROR_BUF, the same pages are mapped twice back to back so that
+ anything starting in [buf, wrap) can be accessed up to size bytes without
+ caring for wrap. Pointers still wrap as usual, only cont_read/cont_write
+ change to return all what is used/free and unwrap becomes useless.
+*/
+
+#if MIRROR_BUF
+// mirrored size must be page aligned and keep frames aligned for decoders
+static size_t _mirror_size(size_t size) {
+	size_t a = sysconf(_SC_PAGESIZE), b = BYTES_PER_FRAME * 3, lcm = a * b;
+	while (b) { size_t t = a % b; a = b; b = t; }
+	lcm /= a;
+	return size - size % lcm;
+}
+
+static u8_t *_mirror_alloc(size_t size) {
+	u8_t *base;
+	int fd = syscall(SYS_memfd_create, "squeezelite", 0);
+
+	if (fd < 0) return NULL;
+
+	base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (base != MAP_FAILED && (ftruncate(fd, size) ||
+		mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+		munmap(base, 2 * size);
+		base = MAP_FAILED;
+	}
+
+	// mappings keep the pages alive
+	close(fd);
+
+	return base != MAP_FAILED ? base : NULL;
+}
+#endif
+
+/*
+ With LOCKFREE_BUF, the reader and the writer use the buffer without mutex.
+ Each moves only its own pointer, stored with release and loaded with
+ acquire, so used/space/cont_* are exact from its side. They do so in a
+ section (buf_begin/buf_end). What moves both pointers or the storage
+ (flush, adjust, map, resize, swap, unwrap) is a holder: it raises hold and
+ waits for the sides to leave, while sides wait for hold to drop before
+ entering. The mutex serializes holders and still protects the state each
+ module keeps with its buffer (stream and output state).
+ A holder that has the mutex while waiting (_ functions) requires that sides
+ don't take it in their section. This is the case for streambuf, and only
+ buf_flush holds outputbuf, before locking. A side that has the mutex when
+ entering must use buf_try_begin and come back later.
+*/
+
+#if LOCKFREE_BUF
+#define LOAD_P(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE_P(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define HOLD_WAIT		1000
+#else
+#define LOAD_P(p)		(p)
+#define STORE_P(p, v)	(p) = (v)
+#endif
+
+static void _buf_alloc(struct buffer *buf, size_t size) {
+#if MIRROR_BUF
+	size_t mirror_size = _mirror_size(size);
+
+	if (mirror_size && (buf->buf = _mirror_alloc(mirror_size)) != NULL) {
+		buf->mirror = true;
+		buf->size = mirror_size;
+		return;
+	}
+#endif
+	buf->mirror = false;
+	buf->buf = malloc(size);
+	buf->size = buf->buf ? size : 0;
+}
+
+#if MMAP_FILE
+// give back the ring that was in place before _buf_map
+static void _buf_unmap(struct buffer *buf) {
+	if (!buf->ring.buf) return;
+	munmap(buf->buf, buf->size - 1);
+	buf->buf = buf->ring.buf;
+	buf->size = buf->ring.size;
+	buf->base_size = buf->ring.base_size;
+	buf->mirror = buf->ring.mirror;
+	buf->wrap = buf->buf + buf->size;
+	buf->readp = buf->writep = buf->buf;
+	buf->ring.buf = NULL;
+}
+#else
+#define _buf_unmap(buf)
+#endif
+
+static void _buf_free(struct buffer *buf) {
+	_buf_unmap(buf);
+#if MIRROR_BUF
+	if (buf->mirror) {
+		munmap(buf->buf, 2 * buf->size);
+		return;
+	}
+#endif
+	free(buf->buf);
+}
+
+// _* called with muxtex locked, or in the side's section with LOCKFREE_BUF
 
 
 bool _buf_wrap(struct buffer *buf) {
@@ -31,7 +153,8 @@ bool _buf_wrap(struct buffer *buf) {
 }
 
 unsigned _buf_used(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->size - (buf->readp - buf->writep);
+	u8_t *readp = LOAD_P(buf->readp), *writep = LOAD_P(buf->writep);
+	return writep >= readp ? writep - readp : buf->size - (readp - writep);
 }
 
 unsigned _buf_space(struct buffer *buf) {
@@ -39,79 +162,226 @@ unsigned _buf_space(struct buffer *buf) {
 }
 
 unsigned _buf_cont_read(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->wrap - buf->readp;
+	u8_t *readp = LOAD_P(buf->readp), *writep = LOAD_P(buf->writep);
+	if (buf->mirror) return _buf_used(buf);
+	return writep >= readp ? writep - readp : buf->wrap - readp;
 }
 
+// never more than space, from the same pointers: callers must not min() it
+// with _buf_space as min() evaluates twice and space can grow in between
 unsigned _buf_cont_write(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->wrap - buf->writep : buf->readp - buf->writep;
+	u8_t *readp = LOAD_P(buf->readp), *writep = LOAD_P(buf->writep);
+	if (buf->mirror) return _buf_space(buf);
+	if (writep < readp) return readp - writep - 1;
+	return buf->wrap - writep - (readp == buf->buf ? 1 : 0);
 }
 
+// only the reader moves readp and only the writer moves writep, the release
+// makes data read/written before visible to the other side
 void _buf_inc_readp(struct buffer *buf, unsigned by) {
-	buf->readp += by;
-	if (buf->readp >= buf->wrap) {
-		buf->readp -= buf->size;
+	u8_t *readp = buf->readp + by;
+	if (readp >= buf->wrap) {
+		readp -= buf->size;
 	}
+	STORE_P(buf->readp, readp);
 }
 
 void _buf_inc_writep(struct buffer *buf, unsigned by) {
-	buf->writep += by;
-	if (buf->writep >= buf->wrap) {
-		buf->writep -= buf->size;
+	u8_t *writep = buf->writep + by;
+	if (writep >= buf->wrap) {
+		writep -= buf->size;
+	}
+	STORE_P(buf->writep, writep);
+}
+
+#if LOCKFREE_BUF
+// busy and hold are a Dekker pair, each side stores its flag then loads the other's
+bool buf_try_begin(struct buffer *buf, int side) {
+	__atomic_store_n(&buf->busy[side], 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&buf->hold, __ATOMIC_SEQ_CST)) return true;
+	__atomic_store_n(&buf->busy[side], 0, __ATOMIC_RELEASE);
+	return false;
+}
+
+void buf_begin(struct buffer *buf, int side) {
+	while (!buf_try_begin(buf, side)) usleep(HOLD_WAIT);
+}
+
+// harmless when side is not in, so that codecs can leave what they might have entered
+void buf_end(struct buffer *buf, int side) {
+	__atomic_store_n(&buf->busy[side], 0, __ATOMIC_RELEASE);
+}
+
+// keep sides out and wait for side (or BUF_BOTH) to leave, holders can nest
+void _buf_hold(struct buffer *buf, int side) {
+	int i;
+
+	__atomic_add_fetch(&buf->hold, 1, __ATOMIC_SEQ_CST);
+	for (i = BUF_READER; i <= BUF_WRITER; i++) {
+		if (side != BUF_BOTH && side != i) continue;
+		while (__atomic_load_n(&buf->busy[i], __ATOMIC_SEQ_CST)) usleep(HOLD_WAIT);
 	}
 }
 
+void _buf_release(struct buffer *buf) {
+	__atomic_sub_fetch(&buf->hold, 1, __ATOMIC_SEQ_CST);
+}
+#else
+void _buf_hold(struct buffer *buf, int side) { }
+void _buf_release(struct buffer *buf) { }
+#endif
+
+/*
+ Queries without section nor mutex. Used can only grow for the reader and
+ space can only grow for the writer, so from these sides the value is a safe
+ lower bound. A concurrent flush or resize can make it meaningless, so it
+ must only be used as a hint to decide if work shall be attempted.
+*/
+unsigned buf_used(struct buffer *buf) {
+	unsigned used;
+#if LOCKFREE_BUF
+	used = _buf_used(buf);
+#else
+	mutex_lock(buf->mutex);
+	used = _buf_used(buf);
+	mutex_unlock(buf->mutex);
+#endif
+	return used;
+}
+
+unsigned buf_space(struct buffer *buf) {
+	unsigned space;
+#if LOCKFREE_BUF
+	space = _buf_space(buf);
+#else
+	mutex_lock(buf->mutex);
+	space = _buf_space(buf);
+	mutex_unlock(buf->mutex);
+#endif
+	return space;
+}
+
+// sides are waited for before the mutex, see above
 void buf_flush(struct buffer *buf) {
+	_buf_hold(buf, BUF_BOTH);
 	mutex_lock(buf->mutex);
+	_buf_unmap(buf);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
 	mutex_unlock(buf->mutex);
+	_buf_release(buf);
 }
 
 bool _buf_reset(struct buffer *buf) {
-	if (buf->readp != buf->writep) return false;
-	buf->readp  = buf->buf;
-	buf->writep = buf->buf;
-	return true;
+	bool reset = false;
+	_buf_hold(buf, BUF_BOTH);
+	if (buf->readp == buf->writep) {
+		_buf_unmap(buf);
+		buf->readp  = buf->buf;
+		buf->writep = buf->buf;
+		reset = true;
+	}
+	_buf_release(buf);
+	return reset;
 }
 
 // adjust buffer to multiple of mod bytes so reading in multiple always wraps on frame boundary
 void buf_adjust(struct buffer *buf, size_t mod) {
 	size_t size;
+	_buf_hold(buf, BUF_BOTH);
 	mutex_lock(buf->mutex);
-	size = ((unsigned)(buf->base_size / mod)) * mod;
+	// a mirrored buffer can't shrink its wrap point
+	size = buf->mirror ? buf->size : ((unsigned)(buf->base_size / mod)) * mod;
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
 	buf->wrap   = buf->buf + size;
 	buf->size   = size;
 	mutex_unlock(buf->mutex);
+	_buf_release(buf);
+}
+
+/*
+ Called with mutex locked to make the whole file fd the buffer's content,
+ ready to be read by the decoder without any copy. The mapping is private
+ so that codecs can still move data in place. The ring is put back by the
+ next flush/reset/destroy.
+*/
+bool _buf_map(struct buffer *buf, int fd) {
+#if MMAP_FILE
+	struct stat st;
+	u8_t *map;
+
+	if (buf->ring.buf || fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+		(unsigned long long) st.st_size >= UINT_MAX) return false;
+
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return false;
+
+	_buf_hold(buf, BUF_BOTH);
+
+	// read ahead aggressively and prefetch what the ring would have held
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	madvise(map, min((size_t) st.st_size, buf->base_size), MADV_WILLNEED);
+
+	buf->ring.buf = buf->buf;
+	buf->ring.size = buf->size;
+	buf->ring.base_size = buf->base_size;
+	buf->ring.mirror = buf->mirror;
+
+	// one spare byte as full would be same as empty otherwise
+	buf->buf = map;
+	buf->size = buf->base_size = st.st_size + 1;
+	buf->wrap = buf->buf + buf->size;
+	buf->mirror = false;
+	buf->readp = buf->buf;
+	buf->writep = buf->buf + st.st_size;
+
+	_buf_release(buf);
+
+	return true;
+#else
+	return false;
+#endif
 }
 
 // called with mutex locked to resize, does not retain contents, reverts to original size if fails
 void _buf_resize(struct buffer *buf, size_t size) {
+	size_t old_size = buf->size;
 	if (buf->size == size) return;
-	free(buf->buf);
-	buf->buf = malloc(size);
+	_buf_hold(buf, BUF_BOTH);
+	_buf_free(buf);
+	_buf_alloc(buf, size);
 	if (!buf->buf) {
-		size    = buf->size;
-		buf->buf= malloc(size);
-		if (!buf->buf) {
-			size = 0;
-		}
+		_buf_alloc(buf, old_size);
 	}
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
-	buf->wrap   = buf->buf + size;
-	buf->size   = size;
-	buf->base_size = size;
+	buf->wrap   = buf->buf + buf->size;
+	buf->base_size = buf->size;
+	_buf_release(buf);
 }
 
-void _buf_unwrap(struct buffer *buf, size_t cont) {
+// called with both mutex locked, exchanges storage and content but each keeps its mutex (and sides)
+void _buf_swap(struct buffer *a, struct buffer *b) {
+	struct buffer tmp;
+	size_t len = offsetof(struct buffer, mutex);
+
+	_buf_hold(a, BUF_BOTH);
+	_buf_hold(b, BUF_BOTH);
+	memcpy(&tmp, a, len);
+	memcpy(a, b, len);
+	memcpy(b, &tmp, len);
+	_buf_release(b);
+	_buf_release(a);
+}
+
+static void _unwrap(struct buffer *buf, size_t cont) {
 	ssize_t len, by = cont - (buf->wrap - buf->readp);
 	size_t size;
 	u8_t *scratch;
 
 	// do nothing if we have enough space
-	if (by <= 0 || cont >= buf->size) return;
+	if (buf->mirror || by <= 0 || cont >= buf->size) return;
 
 	// buffer already unwrapped, just move it up
 	if (buf->writep >= buf->readp) {
@@ -150,24 +420,36 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 		memcpy(buf->writep - size, scratch, size);
 		free(scratch);
 	} else {
-		_buf_unwrap(buf, cont / 2);
-        _buf_unwrap(buf, cont - cont / 2);
+		_unwrap(buf, cont / 2);
+        _unwrap(buf, cont - cont / 2);
 	}
 }
 
+// by the reader, that moves writep as well so writer must be out
+void _buf_unwrap(struct buffer *buf, size_t cont) {
+	if (buf->mirror || cont <= (size_t) (buf->wrap - buf->readp) || cont >= buf->size) return;
+	_buf_hold(buf, BUF_WRITER);
+	_unwrap(buf, cont);
+	_buf_release(buf);
+}
+
 void buf_init(struct buffer *buf, size_t size) {
-	buf->buf    = malloc(size);
+	buf->ring.buf = NULL;
+	_buf_alloc(buf, size);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
-	buf->wrap   = buf->buf + size;
-	buf->size   = size;
-	buf->base_size = size;
+	buf->wrap   = buf->buf + buf->size;
+	buf->base_size = buf->size;
 	mutex_create_p(buf->mutex);
+#if LOCKFREE_BUF
+	buf->busy[BUF_READER] = buf->busy[BUF_WRITER] = 0;
+	buf->hold = 0;
+#endif
 }
 
 void buf_destroy(struct buffer *buf) {
 	if (buf->buf) {
-		free(buf->buf);
+		_buf_free(buf);
 		buf->buf = NULL;
 		buf->size = 0;
 		buf->base_size = 0;
@@ -22,17 +22,48 @@
 // decode thread
 
 #include "squeezelite.h"
+#include "util.h"
 
 #define READ_SIZE  512
 #define WRITE_SIZE 32 * 1024
 
+// decoder sleeps until woken, this is only a safety net
+#define DECODE_WAIT_MS	1000
+#define WAIT_NONE		((size_t) -1)
+
+#if DECODE_POOL
+// players with something to decode are queued for a fixed set of workers
+static struct {
+	mutex_type mutex;		// also protects players' wake, waiting and wait_*
+	cond_type cond;
+	struct thread_ctx_s *head, *tail;
+	pthread_t *threads;
+	int count, users;
+	bool running;
+} pool;
+
+static mutex_type pool_users_mutex;	// serializes pool creation and teardown
+
+#define LOCK_W(ctx)		mutex_lock(pool.mutex)
+#define UNLOCK_W(ctx)	mutex_unlock(pool.mutex)
+#else
+#define LOCK_W(ctx)		mutex_lock((ctx)->decode.wake_mutex)
+#define UNLOCK_W(ctx)	mutex_unlock((ctx)->decode.wake_mutex)
+#endif
+
 extern log_level 	decode_loglevel;
 static log_level 	*loglevel = &decode_loglevel;
 
 struct codec	*codecs[MAX_CODECS];
+static mutex_type codecs_mutex;	// serializes codec libraries loading
 
+#if LOCKFREE_BUF
+#define LOCK_S
+#define UNLOCK_S
+#else
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
+#endif
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_D   mutex_lock(ctx->decode.mutex)
@@ -50,80 +81,307 @@ struct codec	*codecs[MAX_CODECS];
 
 
 /*---------------------------------------------------------------------------*/
-static void *decode_thread(struct thread_ctx_s *ctx) {
-	while (ctx->decode_running) {
-		size_t bytes, space, min_space;
-		bool toend;
-		bool ran = false;
+// one decoder round, when nothing could be done tells what it waits for
+static bool _decode_round(struct thread_ctx_s *ctx, size_t *wait_bytes, size_t *wait_space) {
+	size_t bytes, space, min_space;
+	bool toend;
+	bool ran = false;
 
-		LOCK_S;
-		bytes = _buf_used(ctx->streambuf);
-		toend = (ctx->stream.state <= DISCONNECT);
-		UNLOCK_S;
-		LOCK_O;
-		space = _buf_space(ctx->outputbuf);
-		UNLOCK_O;
+	*wait_bytes = *wait_space = WAIT_NONE;
 
-		LOCK_D;
+	// hints read without mutex, codecs check again from their side
+	bytes = buf_used(ctx->streambuf);
+	space = buf_space(ctx->outputbuf);
 
-		if (ctx->decode.state == DECODE_RUNNING && ctx->codec) {
+	LOCK_D;
 
-			LOG_SDEBUG("streambuf bytes: %u outputbuf space: %u", bytes, space);
+	if (ctx->decode.state == DECODE_RUNNING && ctx->codec) {
+
+		LOG_SDEBUG("streambuf bytes: %u outputbuf space: %u", bytes, space);
+
+		IF_DIRECT(
+			min_space = ctx->codec->min_space;
+		);
+		IF_PROCESS(
+			min_space = ctx->process.max_out_frames * BYTES_PER_FRAME;
+		);
+
+		// end of stream only matters when starving
+		if (bytes <= ctx->codec->min_read_bytes) {
+			LOCK_S;
+			toend = (STREAM_STATE(ctx) <= DISCONNECT);
+			bytes = _buf_used(ctx->streambuf);
+			UNLOCK_S;
+		} else toend = false;
+
+		if (space > min_space && (bytes > ctx->codec->min_read_bytes || toend)) {
+
+			ctx->decode.state = ctx->codec->decode(ctx);
 
-			IF_DIRECT(
-				min_space = ctx->codec->min_space;
-			);
 			IF_PROCESS(
-				min_space = ctx->process.max_out_frames * BYTES_PER_FRAME;
+				if (ctx->process.in_frames) {
+					process_samples(ctx);
+				}
+
+				if (ctx->decode.state == DECODE_COMPLETE) {
+					process_drain(ctx);
+				}
 			);
 
-			if (space > min_space && (bytes > ctx->codec->min_read_bytes || toend)) {
+			if (ctx->decode.state != DECODE_RUNNING) {
 
-				ctx->decode.state = ctx->codec->decode(ctx);
+				LOG_INFO("decode %s", ctx->decode.state == DECODE_COMPLETE ? "complete" : "error");
 
-				IF_PROCESS(
-					if (ctx->process.in_frames) {
-						process_samples(ctx);
-					}
+				LOCK_O;
+				if (ctx->output.fade_mode) _checkfade(false, ctx);
+				UNLOCK_O;
 
-					if (ctx->decode.state == DECODE_COMPLETE) {
-						process_drain(ctx);
-					}
-				);
+				wake_controller(ctx);
+			}
 
-				if (ctx->decode.state != DECODE_RUNNING) {
+			ran = true;
+		} else {
+			// tell stream and output what they shall wait for before waking us up
+			if (space <= min_space) *wait_space = min_space;
+			if (bytes <= ctx->codec->min_read_bytes && !toend) *wait_bytes = ctx->codec->min_read_bytes;
+		}
+	}
 
-					LOG_INFO("decode %s", ctx->decode.state == DECODE_COMPLETE ? "complete" : "error");
+	UNLOCK_D;
 
-					LOCK_O;
-					if (ctx->output.fade_mode) _checkfade(false, ctx);
-					UNLOCK_O;
+	// stream might be idle waiting for room in streambuf
+	if (ran) wake_stream_space(ctx);
 
-					wake_controller(ctx);
-				}
+	return ran;
+}
+
+#if DECODE_POOL
+/*---------------------------------------------------------------------------*/
+static void _pool_push(struct thread_ctx_s *ctx) {
+	ctx->decode.next = NULL;
+	if (pool.tail) pool.tail->decode.next = ctx;
+	else pool.head = ctx;
+	pool.tail = ctx;
+	ctx->decode.queued = true;
+	cond_signal(pool.cond);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _pool_remove(struct thread_ctx_s *ctx) {
+	struct thread_ctx_s **p;
+
+	for (p = &pool.head; *p && *p != ctx; p = &(*p)->decode.next);
+	if (!*p) return;
 
-				ran = true;
+	*p = ctx->decode.next;
+	if (pool.tail == ctx) {
+		for (pool.tail = pool.head; pool.tail && pool.tail->decode.next; pool.tail = pool.tail->decode.next);
+	}
+	ctx->decode.queued = false;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *decode_worker(void *arg) {
+	mutex_lock(pool.mutex);
+
+	while (pool.running) {
+		struct thread_ctx_s *ctx = pool.head;
+		size_t wait_bytes, wait_space;
+		bool ran;
+
+		if (!ctx) {
+			// same safety net as dedicated threads, re-check everybody
+			if (cond_timedwait(pool.cond, pool.mutex, DECODE_WAIT_MS) == ETIMEDOUT) {
+				int i;
+				for (i = 0; i < MAX_PLAYER; i++) {
+					ctx = thread_ctx + i;
+					if (!ctx->decode_running || !ctx->decode.waiting) continue;
+					ctx->decode.waiting = false;
+					_pool_push(ctx);
+				}
 			}
+			continue;
+		}
+
+		// one round per turn, so that all players are served fairly
+		pool.head = ctx->decode.next;
+		if (!pool.head) pool.tail = NULL;
+		ctx->decode.queued = false;
+		ctx->decode.busy = true;
+		ctx->decode.wake = false;
+		mutex_unlock(pool.mutex);
+
+		ran = _decode_round(ctx, &wait_bytes, &wait_space);
+
+		mutex_lock(pool.mutex);
+		ctx->decode.busy = false;
+
+		// decode_close might wait for us to be done
+		if (!ctx->decode_running) {
+			cond_signal(ctx->decode.wake_cond);
+			continue;
+		}
+
+		if (ran || ctx->decode.wake) {
+			_pool_push(ctx);
+		} else {
+			ctx->decode.wait_bytes = wait_bytes;
+			ctx->decode.wait_space = wait_space;
+			ctx->decode.waiting = true;
+		}
+	}
+
+	mutex_unlock(pool.mutex);
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static void _pool_open(struct thread_ctx_s *ctx) {
+	mutex_lock(pool_users_mutex);
+	if (!pool.users++) {
+		pthread_attr_t attr;
+		int i;
+
+		pool.count = max(sysconf(_SC_NPROCESSORS_ONLN), 1);
+		pool.threads = malloc(pool.count * sizeof(pthread_t));
+		pool.head = pool.tail = NULL;
+		pool.running = true;
+		mutex_create(pool.mutex);
+		cond_create(pool.cond);
+
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + DECODE_THREAD_STACK_SIZE);
+		for (i = 0; i < pool.count; i++) {
+			pthread_create(pool.threads + i, &attr, decode_worker, NULL);
 		}
+		pthread_attr_destroy(&attr);
+
+		LOG_INFO("[%p]: decode pool of %d workers", ctx, pool.count);
+	}
+	mutex_unlock(pool_users_mutex);
 
-		UNLOCK_D;
+	// first round is immediate, like a dedicated thread would do
+	mutex_lock(pool.mutex);
+	ctx->decode.busy = false;
+	_pool_push(ctx);
+	mutex_unlock(pool.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _pool_close(struct thread_ctx_s *ctx) {
+	// decode_running is already false, just wait for a worker to be done
+	mutex_lock(pool.mutex);
+	if (ctx->decode.queued) _pool_remove(ctx);
+	while (ctx->decode.busy) cond_timedwait(ctx->decode.wake_cond, pool.mutex, DECODE_WAIT_MS);
+	mutex_unlock(pool.mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+static void _pool_release(void) {
+	int i;
+
+	mutex_lock(pool_users_mutex);
+
+	if (!--pool.users) {
+		mutex_lock(pool.mutex);
+		pool.running = false;
+		for (i = 0; i < pool.count; i++) cond_signal(pool.cond);
+		mutex_unlock(pool.mutex);
+
+		for (i = 0; i < pool.count; i++) pthread_join(pool.threads[i], NULL);
+		free(pool.threads);
+		mutex_destroy(pool.mutex);
+		cond_destroy(pool.cond);
+	}
+
+	mutex_unlock(pool_users_mutex);
+}
+
+#else
+/*---------------------------------------------------------------------------*/
+static void *decode_thread(struct thread_ctx_s *ctx) {
+	while (ctx->decode_running) {
+		size_t wait_bytes, wait_space;
+		bool ran;
+
+		// any wake-up from now on means conditions must be checked again
+		mutex_lock(ctx->decode.wake_mutex);
+		ctx->decode.wake = false;
+		mutex_unlock(ctx->decode.wake_mutex);
+
+		ran = _decode_round(ctx, &wait_bytes, &wait_space);
 
 		if (!ran) {
-			usleep(100000);
+			mutex_lock(ctx->decode.wake_mutex);
+			ctx->decode.wait_bytes = wait_bytes;
+			ctx->decode.wait_space = wait_space;
+			ctx->decode.waiting = true;
+			if (!ctx->decode.wake && ctx->decode_running) {
+				cond_timedwait(ctx->decode.wake_cond, ctx->decode.wake_mutex, DECODE_WAIT_MS);
+			}
+			ctx->decode.waiting = false;
+			mutex_unlock(ctx->decode.wake_mutex);
 		}
 	}
 
 	return 0;
 }
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+static void _wake_decode(bool force, size_t bytes, size_t space, struct thread_ctx_s *ctx) {
+	LOCK_W(ctx);
+	// stream thread outlives decoder on close
+	if (!ctx->decode_running) {
+		UNLOCK_W(ctx);
+		return;
+	}
+
+	// while not waiting, decoder is evaluating and might have missed that
+	if (force || !ctx->decode.waiting || bytes > ctx->decode.wait_bytes || space > ctx->decode.wait_space) {
+		ctx->decode.wake = true;
+#if DECODE_POOL
+		if (ctx->decode.waiting) {
+			ctx->decode.waiting = false;
+			_pool_push(ctx);
+		}
+#else
+		cond_signal(ctx->decode.wake_cond);
+#endif
+	}
+	UNLOCK_W(ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+void wake_decode(struct thread_ctx_s *ctx) {
+	_wake_decode(true, 0, 0, ctx);
+}
 
+/*---------------------------------------------------------------------------*/
+void wake_decode_bytes(size_t bytes, struct thread_ctx_s *ctx) {
+	_wake_decode(false, bytes, 0, ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+void wake_decode_space(size_t space, struct thread_ctx_s *ctx) {
+	_wake_decode(false, 0, space, ctx);
+}
 
 /*---------------------------------------------------------------------------*/
 void decode_init(void) {
 	int i = 0;
 
+	mutex_create(codecs_mutex);
+#if DECODE_POOL
+	mutex_create(pool_users_mutex);
+#endif
+
+	// libraries are loaded on first open, mpg is used when mad can't be
 	codecs[i++] = register_pcm();
-	if ((codecs[i] = register_mad()) == NULL) codecs[i] = register_mpg();
-	i++;
+	codecs[i++] = register_mad();
+	codecs[i++] = register_mpg();
 	codecs[i++] = register_alac();
 	codecs[i++] = register_flac();
 	codecs[i++] = register_faad();
@@ -147,16 +405,27 @@ void decode_end(void) {
 	deregister_opus();
 #if RESAMPLE
 	deregister_soxr();
+#endif
+	mutex_destroy(codecs_mutex);
+#if DECODE_POOL
+	mutex_destroy(pool_users_mutex);
 #endif
 }
 
 
 /*---------------------------------------------------------------------------*/
 void decode_thread_init(struct thread_ctx_s *ctx) {
+#if !DECODE_POOL
 	pthread_attr_t attr;
+#endif
 
 	LOG_DEBUG("[%p]: init decode", ctx);
 	mutex_create(ctx->decode.mutex);
+#if !DECODE_POOL
+	mutex_create(ctx->decode.wake_mutex);
+#endif
+	cond_create(ctx->decode.wake_cond);
+	ctx->decode.wake = ctx->decode.waiting = false;
 
 	ctx->decode_running = true;
 	ctx->decode.new_stream = true;
@@ -171,10 +440,14 @@ void decode_thread_init(struct thread_ctx_s *ctx) {
 		ctx->decode.process = false;
 	);
 
+#if DECODE_POOL
+	_pool_open(ctx);
+#else
 	pthread_attr_init(&attr);
 	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + DECODE_THREAD_STACK_SIZE);
 	pthread_create(&ctx->decode_thread, &attr, (void *(*)(void*)) decode_thread, ctx);
 	pthread_attr_destroy(&attr);
+#endif
 }
 
 /*---------------------------------------------------------------------------*/
@@ -186,12 +459,33 @@ void decode_close(struct thread_ctx_s *ctx) {
 		ctx->codec->close(ctx);
 		ctx->codec = NULL;
 	}
-	ctx->decode_running = false;
 	UNLOCK_D;
+	LOCK_W(ctx);
+	ctx->decode_running = false;
+	ctx->decode.wake = true;
+#if !DECODE_POOL
+	cond_signal(ctx->decode.wake_cond);
+#endif
+	UNLOCK_W(ctx);
+#if DECODE_POOL
+	_pool_close(ctx);
+#else
 	pthread_join(ctx->decode_thread, NULL);
+#endif
 	mutex_destroy(ctx->decode.mutex);
 }
 
+/*---------------------------------------------------------------------------*/
+// stream thread can still wake decoder until it is closed, so this comes after
+void decode_wake_close(struct thread_ctx_s *ctx) {
+#if DECODE_POOL
+	_pool_release();
+#else
+	mutex_destroy(ctx->decode.wake_mutex);
+#endif
+	cond_destroy(ctx->decode.wake_cond);
+}
+
 /*---------------------------------------------------------------------------*/
 void decode_flush(struct thread_ctx_s *ctx) {
 
@@ -215,11 +509,28 @@ unsigned decode_newstream(unsigned sample_rate, int supported_rates[], struct th
 			sample_rate = process_newstream(&ctx->decode.direct, sample_rate, supported_rates, ctx);
 			LOCK_O;
 		}
+		// the resampler only takes internal samples
+		if (!ctx->decode.direct) ctx->decode.light &= ~LIGHT_FLOAT;
 	);
 
+	// float codecs set it again when they keep float frames
+	ctx->output.next_float = false;
+
 	return sample_rate;
 }
 
+/*---------------------------------------------------------------------------*/
+static bool _codec_load(struct codec *codec) {
+	mutex_lock(codecs_mutex);
+	if (!codec->loaded) {
+		codec->loaded = (!codec->load || codec->load()) ? 1 : -1;
+		if (codec->loaded < 0) LOG_WARN("cannot load library for %s", codec->types);
+	}
+	mutex_unlock(codecs_mutex);
+
+	return codec->loaded > 0;
+}
+
 /*---------------------------------------------------------------------------*/
 bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx) {
 	int i;
@@ -238,7 +549,7 @@ bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels,
 	// find the required codec
 	for (i = 0; i < MAX_CODECS; ++i) {
 
-		if (codecs[i] && codecs[i]->id == codec) {
+		if (codecs[i] && codecs[i]->id == codec && _codec_load(codecs[i])) {
 
 			if (ctx->codec && ctx->codec != codecs[i]) {
 				LOG_DEBUG("closing codec: '%c'", ctx->codec->id);
@@ -246,10 +557,12 @@ bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels,
 			}
 
 			ctx->codec = codecs[i];
+			ctx->decode.light = ctx->output.light;
 			ctx->codec->open(sample_size, sample_rate, channels, endianness, ctx);
 			ctx->decode.state = DECODE_READY;
 
 			UNLOCK_D;
+			wake_decode(ctx);
 			return true;
 		}
 	}
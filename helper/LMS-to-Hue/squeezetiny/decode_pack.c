@@ -0,0 +1,860 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2015, triode1@btinternet.com
+ *  (c) Philippe, philippe_44@outlook.com for raop/multi-instance modifications
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Unpack and interleave functions shared by codecs to fill outputbuf
+
+#include "squeezelite.h"
+#include "cpu_util.h"
+
+// vector kernels only produce 32 bits internal samples
+#define DPACK_X86	(CPU_X86 && BYTES_PER_FRAME == 8)
+#define DPACK_NEON	(CPU_NEON && BYTES_PER_FRAME == 8)
+
+#if DPACK_X86
+#include <immintrin.h>
+#elif DPACK_NEON
+#include <arm_neon.h>
+#endif
+
+extern log_level	decode_loglevel;
+static log_level 	*loglevel = &decode_loglevel;
+
+/*
+ Vector kernels only process whole vectors and return the number of frames
+ they have handled, scalar code does the remainder and results are bit-exact
+ with it. Output is always interleaved stereo, mono is copied to both sides
+*/
+typedef frames_t (*unpack_fn)(ISAMPLE_T *optr, u8_t *iptr, frames_t frames);
+
+static struct {
+	char *name;
+	unpack_fn s16_le, s16_be;
+	unpack_fn s16_mono_le, s16_mono_be;
+	unpack_fn s24_le, s24_be;
+	frames_t (*planar)(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned shift);
+	frames_t (*fixed)(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned fracbits);
+	frames_t (*interleaved)(ISAMPLE_T *optr, s32_t *iptr, frames_t frames, unsigned channels, unsigned shift);
+	frames_t (*flt)(ISAMPLE_T *optr, float *iptr, frames_t frames, unsigned channels);
+	frames_t (*flt_planar)(ISAMPLE_T *optr, float *lptr, float *rptr, frames_t frames);
+} decode_kernels = { "scalar" };
+
+// compose an internal sample from its bytes, most significant first
+#if BYTES_PER_FRAME == 4
+#define PCM16(hi, lo)		((ISAMPLE_T) ((hi) << 8 | (lo)))
+#define PCM24(hi, mid, lo)	PCM16(hi, mid)
+#define PCM32(hi, mid, lo, low)	PCM16(hi, mid)
+#else
+#define PCM16(hi, lo)		((ISAMPLE_T) ((u32_t) (hi) << 24 | (u32_t) (lo) << 16))
+#define PCM24(hi, mid, lo)	((ISAMPLE_T) ((u32_t) (hi) << 24 | (u32_t) (mid) << 16 | (u32_t) (lo) << 8))
+#define PCM32(hi, mid, lo, low)	((ISAMPLE_T) ((u32_t) (hi) << 24 | (u32_t) (mid) << 16 | (u32_t) (lo) << 8 | (low)))
+#endif
+
+// move a right-aligned sample to the top of an s32, then to internal size
+#if BYTES_PER_FRAME == 4
+#define JUSTIFY(n, shift)	((ISAMPLE_T) ((s32_t) ((u32_t) (n) << (shift)) >> 16))
+#else
+#define JUSTIFY(n, shift)	((ISAMPLE_T) ((u32_t) (n) << (shift)))
+#endif
+
+// shift an internal sample without overflowing signed arithmetic
+#define SHIFT(n, shift)		((ISAMPLE_T) ((u32_t) (n) << (shift)))
+
+// largest float below 1.0, so that scaling by 2^31 never overflows
+#define FLOAT_MAX	0.99999994f
+
+/*---------------------------------------------------------------------------*/
+// based on libmad minimad.c scale
+static inline ISAMPLE_T _fixed(s32_t sample, unsigned fracbits) {
+	s32_t one = 1L << fracbits;
+
+	sample += (1L << (fracbits - 24));
+
+	if (sample >= one)
+		sample = one - 1;
+	else if (sample < -one)
+		sample = -one;
+
+#if BYTES_PER_FRAME == 4
+	return (ISAMPLE_T)((sample >> (fracbits + 1 - 24)) >> 8);
+#else
+	return (ISAMPLE_T)((sample >> (fracbits + 1 - 24)) << 8);
+#endif
+}
+
+static inline ISAMPLE_T _float(float sample) {
+	// written so that NaN ends up as -1.0, like vector max
+	if (!(sample >= -1.0f)) sample = -1.0f;
+	else if (sample > FLOAT_MAX) sample = FLOAT_MAX;
+
+#if BYTES_PER_FRAME == 4
+	return (ISAMPLE_T) ((s32_t) (sample * 2147483648.0f) >> 16);
+#else
+	return (ISAMPLE_T) (sample * 2147483648.0f);
+#endif
+}
+
+#if DPACK_X86
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static inline __m128i _swap16_sse2(__m128i v) {
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static frames_t _s16_sse2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	__m128i *o = (__m128i *) optr, zero = _mm_setzero_si128();
+	frames_t n = frames & ~3, i;
+
+	// 4 frames (8 samples) per loop
+	for (i = 0; i < n; i += 4, iptr += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *) iptr);
+		if (be) v = _swap16_sse2(v);
+		_mm_storeu_si128(o++, _mm_unpacklo_epi16(zero, v));
+		_mm_storeu_si128(o++, _mm_unpackhi_epi16(zero, v));
+	}
+
+	return n;
+}
+
+__attribute__((target("sse2")))
+static frames_t _s16_mono_sse2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	__m128i *o = (__m128i *) optr, zero = _mm_setzero_si128();
+	frames_t n = frames & ~7, i;
+
+	// 8 frames (8 samples) per loop, each duplicated to both channels
+	for (i = 0; i < n; i += 8, iptr += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *) iptr), lo, hi;
+		if (be) v = _swap16_sse2(v);
+		lo = _mm_unpacklo_epi16(zero, v);
+		hi = _mm_unpackhi_epi16(zero, v);
+		_mm_storeu_si128(o++, _mm_unpacklo_epi32(lo, lo));
+		_mm_storeu_si128(o++, _mm_unpackhi_epi32(lo, lo));
+		_mm_storeu_si128(o++, _mm_unpacklo_epi32(hi, hi));
+		_mm_storeu_si128(o++, _mm_unpackhi_epi32(hi, hi));
+	}
+
+	return n;
+}
+
+static frames_t _s16_le_sse2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_sse2(optr, iptr, frames, false); }
+static frames_t _s16_be_sse2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_sse2(optr, iptr, frames, true); }
+static frames_t _s16_mono_le_sse2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_mono_sse2(optr, iptr, frames, false); }
+static frames_t _s16_mono_be_sse2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_mono_sse2(optr, iptr, frames, true); }
+
+__attribute__((target("sse2")))
+static frames_t _planar_sse2(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned shift) {
+	__m128i *o = (__m128i *) optr, count = _mm_cvtsi32_si128(shift);
+	frames_t n = frames & ~3, i;
+
+	for (i = 0; i < n; i += 4) {
+		__m128i l = _mm_sll_epi32(_mm_loadu_si128((__m128i *) (lptr + i)), count);
+		__m128i r = _mm_sll_epi32(_mm_loadu_si128((__m128i *) (rptr + i)), count);
+		_mm_storeu_si128(o++, _mm_unpacklo_epi32(l, r));
+		_mm_storeu_si128(o++, _mm_unpackhi_epi32(l, r));
+	}
+
+	return n;
+}
+
+// no signed 32 bits min/max in sse2, select with compare masks
+__attribute__((target("sse2")))
+static inline __m128i _fixed_sse2(__m128i v, __m128i round, __m128i max, __m128i min, __m128i count) {
+	__m128i m;
+
+	v = _mm_add_epi32(v, round);
+	m = _mm_cmpgt_epi32(v, max);
+	v = _mm_or_si128(_mm_and_si128(m, max), _mm_andnot_si128(m, v));
+	m = _mm_cmplt_epi32(v, min);
+	v = _mm_or_si128(_mm_and_si128(m, min), _mm_andnot_si128(m, v));
+	return _mm_slli_epi32(_mm_sra_epi32(v, count), 8);
+}
+
+__attribute__((target("sse2")))
+static frames_t _fixed_frames_sse2(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned fracbits) {
+	__m128i *o = (__m128i *) optr, count = _mm_cvtsi32_si128(fracbits + 1 - 24);
+	__m128i round = _mm_set1_epi32(1L << (fracbits - 24));
+	__m128i max = _mm_set1_epi32((1L << fracbits) - 1), min = _mm_set1_epi32(-(1L << fracbits));
+	frames_t n = frames & ~3, i;
+
+	for (i = 0; i < n; i += 4) {
+		__m128i l = _fixed_sse2(_mm_loadu_si128((__m128i *) (lptr + i)), round, max, min, count);
+		__m128i r = _fixed_sse2(_mm_loadu_si128((__m128i *) (rptr + i)), round, max, min, count);
+		_mm_storeu_si128(o++, _mm_unpacklo_epi32(l, r));
+		_mm_storeu_si128(o++, _mm_unpackhi_epi32(l, r));
+	}
+
+	return n;
+}
+
+__attribute__((target("sse2")))
+static frames_t _interleaved_sse2(ISAMPLE_T *optr, s32_t *iptr, frames_t frames, unsigned channels, unsigned shift) {
+	__m128i *o = (__m128i *) optr, count = _mm_cvtsi32_si128(shift);
+	frames_t n = frames & ~3, i;
+
+	if (channels == 2) {
+		for (i = 0; i < n; i += 4, iptr += 8) {
+			_mm_storeu_si128(o++, _mm_sll_epi32(_mm_loadu_si128((__m128i *) iptr), count));
+			_mm_storeu_si128(o++, _mm_sll_epi32(_mm_loadu_si128((__m128i *) (iptr + 4)), count));
+		}
+	} else {
+		for (i = 0; i < n; i += 4, iptr += 4) {
+			__m128i v = _mm_sll_epi32(_mm_loadu_si128((__m128i *) iptr), count);
+			_mm_storeu_si128(o++, _mm_unpacklo_epi32(v, v));
+			_mm_storeu_si128(o++, _mm_unpackhi_epi32(v, v));
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i _float_sse2(__m128 v) {
+	// max returns its 2nd operand on NaN
+	v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(FLOAT_MAX));
+	return _mm_cvttps_epi32(_mm_mul_ps(v, _mm_set1_ps(2147483648.0f)));
+}
+
+__attribute__((target("sse2")))
+static frames_t _float_frames_sse2(ISAMPLE_T *optr, float *iptr, frames_t frames, unsigned channels) {
+	__m128i *o = (__m128i *) optr;
+	frames_t n = frames & ~3, i;
+
+	if (channels == 2) {
+		for (i = 0; i < n; i += 4, iptr += 8) {
+			_mm_storeu_si128(o++, _float_sse2(_mm_loadu_ps(iptr)));
+			_mm_storeu_si128(o++, _float_sse2(_mm_loadu_ps(iptr + 4)));
+		}
+	} else {
+		for (i = 0; i < n; i += 4, iptr += 4) {
+			__m128i v = _float_sse2(_mm_loadu_ps(iptr));
+			_mm_storeu_si128(o++, _mm_unpacklo_epi32(v, v));
+			_mm_storeu_si128(o++, _mm_unpackhi_epi32(v, v));
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("sse2")))
+static frames_t _float_planar_sse2(ISAMPLE_T *optr, float *lptr, float *rptr, frames_t frames) {
+	__m128i *o = (__m128i *) optr;
+	frames_t n = frames & ~3, i;
+
+	for (i = 0; i < n; i += 4) {
+		__m128i l = _float_sse2(_mm_loadu_ps(lptr + i)), r = _float_sse2(_mm_loadu_ps(rptr + i));
+		_mm_storeu_si128(o++, _mm_unpacklo_epi32(l, r));
+		_mm_storeu_si128(o++, _mm_unpackhi_epi32(l, r));
+	}
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static frames_t _s16_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	__m256i *o = (__m256i *) optr;
+	frames_t n = frames & ~7, i;
+
+	// 8 frames (16 samples) per loop
+	for (i = 0; i < n; i += 8, iptr += 32) {
+		__m128i a = _mm_loadu_si128((__m128i *) iptr), b = _mm_loadu_si128((__m128i *) (iptr + 16));
+		if (be) {
+			a = _swap16_sse2(a);
+			b = _swap16_sse2(b);
+		}
+		_mm256_storeu_si256(o++, _mm256_slli_epi32(_mm256_cvtepi16_epi32(a), 16));
+		_mm256_storeu_si256(o++, _mm256_slli_epi32(_mm256_cvtepi16_epi32(b), 16));
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static frames_t _s16_mono_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	__m256i *o = (__m256i *) optr;
+	__m256i dup_lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3), dup_hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+	frames_t n = frames & ~7, i;
+
+	// 8 frames (8 samples) per loop, each duplicated to both channels
+	for (i = 0; i < n; i += 8, iptr += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *) iptr);
+		__m256i s;
+		if (be) v = _swap16_sse2(v);
+		s = _mm256_slli_epi32(_mm256_cvtepi16_epi32(v), 16);
+		_mm256_storeu_si256(o++, _mm256_permutevar8x32_epi32(s, dup_lo));
+		_mm256_storeu_si256(o++, _mm256_permutevar8x32_epi32(s, dup_hi));
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static frames_t _s24_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	__m256i *o = (__m256i *) optr;
+	// move each 3 bytes sample to the top of an s32, low byte zeroed
+	__m256i shuffle = be ?
+		_mm256_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9,
+						 -1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9) :
+		_mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+						 -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	frames_t i;
+
+	// 4 frames (24 bytes) per loop but 16 bytes loads read 4 bytes beyond
+	for (i = 0; (i + 4) * 6 + 4 <= frames * 6; i += 4, iptr += 24) {
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) iptr)),
+											_mm_loadu_si128((__m128i *) (iptr + 12)), 1);
+		_mm256_storeu_si256(o++, _mm256_shuffle_epi8(v, shuffle));
+	}
+
+	return i;
+}
+
+static frames_t _s16_le_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_avx2(optr, iptr, frames, false); }
+static frames_t _s16_be_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_avx2(optr, iptr, frames, true); }
+static frames_t _s16_mono_le_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_mono_avx2(optr, iptr, frames, false); }
+static frames_t _s16_mono_be_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_mono_avx2(optr, iptr, frames, true); }
+static frames_t _s24_le_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s24_avx2(optr, iptr, frames, false); }
+static frames_t _s24_be_avx2(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s24_avx2(optr, iptr, frames, true); }
+
+// unpack works per 128 bits lane, put the halves back in order
+__attribute__((target("avx2")))
+static inline void _store_pairs_avx2(__m256i *o, __m256i l, __m256i r) {
+	__m256i lo = _mm256_unpacklo_epi32(l, r), hi = _mm256_unpackhi_epi32(l, r);
+	_mm256_storeu_si256(o, _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256(o + 1, _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+__attribute__((target("avx2")))
+static frames_t _planar_avx2(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned shift) {
+	__m256i *o = (__m256i *) optr;
+	__m128i count = _mm_cvtsi32_si128(shift);
+	frames_t n = frames & ~7, i;
+
+	for (i = 0; i < n; i += 8, o += 2) {
+		__m256i l = _mm256_sll_epi32(_mm256_loadu_si256((__m256i *) (lptr + i)), count);
+		__m256i r = _mm256_sll_epi32(_mm256_loadu_si256((__m256i *) (rptr + i)), count);
+		_store_pairs_avx2(o, l, r);
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _fixed_avx2(__m256i v, __m256i round, __m256i max, __m256i min, __m128i count) {
+	v = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(v, round), min), max);
+	return _mm256_slli_epi32(_mm256_sra_epi32(v, count), 8);
+}
+
+__attribute__((target("avx2")))
+static frames_t _fixed_frames_avx2(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned fracbits) {
+	__m256i *o = (__m256i *) optr;
+	__m128i count = _mm_cvtsi32_si128(fracbits + 1 - 24);
+	__m256i round = _mm256_set1_epi32(1L << (fracbits - 24));
+	__m256i max = _mm256_set1_epi32((1L << fracbits) - 1), min = _mm256_set1_epi32(-(1L << fracbits));
+	frames_t n = frames & ~7, i;
+
+	for (i = 0; i < n; i += 8, o += 2) {
+		__m256i l = _fixed_avx2(_mm256_loadu_si256((__m256i *) (lptr + i)), round, max, min, count);
+		__m256i r = _fixed_avx2(_mm256_loadu_si256((__m256i *) (rptr + i)), round, max, min, count);
+		_store_pairs_avx2(o, l, r);
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static frames_t _interleaved_avx2(ISAMPLE_T *optr, s32_t *iptr, frames_t frames, unsigned channels, unsigned shift) {
+	__m256i *o = (__m256i *) optr;
+	__m128i count = _mm_cvtsi32_si128(shift);
+	frames_t n = frames & ~7, i;
+
+	if (channels == 2) {
+		for (i = 0; i < n; i += 8, iptr += 16) {
+			_mm256_storeu_si256(o++, _mm256_sll_epi32(_mm256_loadu_si256((__m256i *) iptr), count));
+			_mm256_storeu_si256(o++, _mm256_sll_epi32(_mm256_loadu_si256((__m256i *) (iptr + 8)), count));
+		}
+	} else {
+		for (i = 0; i < n; i += 8, iptr += 8, o += 2) {
+			__m256i v = _mm256_sll_epi32(_mm256_loadu_si256((__m256i *) iptr), count);
+			_store_pairs_avx2(o, v, v);
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _float_avx2(__m256 v) {
+	// max returns its 2nd operand on NaN
+	v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(FLOAT_MAX));
+	return _mm256_cvttps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(2147483648.0f)));
+}
+
+__attribute__((target("avx2")))
+static frames_t _float_frames_avx2(ISAMPLE_T *optr, float *iptr, frames_t frames, unsigned channels) {
+	__m256i *o = (__m256i *) optr;
+	frames_t n = frames & ~7, i;
+
+	if (channels == 2) {
+		for (i = 0; i < n; i += 8, iptr += 16) {
+			_mm256_storeu_si256(o++, _float_avx2(_mm256_loadu_ps(iptr)));
+			_mm256_storeu_si256(o++, _float_avx2(_mm256_loadu_ps(iptr + 8)));
+		}
+	} else {
+		for (i = 0; i < n; i += 8, iptr += 8, o += 2) {
+			__m256i v = _float_avx2(_mm256_loadu_ps(iptr));
+			_store_pairs_avx2(o, v, v);
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static frames_t _float_planar_avx2(ISAMPLE_T *optr, float *lptr, float *rptr, frames_t frames) {
+	__m256i *o = (__m256i *) optr;
+	frames_t n = frames & ~7, i;
+
+	for (i = 0; i < n; i += 8, o += 2) {
+		_store_pairs_avx2(o, _float_avx2(_mm256_loadu_ps(lptr + i)), _float_avx2(_mm256_loadu_ps(rptr + i)));
+	}
+
+	return n;
+}
+#endif
+
+#if DPACK_NEON
+/*---------------------------------------------------------------------------*/
+CPU_NEON_TARGET
+static frames_t _s16_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	frames_t n = frames & ~3, i;
+
+	// 4 frames (8 samples) per loop
+	for (i = 0; i < n; i += 4, iptr += 16, optr += 8) {
+		uint8x16_t b = vld1q_u8(iptr);
+		int16x8_t v;
+		if (be) b = vrev16q_u8(b);
+		v = vreinterpretq_s16_u8(b);
+		vst1q_s32(optr, vshll_n_s16(vget_low_s16(v), 16));
+		vst1q_s32(optr + 4, vshll_n_s16(vget_high_s16(v), 16));
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static frames_t _s16_mono_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	frames_t n = frames & ~3, i;
+
+	// 4 frames (4 samples) per loop, each duplicated to both channels
+	for (i = 0; i < n; i += 4, iptr += 8, optr += 8) {
+		uint8x8_t b = vld1_u8(iptr);
+		int32x4_t s;
+		int32x4x2_t d;
+		if (be) b = vrev16_u8(b);
+		s = vshll_n_s16(vreinterpret_s16_u8(b), 16);
+		d = vzipq_s32(s, s);
+		vst1q_s32(optr, d.val[0]);
+		vst1q_s32(optr + 4, d.val[1]);
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static frames_t _s24_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool be) {
+	frames_t n = frames & ~3, i;
+	uint8x8_t zero = vdup_n_u8(0);
+
+	// 4 frames (8 samples) per loop, bytes are de-interleaved by vld3
+	for (i = 0; i < n; i += 4, iptr += 24, optr += 8) {
+		uint8x8x3_t v = vld3_u8(iptr);
+		uint8x8_t lo = be ? v.val[2] : v.val[0], hi = be ? v.val[0] : v.val[2];
+		uint8x8x2_t a = vzip_u8(zero, lo), b = vzip_u8(v.val[1], hi);
+		uint16x8_t a16 = vreinterpretq_u16_u8(vcombine_u8(a.val[0], a.val[1]));
+		uint16x8_t b16 = vreinterpretq_u16_u8(vcombine_u8(b.val[0], b.val[1]));
+		uint16x8x2_t s = vzipq_u16(a16, b16);
+		vst1q_s32(optr, vreinterpretq_s32_u16(s.val[0]));
+		vst1q_s32(optr + 4, vreinterpretq_s32_u16(s.val[1]));
+	}
+
+	return n;
+}
+
+static frames_t _s16_le_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_neon(optr, iptr, frames, false); }
+static frames_t _s16_be_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_neon(optr, iptr, frames, true); }
+static frames_t _s16_mono_le_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_mono_neon(optr, iptr, frames, false); }
+static frames_t _s16_mono_be_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s16_mono_neon(optr, iptr, frames, true); }
+static frames_t _s24_le_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s24_neon(optr, iptr, frames, false); }
+static frames_t _s24_be_neon(ISAMPLE_T *optr, u8_t *iptr, frames_t frames) { return _s24_neon(optr, iptr, frames, true); }
+
+CPU_NEON_TARGET
+static frames_t _planar_neon(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned shift) {
+	int32x4_t count = vdupq_n_s32(shift);
+	frames_t n = frames & ~3, i;
+
+	for (i = 0; i < n; i += 4, optr += 8) {
+		int32x4x2_t v;
+		v.val[0] = vshlq_s32(vld1q_s32(lptr + i), count);
+		v.val[1] = vshlq_s32(vld1q_s32(rptr + i), count);
+		vst2q_s32(optr, v);
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static inline int32x4_t _fixed_neon(int32x4_t v, int32x4_t round, int32x4_t max, int32x4_t min, int32x4_t count) {
+	v = vminq_s32(vmaxq_s32(vaddq_s32(v, round), min), max);
+	// negative count is an arithmetic right shift
+	return vshlq_n_s32(vshlq_s32(v, count), 8);
+}
+
+CPU_NEON_TARGET
+static frames_t _fixed_frames_neon(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned fracbits) {
+	int32x4_t count = vdupq_n_s32(-(s32_t) (fracbits + 1 - 24)), round = vdupq_n_s32(1L << (fracbits - 24));
+	int32x4_t max = vdupq_n_s32((1L << fracbits) - 1), min = vdupq_n_s32(-(1L << fracbits));
+	frames_t n = frames & ~3, i;
+
+	for (i = 0; i < n; i += 4, optr += 8) {
+		int32x4x2_t v;
+		v.val[0] = _fixed_neon(vld1q_s32(lptr + i), round, max, min, count);
+		v.val[1] = _fixed_neon(vld1q_s32(rptr + i), round, max, min, count);
+		vst2q_s32(optr, v);
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static frames_t _interleaved_neon(ISAMPLE_T *optr, s32_t *iptr, frames_t frames, unsigned channels, unsigned shift) {
+	int32x4_t count = vdupq_n_s32(shift);
+	frames_t n = frames & ~3, i;
+
+	if (channels == 2) {
+		for (i = 0; i < n; i += 4, iptr += 8, optr += 8) {
+			vst1q_s32(optr, vshlq_s32(vld1q_s32(iptr), count));
+			vst1q_s32(optr + 4, vshlq_s32(vld1q_s32(iptr + 4), count));
+		}
+	} else {
+		for (i = 0; i < n; i += 4, iptr += 4, optr += 8) {
+			int32x4x2_t v;
+			v.val[0] = v.val[1] = vshlq_s32(vld1q_s32(iptr), count);
+			vst2q_s32(optr, v);
+		}
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static inline int32x4_t _float_neon(float32x4_t v) {
+	// NaN fails the compare so it is replaced by -1.0
+	float32x4_t m1 = vdupq_n_f32(-1.0f);
+	v = vbslq_f32(vcgeq_f32(v, m1), v, m1);
+	v = vminq_f32(v, vdupq_n_f32(FLOAT_MAX));
+	return vcvtq_s32_f32(vmulq_n_f32(v, 2147483648.0f));
+}
+
+CPU_NEON_TARGET
+static frames_t _float_frames_neon(ISAMPLE_T *optr, float *iptr, frames_t frames, unsigned channels) {
+	frames_t n = frames & ~3, i;
+
+	if (channels == 2) {
+		for (i = 0; i < n; i += 4, iptr += 8, optr += 8) {
+			vst1q_s32(optr, _float_neon(vld1q_f32(iptr)));
+			vst1q_s32(optr + 4, _float_neon(vld1q_f32(iptr + 4)));
+		}
+	} else {
+		for (i = 0; i < n; i += 4, iptr += 4, optr += 8) {
+			int32x4x2_t v;
+			v.val[0] = v.val[1] = _float_neon(vld1q_f32(iptr));
+			vst2q_s32(optr, v);
+		}
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static frames_t _float_planar_neon(ISAMPLE_T *optr, float *lptr, float *rptr, frames_t frames) {
+	frames_t n = frames & ~3, i;
+
+	for (i = 0; i < n; i += 4, optr += 8) {
+		int32x4x2_t v;
+		v.val[0] = _float_neon(vld1q_f32(lptr + i));
+		v.val[1] = _float_neon(vld1q_f32(rptr + i));
+		vst2q_s32(optr, v);
+	}
+
+	return n;
+}
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+void decode_pack_init(void) {
+#if DPACK_X86
+	if (cpu_features() & CPU_HAS_AVX2) {
+		decode_kernels.name = "avx2";
+		decode_kernels.s16_le = _s16_le_avx2;
+		decode_kernels.s16_be = _s16_be_avx2;
+		decode_kernels.s16_mono_le = _s16_mono_le_avx2;
+		decode_kernels.s16_mono_be = _s16_mono_be_avx2;
+		decode_kernels.s24_le = _s24_le_avx2;
+		decode_kernels.s24_be = _s24_be_avx2;
+		decode_kernels.planar = _planar_avx2;
+		decode_kernels.fixed = _fixed_frames_avx2;
+		decode_kernels.interleaved = _interleaved_avx2;
+		decode_kernels.flt = _float_frames_avx2;
+		decode_kernels.flt_planar = _float_planar_avx2;
+	} else if (cpu_features() & CPU_HAS_SSE2) {
+		// no byte shuffle in sse2, 24 bits stays scalar
+		decode_kernels.name = "sse2";
+		decode_kernels.s16_le = _s16_le_sse2;
+		decode_kernels.s16_be = _s16_be_sse2;
+		decode_kernels.s16_mono_le = _s16_mono_le_sse2;
+		decode_kernels.s16_mono_be = _s16_mono_be_sse2;
+		decode_kernels.planar = _planar_sse2;
+		decode_kernels.fixed = _fixed_frames_sse2;
+		decode_kernels.interleaved = _interleaved_sse2;
+		decode_kernels.flt = _float_frames_sse2;
+		decode_kernels.flt_planar = _float_planar_sse2;
+	}
+#elif DPACK_NEON
+	if (cpu_features() & CPU_HAS_NEON) {
+		decode_kernels.name = "neon";
+		decode_kernels.s16_le = _s16_le_neon;
+		decode_kernels.s16_be = _s16_be_neon;
+		decode_kernels.s16_mono_le = _s16_mono_le_neon;
+		decode_kernels.s16_mono_be = _s16_mono_be_neon;
+		decode_kernels.s24_le = _s24_le_neon;
+		decode_kernels.s24_be = _s24_be_neon;
+		decode_kernels.planar = _planar_neon;
+		decode_kernels.fixed = _fixed_frames_neon;
+		decode_kernels.interleaved = _interleaved_neon;
+		decode_kernels.flt = _float_frames_neon;
+		decode_kernels.flt_planar = _float_planar_neon;
+	}
+#endif
+	cpu_set_kernel("decode", decode_kernels.name);
+	LOG_INFO("using %s kernels for decode unpack and interleave", decode_kernels.name);
+}
+
+/*---------------------------------------------------------------------------*/
+// 2 bytes per sample, stereo or mono expanded to stereo
+void _unpack_s16(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, unsigned channels, bool big_endian) {
+	unpack_fn kernel;
+	frames_t done = 0;
+
+	if (channels == 2) kernel = big_endian ? decode_kernels.s16_be : decode_kernels.s16_le;
+	else kernel = big_endian ? decode_kernels.s16_mono_be : decode_kernels.s16_mono_le;
+
+	if (kernel) {
+		done = kernel(optr, iptr, frames);
+		optr += done * 2;
+		iptr += done * channels * 2;
+		frames -= done;
+	}
+
+#if BYTES_PER_FRAME == 4
+	// straight copy when internal samples are 16 bits
+	if (channels == 2 && !big_endian) {
+		memcpy(optr, iptr, frames * BYTES_PER_FRAME);
+		return;
+	}
+#endif
+
+	if (channels == 2) {
+		frames_t count = frames * 2;
+		if (big_endian) {
+			while (count--) {
+				*optr++ = PCM16(*iptr, *(iptr + 1));
+				iptr += 2;
+			}
+		} else {
+			while (count--) {
+				*optr++ = PCM16(*(iptr + 1), *iptr);
+				iptr += 2;
+			}
+		}
+	} else {
+		while (frames--) {
+			*optr = big_endian ? PCM16(*iptr, *(iptr + 1)) : PCM16(*(iptr + 1), *iptr);
+			*(optr + 1) = *optr;
+			optr += 2;
+			iptr += 2;
+		}
+	}
+}
+
+// 3 bytes per sample, stereo, lsb dropped for 16 bits samples
+void _unpack_s24(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool big_endian) {
+	unpack_fn kernel = big_endian ? decode_kernels.s24_be : decode_kernels.s24_le;
+	frames_t count;
+
+	if (kernel) {
+		frames_t done = kernel(optr, iptr, frames);
+		optr += done * 2;
+		iptr += done * 6;
+		frames -= done;
+	}
+
+	count = frames * 2;
+
+	if (big_endian) {
+		while (count--) {
+			*optr++ = PCM24(*iptr, *(iptr + 1), *(iptr + 2));
+			iptr += 3;
+		}
+	} else {
+		while (count--) {
+			*optr++ = PCM24(*(iptr + 2), *(iptr + 1), *iptr);
+			iptr += 3;
+		}
+	}
+}
+
+// 4 bytes per sample, stereo, read byte-wise so alignment and host endianness don't matter
+void _unpack_s32(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool big_endian) {
+	frames_t count = frames * 2;
+
+	if (big_endian) {
+		while (count--) {
+			*optr++ = PCM32(*iptr, *(iptr + 1), *(iptr + 2), *(iptr + 3));
+			iptr += 4;
+		}
+	} else {
+		while (count--) {
+			*optr++ = PCM32(*(iptr + 3), *(iptr + 2), *(iptr + 1), *iptr);
+			iptr += 4;
+		}
+	}
+}
+
+// one buffer per channel of right-aligned samples (flac)
+void _interleave_planar(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned bits) {
+	unsigned shift = 32 - bits;
+
+	if (decode_kernels.planar) {
+		frames_t done = decode_kernels.planar(optr, lptr, rptr, frames, shift);
+		optr += done * 2;
+		lptr += done;
+		rptr += done;
+		frames -= done;
+	}
+
+	while (frames--) {
+		*optr++ = JUSTIFY(*lptr++, shift);
+		*optr++ = JUSTIFY(*rptr++, shift);
+	}
+}
+
+// one buffer per channel of fixed point samples, rounded and clipped (mad)
+void _interleave_fixed(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned fracbits) {
+	if (decode_kernels.fixed) {
+		frames_t done = decode_kernels.fixed(optr, lptr, rptr, frames, fracbits);
+		optr += done * 2;
+		lptr += done;
+		rptr += done;
+		frames -= done;
+	}
+
+	while (frames--) {
+		*optr++ = _fixed(*lptr++, fracbits);
+		*optr++ = _fixed(*rptr++, fracbits);
+	}
+}
+
+// interleaved internal samples left shifted to full scale, 1 or 2 channels (faad)
+void _interleave_shift(ISAMPLE_T *optr, ISAMPLE_T *iptr, frames_t frames, unsigned channels, unsigned shift) {
+	if (decode_kernels.interleaved) {
+		frames_t done = decode_kernels.interleaved(optr, (s32_t *) iptr, frames, channels, shift);
+		optr += done * 2;
+		iptr += done * channels;
+		frames -= done;
+	}
+
+	if (channels == 2) {
+		frames_t count = frames * 2;
+		while (count--) *optr++ = SHIFT(*iptr++, shift);
+	} else {
+		while (frames--) {
+			*optr++ = SHIFT(*iptr, shift);
+			*optr++ = SHIFT(*iptr++, shift);
+		}
+	}
+}
+
+// interleaved float samples in [-1.0, 1.0[, clipped, 1 or 2 channels
+void _interleave_float(ISAMPLE_T *optr, float *iptr, frames_t frames, unsigned channels) {
+	if (decode_kernels.flt) {
+		frames_t done = decode_kernels.flt(optr, iptr, frames, channels);
+		optr += done * 2;
+		iptr += done * channels;
+		frames -= done;
+	}
+
+	if (channels == 2) {
+		frames_t count = frames * 2;
+		while (count--) *optr++ = _float(*iptr++);
+	} else {
+		while (frames--) {
+			*optr++ = _float(*iptr);
+			*optr++ = _float(*iptr++);
+		}
+	}
+}
+
+// one buffer per channel of float samples, same clipping as above (vorbis)
+void _interleave_float_planar(ISAMPLE_T *optr, float *lptr, float *rptr, frames_t frames) {
+	if (decode_kernels.flt_planar) {
+		frames_t done = decode_kernels.flt_planar(optr, lptr, rptr, frames);
+		optr += done * 2;
+		lptr += done;
+		rptr += done;
+		frames -= done;
+	}
+
+	while (frames--) {
+		*optr++ = _float(*lptr++);
+		*optr++ = _float(*rptr++);
+	}
+}
+
+// float frames kept as decoded for the analyzer (LIGHT_FLOAT), mono is duplicated
+void _store_float(float *optr, float *iptr, frames_t frames, unsigned channels) {
+	if (channels == 2) {
+		memcpy(optr, iptr, frames * 2 * sizeof(float));
+	} else {
+		while (frames--) {
+			*optr++ = *iptr;
+			*optr++ = *iptr++;
+		}
+	}
+}
+
+void _store_float_planar(float *optr, float *lptr, float *rptr, frames_t frames) {
+	while (frames--) {
+		*optr++ = *lptr++;
+		*optr++ = *rptr++;
+	}
+}
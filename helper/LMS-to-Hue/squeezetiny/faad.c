@@ -25,6 +25,18 @@
 
 #define WRAPBUF_LEN 2048
 
+// largest box (esds, ----) parsed whole, bigger ones are skipped
+#define MP4_SMALL_BOX 4096
+
+// decoder delivers samples in native endianness, 24 bits ones are right aligned in s32
+#if BYTES_PER_FRAME == 4
+#define FAAD_FMT		FAAD_FMT_16BIT
+#define FAAD_SHIFT		0
+#else
+#define FAAD_FMT		FAAD_FMT_24BIT
+#define FAAD_SHIFT		8
+#endif
+
 struct chunk_table {
 	u32_t sample, offset;
 };
@@ -60,23 +72,39 @@ struct faad {
 	unsigned long samplerate;
 	unsigned char channels;
 	unsigned trak, play;
+	// sample table being parsed across calls, size is 0 when none
+	struct {
+		char type[4];
+		u32_t size, entries, index, remain;
+	} table;
 };
 
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
-#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
-#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#else
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -105,21 +133,245 @@ static u32_t mp4_desc_length(u8_t **buf) {
 	return length;
 }
 
-// read mp4 header to extract config data
+// copy n bytes from readp even when they wrap round the end of buf
+static void _mp4_peek(struct buffer *buf, u8_t *dst, size_t n) {
+	size_t cont = min(n, (size_t) (buf->wrap - buf->readp));
+
+	memcpy(dst, buf->readp, cont);
+	if (n > cont) memcpy(dst + cont, buf->buf, n - cont);
+}
+
+// whole box at readp, only copied out when it wraps
+static u8_t *_mp4_box(struct buffer *buf, u32_t len, u8_t **copy) {
+	*copy = NULL;
+	if (_buf_cont_read(buf) >= len) return buf->readp;
+	if ((*copy = malloc(len)) != NULL) _mp4_peek(buf, *copy, len);
+	return *copy;
+}
+
+// extract audio config from within esds and pass to DecInit2
+static int mp4_esds(u8_t *ptr, unsigned long *samplerate_p, unsigned char *channels_p, struct thread_ctx_s *ctx) {
+	struct faad *a = ctx->decode.handle;
+	unsigned config_len;
+
+	ptr += 12;
+	if (*ptr++ == 0x03) {
+		mp4_desc_length(&ptr);
+		ptr += 4;
+	} else {
+		ptr += 3;
+	}
+	mp4_desc_length(&ptr);
+	ptr += 13;
+	if (*ptr++ != 0x05) {
+		LOG_WARN("[%p]: error parsing esds", ctx);
+		return -1;
+	}
+	config_len = mp4_desc_length(&ptr);
+	if (NEAAC(&ga, Init2, a->hAac, ptr, config_len, samplerate_p, channels_p) == 0) {
+		LOG_DEBUG("[%p]: playable aac track: %u", ctx, a->trak);
+		a->play = a->trak;
+	}
+
+	return 0;
+}
+
+// parse key-value atoms within ilst ---- entries to get encoder padding within iTunSMPB entry for gapless
+static void mp4_smpb(u8_t *ptr, u32_t len, struct thread_ctx_s *ctx) {
+	struct faad *a = ctx->decode.handle;
+	u32_t remain = len - 8, size;
+
+	ptr += 8;
+	if (!memcmp(ptr + 4, "mean", 4) && (size = unpackN((u32_t *)ptr)) < remain) {
+		ptr += size; remain -= size;
+	}
+	if (!memcmp(ptr + 4, "name", 4) && (size = unpackN((u32_t *)ptr)) < remain && !memcmp(ptr + 12, "iTunSMPB", 8)) {
+		ptr += size; remain -= size;
+	}
+	if (!memcmp(ptr + 4, "data", 4) && remain > 16 + 48) {
+		// data is stored as hex strings: 0 start end samples
+		u32_t b, c; u64_t d;
+		if (sscanf((const char *)(ptr + 16), "%x %x %x " FMT_x64, &b, &b, &c, &d) == 4) {
+			LOG_DEBUG("[%p]: iTunSMPB start: %u end: %u samples: " FMT_u64, ctx, b, c, d);
+			if (a->sttssamples && a->sttssamples < b + c + d) {
+				LOG_DEBUG("[%p]: reducing samples as stts count is less", ctx);
+				d = a->sttssamples - (b + c);
+			}
+			a->skip = b;
+			a->samples = d;
+		}
+	}
+}
+
+// fill in first sample id for each chunk from stored stsc
+static void mp4_chunk_samples(struct faad *a, u32_t entries) {
+	u32_t stsc_entries = unpackN((u32_t *)a->stsc);
+	u32_t sample = 0, i;
+	u32_t last = 0, last_samples = 0;
+	u8_t *ptr = (u8_t *)a->stsc + 4;
+
+	while (stsc_entries--) {
+		u32_t first = unpackN((u32_t *)ptr);
+		u32_t samples = unpackN((u32_t *)(ptr + 4));
+		if (last) {
+			for (i = last - 1; i < first - 1 && i < entries; ++i) {
+				a->chunkinfo[i].sample = sample;
+				sample += last_samples;
+			}
+		}
+		if (stsc_entries == 0) {
+			for (i = first - 1; i < entries; ++i) {
+				a->chunkinfo[i].sample = sample;
+				sample += samples;
+			}
+		}
+		last = first;
+		last_samples = samples;
+		ptr += 12;
+	}
+
+	free(a->stsc);
+	a->stsc = NULL;
+}
+
+// start parsing a sample table, header (box, version/flags, entry count) is in head
+static int mp4_table_open(u8_t *head, u32_t len, struct thread_ctx_s *ctx) {
+	struct faad *a = ctx->decode.handle;
+	u32_t entries = unpackN((u32_t *)(head + 12));
+
+	if (!memcmp(head + 4, "stts", 4)) a->table.size = 8;
+	else if (!memcmp(head + 4, "stsc", 4)) a->table.size = 12;
+	else a->table.size = 4;
+
+	// entry count comes from the file, never allocate more than the box can hold
+	entries = min(entries, (len - 16) / a->table.size);
+
+	if (a->table.size == 12) {
+		// stash sample to chunk info, assume it comes before stco
+		if (a->stsc) free(a->stsc);
+		if ((a->stsc = malloc(4 + (size_t) entries * 12)) == NULL) {
+			LOG_WARN("[%p]: malloc fail", ctx);
+			return -1;
+		}
+		packN((u32_t *)a->stsc, entries);
+	} else if (a->table.size == 4) {
+		// build offsets table from stco and stored stsc
+		if ((a->chunkinfo = malloc(sizeof(struct chunk_table) * ((size_t) entries + 1))) == NULL) {
+			LOG_WARN("[%p]: malloc fail", ctx);
+			return -1;
+		}
+	}
+
+	memcpy(a->table.type, head + 4, 4);
+	a->table.entries = entries;
+	a->table.index = 0;
+	a->table.remain = len - 16;
+
+	return 0;
+}
+
+// consume as many table entries as available, true once the whole box is done
+static bool mp4_table_feed(size_t *bytes, struct thread_ctx_s *ctx) {
+	struct faad *a = ctx->decode.handle;
+	u8_t copy[12];
+
+	while (a->table.index < a->table.entries && a->table.remain >= a->table.size) {
+		// entries are parsed in place, only the one wrapping round the end of streambuf is copied
+		u32_t n = min(a->table.entries - a->table.index, a->table.remain / a->table.size);
+		u8_t *entry = ctx->streambuf->readp;
+		u32_t i;
+
+		n = min(n, min(*bytes, _buf_cont_read(ctx->streambuf)) / a->table.size);
+
+		if (!n) {
+			if (*bytes < a->table.size) return false;
+			_mp4_peek(ctx->streambuf, copy, a->table.size);
+			entry = copy;
+			n = 1;
+		}
+
+		for (i = 0; i < n; i++, entry += a->table.size, a->table.index++) {
+			if (a->table.size == 8) {
+				// extract the total number of samples from stts
+				a->sttssamples += (u64_t) unpackN((u32_t *)entry) * unpackN((u32_t *)(entry + 4));
+			} else if (a->table.size == 12) {
+				memcpy((u8_t *)a->stsc + 4 + a->table.index * 12, entry, 12);
+			} else {
+				a->chunkinfo[a->table.index].offset = unpackN((u32_t *)entry);
+				a->chunkinfo[a->table.index].sample = 0;
+			}
+		}
+
+		_buf_inc_readp(ctx->streambuf, n * a->table.size);
+		a->pos += n * a->table.size;
+		*bytes -= n * a->table.size;
+		a->table.remain -= n * a->table.size;
+	}
+
+	// a truncated table only keeps what was read
+	a->table.entries = a->table.index;
+
+	if (a->table.size == 8) {
+		LOG_DEBUG("[%p]: total number of samples contained in stts: " FMT_u64, ctx, a->sttssamples);
+	} else if (a->table.size == 12) {
+		packN((u32_t *)a->stsc, a->table.entries);
+	} else {
+		a->chunkinfo[a->table.entries].sample = 0;
+		a->chunkinfo[a->table.entries].offset = 0;
+		if (a->stsc) mp4_chunk_samples(a, a->table.entries);
+	}
+
+	LOG_DEBUG("[%p]: type: %.4s entries: %u", ctx, a->table.type, a->table.entries);
+
+	// padding after entries is skipped like any other box body
+	a->consume = a->table.remain;
+	a->table.size = 0;
+
+	return true;
+}
+
+/*
+ read mp4 header to extract config data. Boxes are walked in streaming
+ fashion: sample tables are parsed entry by entry across calls, small boxes
+ (esds, ----) are only copied out when they wrap and the rest is skipped
+ without being buffered
+*/
 static int read_mp4_header(unsigned long *samplerate_p, unsigned char *channels_p, struct thread_ctx_s *ctx) {
 	struct faad *a = ctx->decode.handle;
-	size_t bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	size_t bytes = _buf_used(ctx->streambuf);
+	u8_t head[16];
 	char type[5];
 	u32_t len;
 
-	while (bytes >= 8) {
-		// count trak to find the first playable one
+	while (true) {
 		u32_t consume;
 
-		len = unpackN((u32_t *)ctx->streambuf->readp);
-		memcpy(type, ctx->streambuf->readp + 4, 4);
+		// sample table still being parsed
+		if (a->table.size && !mp4_table_feed(&bytes, ctx)) break;
+
+		// body left to skip, possibly more than what is in buffer
+		if (a->consume) {
+			consume = min(a->consume, bytes);
+			_buf_inc_readp(ctx->streambuf, consume);
+			a->pos += consume;
+			a->consume -= consume;
+			bytes -= consume;
+			if (a->consume) break;
+		}
+
+		if (bytes < 8) break;
+
+		// count trak to find the first playable one
+		_mp4_peek(ctx->streambuf, head, 8);
+		len = unpackN((u32_t *)head);
+		memcpy(type, head + 4, 4);
 		type[4] = '\0';
 
+		if (len < 8) {
+			LOG_ERROR("[%p]: invalid atom %s len %u", ctx, type, len);
+			return -1;
+		}
+
 		if (!strcmp(type, "moov")) {
 			a->trak = 0;
 			a->play = 0;
@@ -128,101 +380,32 @@ static int read_mp4_header(unsigned long *samplerate_p, unsigned char *channels_
 			a->trak++;
 		}
 
-		// extract audio config from within esds and pass to DecInit2
-		if (!strcmp(type, "esds") && bytes > len) {
-			unsigned config_len;
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			if (*ptr++ == 0x03) {
-				mp4_desc_length(&ptr);
-				ptr += 4;
-			} else {
-				ptr += 3;
-			}
-			mp4_desc_length(&ptr);
-			ptr += 13;
-			if (*ptr++ != 0x05) {
-				LOG_WARN("[%p]: error parsing esds", ctx);
-				return -1;
-			}
-			config_len = mp4_desc_length(&ptr);
-			if (NEAAC(&ga, Init2, a->hAac, ptr, config_len, samplerate_p, channels_p) == 0) {
-				LOG_DEBUG("[%p]: playable aac track: %u", ctx, a->trak);
-				a->play = a->trak;
-			}
+		// sample tables are streamed so they never need to sit in streambuf at once
+		if ((!strcmp(type, "stts") || (!strcmp(type, "stsc") && !a->chunkinfo) ||
+			(!strcmp(type, "stco") && a->play == a->trak && !a->chunkinfo)) && len >= 16) {
+			if (bytes < 16) break;
+			_mp4_peek(ctx->streambuf, head, 16);
+			if (mp4_table_open(head, len, ctx) < 0) return -1;
+			_buf_inc_readp(ctx->streambuf, 16);
+			a->pos += 16;
+			bytes -= 16;
+			continue;
 		}
 
-		// extract the total number of samples from stts
-		if (!strcmp(type, "stts") && bytes > len) {
-			u32_t i;
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			u32_t entries = unpackN((u32_t *)ptr);
-			ptr += 4;
-			for (i = 0; i < entries; ++i) {
-				u32_t count = unpackN((u32_t *)ptr);
-				u32_t size = unpackN((u32_t *)(ptr + 4));
-				a->sttssamples += count * size;
-				ptr += 8;
-			}
-			LOG_DEBUG("[%p]: total number of samples contained in stts: " FMT_u64, ctx, a->sttssamples);
-		}
+		// small boxes are parsed whole, wait till they are in streambuf
+		if ((!strcmp(type, "esds") || !strcmp(type, "----")) && len <= MP4_SMALL_BOX) {
+			u8_t *box, *copy;
+			int err = 0;
 
-		// stash sample to chunk info, assume it comes before stco
-		if (!strcmp(type, "stsc") && bytes > len && !a->chunkinfo) {
-			a->stsc = malloc(len - 12);
-			if (a->stsc == NULL) {
+			if (bytes < len) break;
+			if ((box = _mp4_box(ctx->streambuf, len, &copy)) == NULL) {
 				LOG_WARN("[%p]: malloc fail", ctx);
 				return -1;
 			}
-			memcpy(a->stsc, ctx->streambuf->readp + 12, len - 12);
-		}
-
-		// build offsets table from stco and stored stsc
-		if (!strcmp(type, "stco") && bytes > len && a->play == a->trak) {
-			u32_t i;
-			// extract chunk offsets
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			u32_t entries = unpackN((u32_t *)ptr);
-			ptr += 4;
-			a->chunkinfo = malloc(sizeof(struct chunk_table) * (entries + 1));
-			if (a->chunkinfo == NULL) {
-				LOG_WARN("[%p]: malloc fail", ctx);
-				return -1;
-			}
-			for (i = 0; i < entries; ++i) {
-				a->chunkinfo[i].offset = unpackN((u32_t *)ptr);
-				a->chunkinfo[i].sample = 0;
-				ptr += 4;
-			}
-			a->chunkinfo[i].sample = 0;
-			a->chunkinfo[i].offset = 0;
-			// fill in first sample id for each chunk from stored stsc
-			if (a->stsc) {
-				u32_t stsc_entries = unpackN((u32_t *)a->stsc);
-				u32_t sample = 0;
-				u32_t last = 0, last_samples = 0;
-				u8_t *ptr = (u8_t *)a->stsc + 4;
-				while (stsc_entries--) {
-					u32_t first = unpackN((u32_t *)ptr);
-					u32_t samples = unpackN((u32_t *)(ptr + 4));
-					if (last) {
-						for (i = last - 1; i < first - 1; ++i) {
-							a->chunkinfo[i].sample = sample;
-							sample += last_samples;
-						}
-					}
-					if (stsc_entries == 0) {
-						for (i = first - 1; i < entries; ++i) {
-							a->chunkinfo[i].sample = sample;
-							sample += samples;
-						}
-					}
-					last = first;
-					last_samples = samples;
-					ptr += 12;
-				}
-				free(a->stsc);
-				a->stsc = NULL;
-			}
+			if (*type == 'e') err = mp4_esds(box, samplerate_p, channels_p, ctx);
+			else mp4_smpb(box, len, ctx);
+			if (copy) free(copy);
+			if (err) return err;
 		}
 
 		// found media data, advance to start of first chunk and return
@@ -233,7 +416,7 @@ static int read_mp4_header(unsigned long *samplerate_p, unsigned char *channels_
 			if (a->play) {
 				LOG_DEBUG("[%p]: type: mdat len: %u pos: %u", ctx, len, a->pos);
 				if (a->chunkinfo && a->chunkinfo[0].offset > a->pos) {
-					u32_t skip = a->chunkinfo[0].offset - a->pos; 	
+					u32_t skip = a->chunkinfo[0].offset - a->pos;
 					LOG_DEBUG("[%p]: skipping: %u", ctx, skip);
 					if (skip <= bytes) {
 						_buf_inc_readp(ctx->streambuf, skip);
@@ -250,31 +433,6 @@ static int read_mp4_header(unsigned long *samplerate_p, unsigned char *channels_
 			}
 		}
 
-		// parse key-value atoms within ilst ---- entries to get encoder padding within iTunSMPB entry for gapless
-		if (!strcmp(type, "----") && bytes > len) {
-			u8_t *ptr = ctx->streambuf->readp + 8;
-			u32_t remain = len - 8, size;
-			if (!memcmp(ptr + 4, "mean", 4) && (size = unpackN((u32_t *)ptr)) < remain) {
-				ptr += size; remain -= size;
-			}
-			if (!memcmp(ptr + 4, "name", 4) && (size = unpackN((u32_t *)ptr)) < remain && !memcmp(ptr + 12, "iTunSMPB", 8)) {
-				ptr += size; remain -= size;
-			}
-			if (!memcmp(ptr + 4, "data", 4) && remain > 16 + 48) {
-				// data is stored as hex strings: 0 start end samples
-				u32_t b, c; u64_t d;
-				if (sscanf((const char *)(ptr + 16), "%x %x %x " FMT_x64, &b, &b, &c, &d) == 4) {
-					LOG_DEBUG("[%p]: iTunSMPB start: %u end: %u samples: " FMT_u64, ctx, b, c, d);
-					if (a->sttssamples && a->sttssamples < b + c + d) {
-						LOG_DEBUG("[%p]: reducing samples as stts count is less", ctx);
-						d = a->sttssamples - (b + c);
-					}
-					a->skip = b;
-					a->samples = d;
-				}
-			}
-		}
-
 		// default to consuming entire box
 		consume = len;
 
@@ -288,35 +446,9 @@ static int read_mp4_header(unsigned long *samplerate_p, unsigned char *channels_
 		if (!strcmp(type, "mp4a")) consume = 36;
 		if (!strcmp(type, "meta")) consume = 12;
 
-		// consume rest of box if it has been parsed (all in the buffer) or is not one we want to parse
-		if (bytes >= consume) {
-			LOG_DEBUG("[%p]: type: %s len: %u consume: %u", ctx, type, len, consume);
-			_buf_inc_readp(ctx->streambuf, consume);
-			a->pos += consume;
-			bytes -= consume;
-		} else if ( !(!strcmp(type, "esds") || !strcmp(type, "stts") || !strcmp(type, "stsc") ||
-					 !strcmp(type, "stco") || !strcmp(type, "----")) ) {
-			LOG_DEBUG("[%p]: type: %s len: %u consume: %u - partial consume: %u", ctx, type, len, consume, bytes);
-			_buf_inc_readp(ctx->streambuf, bytes);
-			a->pos += bytes;
-			a->consume = consume - bytes;
-			break;
-		} else if (len > bytes && len <= _buf_used(ctx->streambuf)) {
-			// atom body wrapping around buffer, need to linearize it
-			u8_t *buf = malloc(bytes);
-			memcpy(buf, ctx->streambuf->readp, bytes);
-			memmove(ctx->streambuf->buf + bytes, ctx->streambuf->buf, ctx->streambuf->writep - ctx->streambuf->buf);
-			memcpy(ctx->streambuf->buf, buf, bytes);
-			_buf_inc_writep(ctx->streambuf, bytes);
-			LOG_WARN("[%p]: buffer wrap in mp4 header parsing type:%s len:%u bytes:%s", ctx, type, len, bytes);
-			break;
-		 } else if (len >= ctx->streambuf->size) {
-			// can't process an atom larger than streambuf!
-			LOG_ERROR("[%p]: atom %s too large for buffer %u %u", ctx, type, len, ctx->streambuf->size);
-			return -1;
-		 } else {
-			break;
-		 }
+		// skipped bodies (cover art, unused tables...) are never buffered whole
+		LOG_DEBUG("[%p]: type: %s len: %u consume: %u", ctx, type, len, consume);
+		a->consume = consume;
 	}
 
 	return 0;
@@ -326,16 +458,18 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 	size_t bytes_total;
 	size_t bytes_wrap;
 	NeAACDecFrameInfo info;
-	s16_t *iptr;
+	ISAMPLE_T *iptr;
 	bool endstream;
 	frames_t frames;
+	stream_state state;
 	struct faad *a = ctx->decode.handle;
 
 	LOCK_S;
+	state = STREAM_STATE(ctx);
 	bytes_total = _buf_used(ctx->streambuf);
 	bytes_wrap  = min(bytes_total, _buf_cont_read(ctx->streambuf));
 
-	if (ctx->stream.state <= DISCONNECT && !bytes_total) {
+	if (state <= DISCONNECT && !bytes_total) {
 		UNLOCK_S;
 		return DECODE_COMPLETE;
 	}
@@ -384,8 +518,7 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 
 			LOCK_O;
 			LOG_INFO("[%p]: setting track_start", ctx);
-			// don't use next_sample_rate
-			ctx->output.current_sample_rate = decode_newstream(a->samplerate, ctx->output.supported_rates, ctx);
+			ctx->output.next_sample_rate = decode_newstream(a->samplerate, ctx->output.supported_rates, ctx);
 			ctx->output.track_start = ctx->outputbuf->writep;
 			if (ctx->output.fade_mode) _checkfade(true, ctx);
 			ctx->decode.new_stream = false;
@@ -495,31 +628,22 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 
 	while (frames > 0) {
 		frames_t f;
-		frames_t count;
-		s16_t *optr;
+		ISAMPLE_T *optr;
 
 		IF_DIRECT(
 			f = _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME;
-			optr = (s16_t *)ctx->outputbuf->writep;
+			optr = (ISAMPLE_T *)ctx->outputbuf->writep;
 		);
 		IF_PROCESS(
 			f = ctx->process.max_in_frames;
-			optr = (s16_t *)ctx->process.inbuf;
+			optr = (ISAMPLE_T *)ctx->process.inbuf;
 		);
 
 		f = min(f, frames);
-		count = f;
 
-		if (info.channels == 2) {
-			while (count--) {
-				*optr++ = *iptr++;
-				*optr++ = *iptr++;
-			}
-		} else if (info.channels == 1) {
-			while (count--) {
-				*optr++ = *iptr;
-				*optr++ = *iptr++;
-			}
+		if (info.channels == 2 || info.channels == 1) {
+			_interleave_shift(optr, iptr, f, info.channels, FAAD_SHIFT);
+			iptr += f * info.channels;
 		} else {
 			LOG_WARN("[%^p]: unsupported number of channels", ctx);
 		}
@@ -555,6 +679,7 @@ static void faad_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t e
 
 	a->type = sample_size;
 	a->pos = a->consume = a->sample = a->nextchunk = 0;
+	a->table.size = 0;
 
 	if (a->chunkinfo) free(a->chunkinfo);
 	if (a->stsc) free(a->stsc);
@@ -573,9 +698,11 @@ static void faad_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t e
 	conf = NEAAC(&ga, GetCurrentConfiguration, a->hAac);
 
 	//FIXME: set 16 bits and maybe sample rate
-	conf->outputFormat = FAAD_FMT_16BIT;
+	conf->outputFormat = FAAD_FMT;
     conf->defSampleRate = 44100;
 	conf->downMatrix = 1;
+	// lights only: stay at AAC core rate when SBR is implicit, skip the upsampling QMF
+	if (ctx->decode.light & LIGHT_LOWRATE) conf->dontUpSampleImplicitSBR = 1;
 
 	if (!NEAAC(&ga, SetConfiguration, a->hAac, conf)) {
 		LOG_WARN("[%p]: error setting config", ctx);
@@ -639,12 +766,9 @@ struct codec *register_faad(void) {
 		faad_open,    // open
 		faad_close,   // close
 		faad_decode,  // decode
+		load_faad,    // load
 	};
 
-	if (!load_faad()) {
-		return NULL;
-	}
-
 	LOG_INFO("using faad to decode aac", NULL);
 	return &ret;
 }
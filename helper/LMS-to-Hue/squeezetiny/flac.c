@@ -69,18 +69,29 @@ struct flac {
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
-#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
-#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#else
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -96,12 +107,14 @@ static log_level *loglevel = &decode_loglevel;
 static FLAC__StreamDecoderReadStatus read_cb(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *want, void *client_data) {
 	size_t bytes;
 	bool end;
+	stream_state state;
 	struct thread_ctx_s *ctx = (struct thread_ctx_s*) client_data;
 
 	LOCK_S;
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	state = STREAM_STATE(ctx);
+	bytes = _buf_cont_read(ctx->streambuf);
 	bytes = min(bytes, *want);
-	end = (ctx->stream.state <= DISCONNECT && bytes == 0);
+	end = (state <= DISCONNECT && bytes == 0);
 
 	memcpy(buffer, ctx->streambuf->readp, bytes);
 	_buf_inc_readp(ctx->streambuf, bytes);
@@ -128,8 +141,7 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 		LOG_INFO("[%p]: setting track_start", ctx);
 		ctx->output.track_start = ctx->outputbuf->writep;
 		ctx->decode.new_stream = false;
-		// don't use next_sample_rate
-		ctx->output.current_sample_rate = decode_newstream(frame->header.sample_rate, ctx->output.supported_rates, ctx);
+		ctx->output.next_sample_rate = decode_newstream(frame->header.sample_rate, ctx->output.supported_rates, ctx);
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 
 		UNLOCK_O;
@@ -139,42 +151,23 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 
 	while (frames > 0) {
 		frames_t f;
-		frames_t count;
-		s16_t *optr;
+		ISAMPLE_T *optr;
 
 		IF_DIRECT(
-			optr = (s16_t *)ctx->outputbuf->writep;
-			f = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
+			optr = (ISAMPLE_T *)ctx->outputbuf->writep;
+			f = _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME;
 		);
 		IF_PROCESS(
-			optr = (s16_t *)ctx->process.inbuf;
+			optr = (ISAMPLE_T *)ctx->process.inbuf;
 			f = ctx->process.max_in_frames;
 		);
 
 		f = min(f, frames);
 
-		count = f;
-
-		if (bits_per_sample == 8) {
-			while (count--) {
-				*optr++ = *lptr++ << 8;
-				*optr++ = *rptr++ << 8;
-			}
-		} else if (bits_per_sample == 16) {
-			while (count--) {
-				*optr++ = *lptr++;
-				*optr++ = *rptr++;
-			}
-		} else if (bits_per_sample == 24) {
-			while (count--) {
-				*optr++ = *lptr++ >> 8;
-				*optr++ = *rptr++ >> 8;
-			}
-		} else if (bits_per_sample == 32) {
-			while (count--) {
-				*optr++ = *lptr++ >> 16;
-				*optr++ = *rptr++ >> 16;
-			}
+		if (bits_per_sample == 8 || bits_per_sample == 16 || bits_per_sample == 24 || bits_per_sample == 32) {
+			_interleave_planar(optr, lptr, rptr, f, bits_per_sample);
+			lptr += f;
+			rptr += f;
 		} else {
 			LOG_ERROR("[%p]: unsupported bits per sample: %u", ctx, bits_per_sample);
 		}
@@ -299,12 +292,9 @@ struct codec *register_flac(void) {
 		flac_open,    // open
 		flac_close,   // close
 		flac_decode,  // decode
+		load_flac,    // load
 	};
 
-	if (!load_flac()) {
-		return NULL;
-	}
-
 	LOG_INFO("using flac to decode flc", NULL);
 	return &ret;
 }
@@ -56,24 +56,36 @@ struct mad {
 	u32_t skip;
 	u64_t samples;
 	u32_t padding;
+	u8_t shift;		// 1 when synth runs at half rate, gapless counts shrink too
 };
 
 
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
-#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
-#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#else
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -84,18 +96,6 @@ static log_level *loglevel = &decode_loglevel;
 #define MAD(h, fn, ...) (h)->mad_##fn(__VA_ARGS__)
 #endif
 
-// based on libmad minimad.c scale
-static inline u16_t scale(mad_fixed_t sample) {
-	sample += (1L << (MAD_F_FRACBITS - 24));
-
-	if (sample >= MAD_F_ONE)
-		sample = MAD_F_ONE - 1;
-	else if (sample < -MAD_F_ONE)
-		sample = -MAD_F_ONE;
-
-	return (s16_t)((sample >> (MAD_F_FRACBITS + 1 - 24)) >> 8);
-}
-
 // check for id3.2 tag at start of file - http://id3.org/id3v2.4.0-structure, return length
 static unsigned _check_id3_tag(size_t bytes, struct thread_ctx_s *ctx) {
 	u8_t *ptr = ctx->streambuf->readp;
@@ -151,9 +151,9 @@ static void _check_lame_header(size_t bytes, struct thread_ctx_s *ctx) {
 		enc_padding = enc_padding > MAD_DELAY ? enc_padding - MAD_DELAY : 0;
 
 		// add one frame to initial skip for this (empty) frame
-		m->skip    = enc_delay + 1152;
-		m->samples = frame_count * 1152 - enc_delay - enc_padding;
-		m->padding = enc_padding;
+		m->skip    = (enc_delay + 1152) >> m->shift;
+		m->samples = ((u64_t) frame_count * 1152 - enc_delay - enc_padding) >> m->shift;
+		m->padding = enc_padding >> m->shift;
 		
 		LOG_INFO("gapless: skip: %u samples: " FMT_u64 " delay: %u padding: %u", m->skip, m->samples, enc_delay, enc_padding);
 	}
@@ -162,10 +162,12 @@ static void _check_lame_header(size_t bytes, struct thread_ctx_s *ctx) {
 static decode_state mad_decode(struct thread_ctx_s *ctx) {
 	size_t bytes;
 	bool eos = false;
+	stream_state state;
 	struct mad *m = ctx->decode.handle;
 
 	LOCK_S;
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	state = STREAM_STATE(ctx);
+	bytes = _buf_cont_read(ctx->streambuf);
 
 	if (m->checktags) {
 		if (m->checktags == 1) {
@@ -198,7 +200,7 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 	m->readbuf_len += bytes;
 	_buf_inc_readp(ctx->streambuf, bytes);
 
-	if (ctx->stream.state <= DISCONNECT && _buf_used(ctx->streambuf) == 0) {
+	if (state <= DISCONNECT && _buf_used(ctx->streambuf) == 0) {
 		eos = true;
 		LOG_DEBUG("[%p]: end of stream", ctx);
 		memset(m->readbuf + m->readbuf_len, 0, MAD_BUFFER_GUARD);
@@ -244,8 +246,7 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 			LOCK_O;
 			LOG_INFO("[%p]: setting track_start", ctx);
 
-			// don't use next_sample_rate
-			ctx->output.current_sample_rate = decode_newstream(m->synth.pcm.samplerate, ctx->output.supported_rates, ctx);
+			ctx->output.next_sample_rate = decode_newstream(m->synth.pcm.samplerate, ctx->output.supported_rates, ctx);
 			ctx->output.track_start = ctx->outputbuf->writep;
 			if (ctx->output.fade_mode) _checkfade(true, ctx);
 
@@ -302,24 +303,22 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 		LOG_SDEBUG("[%p]: write %u frames", ctx, frames);
 
 		while (frames > 0) {
-			size_t f, count;
-			s16_t *optr;
+			size_t f;
+			ISAMPLE_T *optr;
 
 			IF_DIRECT(
 				f = min(frames, _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME);
-				optr = (s16_t *)ctx->outputbuf->writep;
+				optr = (ISAMPLE_T *)ctx->outputbuf->writep;
 			);
 			IF_PROCESS(
 				f = min(frames, ctx->process.max_in_frames - ctx->process.in_frames);
-				optr = (s16_t *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
+				optr = (ISAMPLE_T *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
 			);
 
-			count = f;
-
-			while (count--) {
-				*optr++ = scale(*iptrl++);
-				*optr++ = scale(*iptrr++);
-			}
+			// rounding and clipping of libmad minimad.c scale
+			_interleave_fixed(optr, iptrl, iptrr, f, MAD_F_FRACBITS);
+			iptrl += f;
+			iptrr += f;
 
 			frames -= f;
 
@@ -356,13 +355,16 @@ static void mad_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t en
 
 	m->checktags = 1;
 	m->consume = 0;
-	m->skip = MAD_DELAY;
+	m->shift = (ctx->decode.light & LIGHT_LOWRATE) ? 1 : 0;
+	m->skip = MAD_DELAY >> m->shift;
 	m->samples = 0;
 	m->readbuf_len = 0;
 	m->last_error = MAD_ERROR_NONE;
 	m->readbuf_len = 0;
 
 	MAD(&gm, stream_init, &m->stream);
+	// lights only: synth runs the half-band polyphase, reported rate follows
+	if (m->shift) mad_stream_options(&m->stream, MAD_OPTION_HALFSAMPLERATE);
 	MAD(&gm, frame_init, &m->frame);
 	MAD(&gm, synth_init, &m->synth);
 }
@@ -420,12 +422,9 @@ struct codec *register_mad(void) {
 		mad_open,     // open
 		mad_close,    // close
 		mad_decode,   // decode
+		load_mad,     // load
 	};
 
-	if (!load_mad()) {
-		return NULL;
-	}
-
 	LOG_INFO("using mad to decode mp3", NULL);
 	return &ret;
 }
@@ -72,6 +72,7 @@ void sq_wipe_device(struct thread_ctx_s *ctx) {
 #endif
 	decode_close(ctx);
 	stream_close(ctx);
+	decode_wake_close(ctx);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -270,6 +271,7 @@ static void sq_init_metadata(sq_metadata_t *metadata)
 	metadata->title 	= NULL;
 	metadata->genre 	= NULL;
 	metadata->artwork 	= NULL;
+	metadata->url 		= NULL;
 
 	metadata->track 	= 0;
 	metadata->index 	= 0;
@@ -333,7 +335,7 @@ bool sq_get_metadata(sq_dev_handle_t handle, sq_metadata_t *metadata, bool next)
 
 	sq_init_metadata(metadata);
 
-	sprintf(cmd, "%s status - 2 tags:xcfldatgrKN", ctx->cli_id);
+	sprintf(cmd, "%s status - 2 tags:xcfldatgrKNu", ctx->cli_id);
 	rsp = cli_send_cmd(cmd, false, false, ctx);
 
 	if (!rsp || !*rsp) {
@@ -363,6 +365,7 @@ bool sq_get_metadata(sq_dev_handle_t handle, sq_metadata_t *metadata, bool next)
 		metadata->artist = cli_find_tag(cur, "artist");
 		metadata->album = cli_find_tag(cur, "album");
 		metadata->genre = cli_find_tag(cur, "genre");
+		metadata->url = cli_find_tag(cur, "url");
 
 		if ((p = cli_find_tag(cur, "duration")) != NULL) {
 			metadata->duration = 1000 * atof(p);
@@ -429,6 +432,7 @@ void sq_free_metadata(sq_metadata_t *metadata)
 	NFREE(metadata->title);
 	NFREE(metadata->genre);
 	NFREE(metadata->artwork);
+	NFREE(metadata->url);
 }
 
 
@@ -564,6 +568,8 @@ void sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *
 void sq_init(char *model_name)
 {
 	strcpy(sq_model_name, model_name);
+	output_pack_init();
+	decode_pack_init();
 	decode_init();
 #if RESAMPLE
 	soxr_loaded = register_soxr();
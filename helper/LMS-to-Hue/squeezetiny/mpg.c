@@ -52,22 +52,35 @@ static struct {
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
+#define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
+#define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#define LOCK_O_not_direct   LOCK_O
+#define UNLOCK_O_not_direct UNLOCK_O
+#else
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
-#define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
-#define UNLOCK_O mutex_unlock(outputbuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct   if (!ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_not_direct if (!ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct
 #define UNLOCK_O_not_direct
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -82,13 +95,15 @@ static decode_state mpg_decode(struct thread_ctx_s *ctx) {
 	size_t bytes, space, size;
 	int ret;
 	u8_t *write_buf;
+	stream_state state;
 
 	LOCK_S;
 	LOCK_O_direct;
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	state = STREAM_STATE(ctx);
+	bytes = _buf_cont_read(ctx->streambuf);
 
 	IF_DIRECT(
-		space = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf));
+		space = _buf_cont_write(ctx->outputbuf);
 		write_buf = ctx->outputbuf->writep;
 	);
 	IF_PROCESS(
@@ -116,8 +131,7 @@ static decode_state mpg_decode(struct thread_ctx_s *ctx) {
 
 			LOG_INFO("[%p]: setting track_start", ctx);
 			LOCK_O_not_direct;
-			// don't use next_sample_rate
-			ctx->output.current_sample_rate = decode_newstream(rate, ctx->output.supported_rates, ctx);
+			ctx->output.next_sample_rate = decode_newstream(rate, ctx->output.supported_rates, ctx);
 			ctx->output.track_start = ctx->outputbuf->writep;
 			if (ctx->output.fade_mode) _checkfade(true, ctx);
 			ctx->decode.new_stream = false;
@@ -141,7 +155,7 @@ static decode_state mpg_decode(struct thread_ctx_s *ctx) {
 
 	LOG_SDEBUG("[%p]: write %u frames", size / BYTES_PER_FRAME, ctx);
 
-	if (ret == MPG123_DONE || (bytes == 0 && size == 0 && ctx->stream.state <= DISCONNECT)) {
+	if (ret == MPG123_DONE || (bytes == 0 && size == 0 && state <= DISCONNECT)) {
 		UNLOCK_S;
 		LOG_INFO("[%p]: stream complete", ctx);
 		return DECODE_COMPLETE;
@@ -178,8 +192,28 @@ static void mpg_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t en
 	//MPG123(&m, param, ctx->decode.handle, MPG123_FORCE_RATE, 44100, 0);
 	//MPG123(&m, param, ctx->decode.handle, MPG123_REMOVE_FLAGS, MPG123_GAPLESS, 0);
 
-	// restrict output to 44100, 16bits signed 2 channel based on library capability
-	MPG123(&gm, format, ctx->decode.handle, 44100, 2, MPG123_ENC_SIGNED_16);
+	// lights only: half-rate synth, and a single mixed channel copied to both sides
+	if (ctx->decode.light & LIGHT_LOWRATE) {
+		MPG123(&gm, param, ctx->decode.handle, MPG123_DOWN_SAMPLE, 1, 0);
+	}
+	if (ctx->decode.light & LIGHT_MONO) {
+		MPG123(&gm, param, ctx->decode.handle, MPG123_ADD_FLAGS, MPG123_MONO_MIX | MPG123_FORCE_STEREO, 0);
+	}
+
+	// restrict output to 44100, 32 or 16 bits signed 2 channel based on library capability
+	if (ctx->decode.light & LIGHT_LOWRATE) {
+		// half of any MPEG rate, as down-sampling can't produce anything else
+		static const long half_rates[] = { 8000, 11025, 12000, 16000, 22050, 24000 };
+		int i;
+
+		for (i = 0; i < (int) (sizeof(half_rates) / sizeof(half_rates[0])); i++) {
+			MPG123(&gm, format, ctx->decode.handle, half_rates[i], 2,
+				   BYTES_PER_FRAME == 8 ? MPG123_ENC_SIGNED_32 : MPG123_ENC_SIGNED_16);
+		}
+	} else {
+		MPG123(&gm, format, ctx->decode.handle, 44100, 2,
+			   BYTES_PER_FRAME == 8 ? MPG123_ENC_SIGNED_32 : MPG123_ENC_SIGNED_16);
+	}
 	/*
 	for (i = 0; i < count; i++) {
 		MPG123(&m, format, ctx->decode.handle, list[i], 2, MPG123_ENC_SIGNED_16);
@@ -231,6 +265,8 @@ static bool load_mpg(void) {
 	LOG_INFO("loaded "LIBMPG, NULL);
 #endif
 
+	MPG123(&gm, init);
+
 	return true;
 }
 
@@ -243,14 +279,9 @@ struct codec *register_mpg(void) {
 		mpg_open,     // open
 		mpg_close,    // close
 		mpg_decode,   // decode
+		load_mpg,     // load
 	};
 
-	if (!load_mpg()) {
-		return NULL;
-	}
-
-	MPG123(&gm, init);
-
 	LOG_INFO("using mpg to decode mp3", NULL);
 	return &ret;
 }
@@ -30,6 +30,7 @@ static struct {
 	// opus symbols to be dynamically loaded
 	void (*op_free)(OggOpusFile *_of);
 	int  (*op_read)(OggOpusFile *_of, opus_int16 *_pcm, int _buf_size, int *_li);
+	int  (*op_read_float)(OggOpusFile *_of, float *_pcm, int _buf_size, int *_li);
 	const OpusHead* (*op_head)(OggOpusFile *_of, int _li);
 	OggOpusFile*  (*op_open_callbacks) (void *_source, OpusFileCallbacks *_cb, unsigned char *_initial_data, size_t _initial_bytes, int *_error);
 } gu;
@@ -38,27 +39,44 @@ static struct {
 struct opus {
 	struct OggOpusFile *of;
 	int channels;
+	float *pcm;
 };
 
+// largest opus packet is 120ms at 48kHz
+#define FLOAT_FRAMES	5760
+
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
-#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
-#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#define LOCK_O_not_direct   LOCK_O
+#define UNLOCK_O_not_direct UNLOCK_O
+#else
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct   if (!ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_not_direct if (!ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct
 #define UNLOCK_O_not_direct
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -66,8 +84,10 @@ static log_level *loglevel = &decode_loglevel;
 
 #if LINKALL
 #define OP(h, fn, ...) (op_ ## fn)(__VA_ARGS__)
+#define FLOAT(h)       1
 #else
 #define OP(h, fn, ...) (h)->op_ ## fn(__VA_ARGS__)
+#define FLOAT(h)       (h)->op_read_float
 #endif
 
 // called with mutex locked within vorbis_decode to avoid locking O before S
@@ -75,7 +95,7 @@ static int _read_cb(void *datasource, char *ptr, int size) {
 	size_t bytes;
 	struct thread_ctx_s *ctx = datasource;
 
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	bytes = _buf_cont_read(ctx->streambuf);
 	bytes = min(bytes, size);
 
 	memcpy(ptr, ctx->streambuf->readp, bytes);
@@ -89,18 +109,21 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 	frames_t frames;
 	int n;
 	u8_t *write_buf;
+	float *pcm = u->pcm;
+	stream_state state;
 
 	LOCK_S;
 	LOCK_O_direct;
+	state = STREAM_STATE(ctx);
 
 	IF_DIRECT(
-		frames = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
+		frames = _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME;
 	);
 	IF_PROCESS(
 		frames = ctx->process.max_in_frames;
 	);
 
-	if (!frames && ctx->stream.state <= DISCONNECT) {
+	if (!frames && state <= DISCONNECT) {
 		UNLOCK_O_direct;
 		UNLOCK_S;
 		return DECODE_COMPLETE;
@@ -125,7 +148,8 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 
 		LOG_INFO("[%p]: setting track_start", ctx);
 		LOCK_O_not_direct;
-		ctx->output.current_sample_rate = decode_newstream(48000, ctx->output.supported_rates, ctx);
+		ctx->output.next_sample_rate = decode_newstream((ctx->decode.light & LIGHT_LOWRATE) ? 24000 : 48000, ctx->output.supported_rates, ctx);
+		ctx->output.next_float = u->pcm && (ctx->decode.light & LIGHT_FLOAT);
 		ctx->output.track_start = ctx->outputbuf->writep;
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
@@ -152,28 +176,65 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 		write_buf = ctx->process.inbuf;
 	);
 
-	// write the decoded frames into outputbuf (they are 16 bits)
-	n = OP(&gu, read, u->of, (opus_int16*) write_buf, frames * u->channels, NULL);
+	if (ctx->output.next_float && u->channels == 2) {
+		// stereo float frames are kept as they are, decode straight into outputbuf
+		pcm = (float *) write_buf;
+		n = OP(&gu, read_float, u->of, pcm, frames * 2, NULL);
+	} else if (u->pcm) {
+		// decode float in a side buffer, then clip and interleave into outputbuf
+		n = OP(&gu, read_float, u->of, pcm, min(frames, FLOAT_FRAMES) * u->channels, NULL);
+	} else {
+		// write the decoded frames into outputbuf (they are 16 bits)
+		n = OP(&gu, read, u->of, (opus_int16*) write_buf, frames * u->channels, NULL);
+	}
 
 	if (n > 0) {
-		frames_t count;
-		s16_t *iptr, *optr;
-
 		frames = n;
-		count = frames * u->channels;
-
-		// work backward but no unpack needed
-		iptr = (s16_t *)write_buf + count;
-		optr = (s16_t *)write_buf + frames * 2;
 
-		if (u->channels == 2) {
-			while (count--) {
-				*--optr = *--iptr;
+		// lights only: opusfile always renders 48kHz, so average pairs down to 24kHz
+		if ((ctx->decode.light & LIGHT_LOWRATE) && pcm) {
+			float *sptr = pcm, *dptr = pcm;
+			frames_t i;
+			int c;
+
+			frames /= 2;
+			for (i = 0; i < frames; i++, sptr += u->channels) {
+				for (c = 0; c < u->channels; c++, sptr++) {
+					*dptr++ = (sptr[0] + sptr[u->channels]) * 0.5f;
+				}
+			}
+		} else if (ctx->decode.light & LIGHT_LOWRATE) {
+			s16_t *sptr = (s16_t *)write_buf, *dptr = (s16_t *)write_buf;
+			frames_t i;
+			int c;
+
+			frames /= 2;
+			for (i = 0; i < frames; i++, sptr += u->channels) {
+				for (c = 0; c < u->channels; c++, sptr++) {
+					*dptr++ = (sptr[0] + sptr[u->channels]) >> 1;
+				}
 			}
-		} else if (u->channels == 1) {
-			while (count--) {
-				*--optr = *--iptr;
-				*--optr = *iptr;
+		}
+
+		if (ctx->output.next_float) {
+			if (pcm == u->pcm) _store_float((float *) write_buf, pcm, frames, u->channels);
+		} else if (pcm) {
+			_interleave_float((ISAMPLE_T *) write_buf, pcm, frames, u->channels);
+		} else {
+			frames_t count = frames * u->channels;
+			// work backward to expand 16 bits samples in place
+			s16_t *iptr = (s16_t *)write_buf + count;
+			ISAMPLE_T *optr = (ISAMPLE_T *)write_buf + frames * 2;
+
+			if (u->channels == 2) {
+				while (count--) {
+					*--optr = ALIGN16(*--iptr);
+				}
+			} else if (u->channels == 1) {
+				while (count--) {
+					*--optr = ALIGN16(*--iptr);
+					*--optr = ALIGN16(*iptr);
+				}
 			}
 		}
 
@@ -188,7 +249,7 @@ static decode_state opus_decompress( struct thread_ctx_s *ctx) {
 
 	} else if (n == 0) {
 
-		if (ctx->stream.state <= DISCONNECT) {
+		if (state <= DISCONNECT) {
 			LOG_INFO("[%p]: partial decode", ctx);
 			UNLOCK_O_direct;
 			UNLOCK_S;
@@ -222,6 +283,8 @@ static void opus_open(u8_t size, u32_t rate, u8_t chan, u8_t endianness, struct
 	if (!u) {
 		u = ctx->decode.handle = malloc(sizeof(struct opus));
 		u->of = NULL;
+		// float decoding skips the 16 bits step, stereo at most
+		u->pcm = FLOAT(&gu) ? malloc(FLOAT_FRAMES * 2 * sizeof(float)) : NULL;
 	} else if (u->of) {
 		OP(&gu, free, u->of);
 		u->of = NULL;
@@ -234,6 +297,7 @@ static void opus_close(struct thread_ctx_s *ctx) {
 	if (u && u->of) {
 		OP(&gu, free, u->of);
 	}
+	if (u) free(u->pcm);
 	free(u);
 	ctx->decode.handle = NULL;
 }
@@ -258,6 +322,10 @@ static bool load_opus(void) {
 		return false;
 	}
 
+	// optional, older opusfile builds may not export it
+	gu.op_read_float = dlsym(gu.handle, "op_read_float");
+	dlerror();
+
 	LOG_INFO("loaded "LIBOPUS, NULL);
 #endif
 
@@ -273,12 +341,9 @@ struct codec *register_opus(void) {
 		opus_open,    // open
 		opus_close,   // close
 		opus_decompress,  // decode
+		load_opus,        // load
 	};
 
-	if (!load_opus()) {
-		return NULL;
-	}
-
 	LOG_INFO("using opus to decode ops", NULL);
 	return &ret;
 }
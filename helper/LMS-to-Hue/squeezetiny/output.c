@@ -40,16 +40,24 @@ frames_t _output_frames(frames_t avail, struct thread_ctx_s *ctx) {
         u8_t flags = ctx->output.channels;
 
 	s32_t cross_gain_in = 0, cross_gain_out = 0;
-	s32_t *cross_ptr = NULL;
+	ISAMPLE_T *cross_ptr = NULL;
 
-	s32_t gainL = ctx->output.current_replay_gain ? gain(ctx->output.gainL, ctx->output.current_replay_gain) : ctx->output.gainL;
-	s32_t gainR = ctx->output.current_replay_gain ? gain(ctx->output.gainR, ctx->output.current_replay_gain) : ctx->output.gainR;
+	s32_t gainL, gainR;
+
+	// volume and replay gain shall not change what the analyzer sees
+	if (ctx->output.analysis_only) {
+		gainL = gainR = FIXED_ONE;
+		flags = 0;
+	} else {
+		gainL = ctx->output.current_replay_gain ? gain(ctx->output.gainL, ctx->output.current_replay_gain) : ctx->output.gainL;
+		gainR = ctx->output.current_replay_gain ? gain(ctx->output.gainR, ctx->output.current_replay_gain) : ctx->output.gainR;
+	}
 
 	frames = _buf_used(ctx->outputbuf) / BYTES_PER_FRAME;
 	silence = false;
 
-	// start when threshold met
-	if (ctx->output.state == OUTPUT_BUFFER && frames > ctx->output.threshold * ctx->output.current_sample_rate / 10 && frames > ctx->output.start_frames) {
+	// start when threshold met (fast start only waits for start_frames)
+	if (ctx->output.state == OUTPUT_BUFFER && (ctx->output.fast_start || frames > ctx->output.threshold * ctx->output.current_sample_rate / 10) && frames > ctx->output.start_frames) {
 		ctx->output.state = OUTPUT_RUNNING;
 		LOG_INFO("[%p]: start buffer frames: %u", ctx, frames);
 		wake_controller(ctx);
@@ -98,6 +106,8 @@ frames_t _output_frames(frames_t avail, struct thread_ctx_s *ctx) {
 
 		if (ctx->output.track_start && !silence) {
 			if (ctx->output.track_start == ctx->outputbuf->readp) {
+				ctx->output.current_sample_rate = ctx->output.next_sample_rate;
+				ctx->output.current_float = ctx->output.next_float;
 				LOG_INFO("[%p]: track start sample rate: %u replay_gain: %u", ctx, ctx->output.current_sample_rate, ctx->output.next_replay_gain);
 				ctx->output.frames_played = 0;
 				ctx->output.track_started = true;
@@ -174,15 +184,17 @@ frames_t _output_frames(frames_t avail, struct thread_ctx_s *ctx) {
 						if (_buf_used(ctx->outputbuf) / BYTES_PER_FRAME > dur_f + size) {
 							cross_gain_in  = to_gain((float)cur_f / (float)dur_f);
 							cross_gain_out = FIXED_ONE - cross_gain_in;
-							if (ctx->output.current_replay_gain) {
+							if (ctx->output.current_replay_gain && !ctx->output.analysis_only) {
 								cross_gain_out = gain(cross_gain_out, ctx->output.current_replay_gain);
 							}
-							if (ctx->output.next_replay_gain) {
+							if (ctx->output.next_replay_gain && !ctx->output.analysis_only) {
 								cross_gain_in = gain(cross_gain_in, ctx->output.next_replay_gain);
 							}
-							gainL = ctx->output.gainL;
-							gainR = ctx->output.gainR;
-							cross_ptr = (s32_t *)(ctx->output.fade_end + cur_f * BYTES_PER_FRAME);
+							if (!ctx->output.analysis_only) {
+								gainL = ctx->output.gainL;
+								gainR = ctx->output.gainR;
+							}
+							cross_ptr = (ISAMPLE_T *)(ctx->output.fade_end + cur_f * BYTES_PER_FRAME);
 						} else {
 							LOG_INFO("[%p]: unable to continue crossfade - too few samples", ctx);
 							ctx->output.fade = FADE_INACTIVE;
@@ -194,8 +206,8 @@ frames_t _output_frames(frames_t avail, struct thread_ctx_s *ctx) {
 
 		out_frames = !silence ? min(size, cont_frames) : size;
 
-		if (ctx->output.channels & 0x01) gainR |= MONO_FLAG;
-		if (ctx->output.channels & 0x02) gainL |= MONO_FLAG;
+		if (ctx->output.channels & 0x01 && !ctx->output.analysis_only) gainR |= MONO_FLAG;
+		if (ctx->output.channels & 0x02 && !ctx->output.analysis_only) gainL |= MONO_FLAG;
 
 		wrote = ctx->output.write_cb(ctx, out_frames, silence, gainL, gainR, flags, cross_gain_in, cross_gain_out, &cross_ptr);
 
@@ -216,6 +228,9 @@ frames_t _output_frames(frames_t avail, struct thread_ctx_s *ctx) {
 
 	LOG_SDEBUG("[%p]: wrote %u frames", ctx, frames);
 
+	// decoder might be waiting for room
+	if (frames && !silence) wake_decode_space(_buf_space(ctx->outputbuf), ctx);
+
 	return frames;
 }
 
@@ -226,7 +241,7 @@ void _checkfade(bool start, struct thread_ctx_s *ctx) {
 
 	LOG_INFO("[%p]: fade mode: %u duration: %u %s", ctx, ctx->output.fade_mode, ctx->output.fade_secs, start ? "track-start" : "track-end");
 
-	bytes = ctx->output.current_sample_rate * BYTES_PER_FRAME * ctx->output.fade_secs;
+	bytes = ctx->output.next_sample_rate * BYTES_PER_FRAME * ctx->output.fade_secs;
 	if (ctx->output.fade_mode == FADE_INOUT) {
 		bytes = ((bytes / 2) / BYTES_PER_FRAME) * BYTES_PER_FRAME;
 	}
@@ -255,7 +270,10 @@ void _checkfade(bool start, struct thread_ctx_s *ctx) {
 		ctx->output.fade_end = ctx->outputbuf->writep;
 	}
 
-	if (start && ctx->output.fade_mode == FADE_CROSSFADE) {
+	// lights don't need it and tracks in outputbuf may not have the same frame format
+	if (start && ctx->output.fade_mode == FADE_CROSSFADE && ctx->output.analysis_only) {
+		LOG_INFO("[%p]: no crossfade for analysis only", ctx);
+	} else if (start && ctx->output.fade_mode == FADE_CROSSFADE) {
 		if (_buf_used(ctx->outputbuf) != 0) {
 			bytes = min(bytes, _buf_used(ctx->outputbuf));               // max of current remaining samples from previous track
 			bytes = min(bytes, (frames_t)(ctx->outputbuf->size * 0.9));  // max of 90% of outputbuf as we consume additional buffer during crossfade
@@ -311,7 +329,7 @@ void output_init_common(void *device, unsigned outputbuf_size, u32_t sample_rate
 	ctx->output.error_opening = false;
 	ctx->output.detect_start_time = false;
 
-	ctx->output.current_sample_rate = ctx->output.default_sample_rate = sample_rate;
+	ctx->output.current_sample_rate = ctx->output.next_sample_rate = ctx->output.default_sample_rate = sample_rate;
 	ctx->output.supported_rates[0] = sample_rate;
 	ctx->output.supported_rates[1] = 0;
 }
@@ -39,22 +39,44 @@ void wake_output(struct thread_ctx_s *ctx) {
 
 /*---------------------------------------------------------------------------*/
 static int _huebridge_write_frames(struct thread_ctx_s *ctx, frames_t out_frames, bool silence, s32_t gainL, s32_t gainR,
-                             u8_t flags, s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr) {
+                             u8_t flags, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
 
     u8_t *obuf;
+    bool cross = false;
 
-    if (!silence) {
-        if (ctx->output.fade == FADE_ACTIVE && ctx->output.fade_dir == FADE_CROSS && *cross_ptr) {
-            _apply_cross(ctx->outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
-        }
+    // silence is only accounted for, the analyzer will feed zeros itself
+    if (silence && ctx->output.analysis_only) {
+        ctx->output.silent_frames += out_frames;
+        return (int) out_frames;
+    }
 
+    if (!silence) {
+        cross = ctx->output.fade == FADE_ACTIVE && ctx->output.fade_dir == FADE_CROSS && *cross_ptr;
         obuf = ctx->outputbuf->readp;
     }
     else {
         obuf = ctx->silencebuf;
     }
 
-    _scale_and_pack_frames((ctx->output.buf + ctx->output.buf_frames * BYTES_PER_FRAME), (s32_t*)(void *)obuf, out_frames, gainL, gainR, flags, ctx->output.format);
+#if LOCKFREE_BUF
+    // frames are ours in the reader section, output state has been read above
+    UNLOCK;
+#endif
+
+    if (cross) {
+        _apply_cross(ctx->outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
+    }
+
+    // buf holds interleaved S16_LE samples, so a frame is 2 of them, or 2 floats for the analyzer alone
+    if (ctx->output.analysis_only) {
+        _scale_float_frames((float *) ctx->output.buf + ctx->output.buf_frames * 2, obuf, out_frames, gainL, gainR, ctx->output.current_float);
+    } else {
+        _scale_and_pack_frames((ctx->output.buf + ctx->output.buf_frames * 2), (ISAMPLE_T*)(void *)obuf, out_frames, gainL, gainR, flags, ctx->output.format);
+    }
+
+#if LOCKFREE_BUF
+    LOCK;
+#endif
 
     ctx->output.buf_frames += out_frames;
 
@@ -70,6 +92,7 @@ void output_close(struct thread_ctx_s *ctx) {
 
 /*---------------------------------------------------------------------------*/
 static void *output_huebridge_thread(struct thread_ctx_s *ctx) {
+    unsigned sample_rate = 0;
 
     while (ctx->output_running) {
         bool ran = false;
@@ -77,14 +100,34 @@ static void *output_huebridge_thread(struct thread_ctx_s *ctx) {
         // proceed only if room in queue *and* running
         if (ctx->output.state >= OUTPUT_BUFFER && huebridge_accept_frames(ctx->output.device)) {
             u64_t playtime;
+            unsigned rate;
 
+#if LOCKFREE_BUF
+            // outputbuf's reader, the mutex is only held for output state
+            buf_begin(ctx->outputbuf, BUF_READER);
+#endif
             LOCK;
             // this will internally loop till we have exactly 4096 frames
             _output_frames(FRAMES_PER_BLOCK, ctx);
+            // only changes when output has reached track_start
+            rate = ctx->output.current_sample_rate;
             UNLOCK;
+#if LOCKFREE_BUF
+            buf_end(ctx->outputbuf, BUF_READER);
+#endif
+
+            // no resampling on lights, so bridge clock and analyzer follow the track
+            if (rate != sample_rate) {
+                sample_rate = rate;
+                huebridge_set_sample_rate(ctx->output.device, sample_rate);
+            }
 
             if (ctx->output.buf_frames) {
-                huebridge_process_chunk(ctx->output.device, ctx->output.buf, ctx->output.buf_frames, &playtime);
+                if (ctx->output.analysis_only) {
+                    huebridge_process_float_chunk(ctx->output.device, (float *) ctx->output.buf, ctx->output.buf_frames, &playtime);
+                } else {
+                    huebridge_process_chunk(ctx->output.device, ctx->output.buf, ctx->output.buf_frames, &playtime);
+                }
 
                 // current block is a track start, set the value
                 if (ctx->output.detect_start_time) {
@@ -97,6 +140,24 @@ static void *output_huebridge_thread(struct thread_ctx_s *ctx) {
                 ctx->output.buf_frames = 0;
                 ran = true;
             }
+            else if (ctx->output.silent_frames) {
+                huebridge_process_silence(ctx->output.device, ctx->output.silent_frames, &playtime);
+                ctx->output.silent_frames = 0;
+                ran = true;
+            }
+            else if (ctx->output.fast_start && ctx->output.state == OUTPUT_RUNNING) {
+                // starved: push silence so that analyzer window and falloff fade lights out
+                if (!ctx->output.underrun) {
+                    LOG_INFO("[%p]: output underrun, fading lights", ctx);
+                    ctx->output.underrun = true;
+                }
+                huebridge_process_silence(ctx->output.device, FRAMES_PER_BLOCK, &playtime);
+            }
+
+            if (ran && ctx->output.underrun) {
+                LOG_INFO("[%p]: output resumed after underrun", ctx);
+                ctx->output.underrun = false;
+            }
         }
 
         LOCK;
@@ -123,7 +184,7 @@ bool output_huebridge_thread_init(struct huebridgecl_s *huebridgecl, unsigned ou
 
     memset(&ctx->output, 0, sizeof(ctx->output));
 
-    ctx->output.buf = malloc(FRAMES_PER_BLOCK * BYTES_PER_FRAME);
+    ctx->output.buf = malloc(FRAMES_PER_BLOCK * 2 * sizeof(float));
     if (!ctx->output.buf) {
         LOG_ERROR("[%p]: unable to malloc buf", ctx);
 
@@ -133,7 +194,26 @@ bool output_huebridge_thread_init(struct huebridgecl_s *huebridgecl, unsigned ou
     ctx->output_running = true;
     ctx->output.format = S16_LE;
     ctx->output.buf_frames = 0;
-    ctx->output.start_frames = FRAMES_PER_BLOCK * 2;
+    ctx->output.silent_frames = 0;
+    ctx->output.analysis_only = ctx->config.analysis_only;
+    ctx->output.fast_start = ctx->config.fast_start;
+
+    // decoding fidelity can only be traded when nothing but the analyzer listens
+    ctx->output.light = 0;
+    if (ctx->config.light_decode && ctx->output.analysis_only) {
+        ctx->output.light = LIGHT_LOWRATE;
+        if (huebridge_mono_analysis(huebridgecl)) ctx->output.light |= LIGHT_MONO;
+        LOG_INFO("[%p]: light decoding (mono:%u)", ctx, (ctx->output.light & LIGHT_MONO) ? 1 : 0);
+    }
+    if (ctx->config.analysis_rate && ctx->output.analysis_only) {
+        ctx->output.light |= LIGHT_STREAM;
+        LOG_INFO("[%p]: analysis stream at %u", ctx, ctx->config.analysis_rate);
+    }
+    // float frames take the same room as internal ones in outputbuf
+    if (ctx->output.analysis_only && BYTES_PER_FRAME == 2 * sizeof(float)) {
+        ctx->output.light |= LIGHT_FLOAT;
+    }
+    ctx->output.start_frames = ctx->output.fast_start ? FRAMES_PER_BLOCK : FRAMES_PER_BLOCK * 2;
     ctx->output.write_cb = &_huebridge_write_frames;
 
     output_init_common(huebridgecl, outputbuf_size, 44100, ctx);
@@ -22,10 +22,46 @@
 // Scale and pack functions
 
 #include "squeezelite.h"
+#include "cpu_util.h"
+
+// vector kernels only handle 32 bits internal samples
+#define PACK_X86	(CPU_X86 && BYTES_PER_FRAME == 8)
+#define PACK_NEON	(CPU_NEON && BYTES_PER_FRAME == 8)
+
+#if PACK_X86
+#include <immintrin.h>
+#elif PACK_NEON
+#include <arm_neon.h>
+#endif
 
 #define MAX_SCALESAMPLE 0x7fffffffffffLL
 #define MIN_SCALESAMPLE -MAX_SCALESAMPLE
 
+// 16 bits internal samples are scaled up so that gain() and packing stay the same
+#if BYTES_PER_FRAME == 4
+#define SAMPLE32(s) ((s32_t) (s) * 65536)
+#else
+#define SAMPLE32(s) (s)
+#endif
+
+extern log_level	output_loglevel;
+static log_level 	*loglevel = &output_loglevel;
+
+/*
+ Vector kernels only process whole vectors and return the number of frames
+ (or samples for cross) they have handled, scalar code does the remainder.
+ They are only used when 0 <= gain <= FIXED_ONE, where gain() never clamps,
+ so results are bit-exact with the scalar version
+*/
+static struct {
+	char *name;
+	frames_t (*pack)(void *outputptr, ISAMPLE_T *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, output_format format);
+	frames_t (*mono)(ISAMPLE_T *ptr, frames_t cnt, u8_t flags);
+	frames_t (*cross)(ISAMPLE_T *ptr, ISAMPLE_T *cross_ptr, frames_t cnt, s32_t cross_gain_in, s32_t cross_gain_out);
+} pack_kernels = { "scalar", NULL, NULL, NULL };
+
+#define GAIN_IS_SIMPLE(g) ((g) >= 0 && (g) <= FIXED_ONE)
+
 
 /*---------------------------------------------------------------------------*/
 #if !WIN
@@ -48,12 +84,283 @@ s32_t to_gain(float f) {
 }
 
 
+#if PACK_X86
+/*---------------------------------------------------------------------------*/
+// unsigned 32x32 multiply, then remove gain << 32 for negative samples
+__attribute__((target("sse2")))
+static inline __m128i _gain_sse2(__m128i s, __m128i g) {
+	__m128i even = _mm_srli_epi64(_mm_mul_epu32(s, g), 16);
+	__m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(s, 32), _mm_srli_epi64(g, 32)), 16);
+	__m128i r = _mm_or_si128(_mm_and_si128(even, _mm_set_epi32(0, -1, 0, -1)), _mm_slli_epi64(odd, 32));
+	return _mm_sub_epi32(r, _mm_and_si128(_mm_srai_epi32(s, 31), _mm_slli_epi32(g, 16)));
+}
+
+// (a + b) / 2 rounded toward zero, like the 64 bits scalar version
+__attribute__((target("sse2")))
+static inline __m128i _average_sse2(__m128i a, __m128i b) {
+	__m128i one = _mm_set1_epi32(1);
+	__m128i f = _mm_add_epi32(_mm_add_epi32(_mm_srai_epi32(a, 1), _mm_srai_epi32(b, 1)), _mm_and_si128(_mm_and_si128(a, b), one));
+	return _mm_add_epi32(f, _mm_and_si128(_mm_and_si128(_mm_xor_si128(a, b), one), _mm_srli_epi32(f, 31)));
+}
+
+__attribute__((target("sse2")))
+static frames_t _pack_sse2(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, output_format format) {
+	__m128i g = _mm_set_epi32(gainR, gainL, gainR, gainL);
+	bool unity = gainL == FIXED_ONE && gainR == FIXED_ONE;
+	frames_t i, n = cnt & ~3;
+
+	for (i = 0; i < n; i += 4) {
+		__m128i a = _mm_loadu_si128((__m128i*) (inputptr + 2*i));
+		__m128i b = _mm_loadu_si128((__m128i*) (inputptr + 2*i + 4));
+
+		if (!unity) {
+			a = _gain_sse2(a, g);
+			b = _gain_sse2(b, g);
+		}
+
+		if (format == S16_LE) {
+			_mm_storeu_si128((__m128i*) ((u32_t*) outputptr + i), _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16)));
+		} else {
+			if (format == S24_LE) {
+				a = _mm_srai_epi32(a, 8);
+				b = _mm_srai_epi32(b, 8);
+			}
+			_mm_storeu_si128((__m128i*) ((u32_t*) outputptr + 2*i), a);
+			_mm_storeu_si128((__m128i*) ((u32_t*) outputptr + 2*i + 4), b);
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("sse2")))
+static frames_t _mono_sse2(s32_t *ptr, frames_t cnt, u8_t flags) {
+	frames_t i, n = cnt & ~1;
+
+	for (i = 0; i < n; i += 2) {
+		__m128i v = _mm_loadu_si128((__m128i*) (ptr + 2*i));
+
+		if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) v = _average_sse2(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		else if (flags & MONO_RIGHT) v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 1, 1));
+		else v = _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 0, 0));
+
+		_mm_storeu_si128((__m128i*) (ptr + 2*i), v);
+	}
+
+	return n;
+}
+
+__attribute__((target("sse2")))
+static frames_t _cross_sse2(s32_t *ptr, s32_t *cross_ptr, frames_t cnt, s32_t cross_gain_in, s32_t cross_gain_out) {
+	__m128i gin = _mm_set1_epi32(cross_gain_in), gout = _mm_set1_epi32(cross_gain_out);
+	frames_t i, n = cnt & ~3;
+
+	for (i = 0; i < n; i += 4) {
+		__m128i a = _gain_sse2(_mm_loadu_si128((__m128i*) (ptr + i)), gout);
+		__m128i b = _gain_sse2(_mm_loadu_si128((__m128i*) (cross_ptr + i)), gin);
+		_mm_storeu_si128((__m128i*) (ptr + i), _mm_add_epi32(a, b));
+	}
+
+	return n;
+}
+
 /*---------------------------------------------------------------------------*/
-void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format) {
+__attribute__((target("avx2")))
+static inline __m256i _gain_avx2(__m256i s, __m256i g) {
+	__m256i even = _mm256_srli_epi64(_mm256_mul_epi32(s, g), 16);
+	__m256i odd = _mm256_srli_epi64(_mm256_mul_epi32(_mm256_srli_epi64(s, 32), _mm256_srli_epi64(g, 32)), 16);
+	return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _average_avx2(__m256i a, __m256i b) {
+	__m256i one = _mm256_set1_epi32(1);
+	__m256i f = _mm256_add_epi32(_mm256_add_epi32(_mm256_srai_epi32(a, 1), _mm256_srai_epi32(b, 1)), _mm256_and_si256(_mm256_and_si256(a, b), one));
+	return _mm256_add_epi32(f, _mm256_and_si256(_mm256_and_si256(_mm256_xor_si256(a, b), one), _mm256_srli_epi32(f, 31)));
+}
+
+__attribute__((target("avx2")))
+static frames_t _pack_avx2(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, output_format format) {
+	__m256i g = _mm256_set_epi32(gainR, gainL, gainR, gainL, gainR, gainL, gainR, gainL);
+	bool unity = gainL == FIXED_ONE && gainR == FIXED_ONE;
+	frames_t i, n = cnt & ~7;
+
+	for (i = 0; i < n; i += 8) {
+		__m256i a = _mm256_loadu_si256((__m256i*) (inputptr + 2*i));
+		__m256i b = _mm256_loadu_si256((__m256i*) (inputptr + 2*i + 8));
+
+		if (!unity) {
+			a = _gain_avx2(a, g);
+			b = _gain_avx2(b, g);
+		}
+
+		if (format == S16_LE) {
+			// pack works within 128 bits lanes, so restore frames order
+			__m256i v = _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+			_mm256_storeu_si256((__m256i*) ((u32_t*) outputptr + i), _mm256_permute4x64_epi64(v, 0xd8));
+		} else {
+			if (format == S24_LE) {
+				a = _mm256_srai_epi32(a, 8);
+				b = _mm256_srai_epi32(b, 8);
+			}
+			_mm256_storeu_si256((__m256i*) ((u32_t*) outputptr + 2*i), a);
+			_mm256_storeu_si256((__m256i*) ((u32_t*) outputptr + 2*i + 8), b);
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static frames_t _mono_avx2(s32_t *ptr, frames_t cnt, u8_t flags) {
+	frames_t i, n = cnt & ~3;
+
+	for (i = 0; i < n; i += 4) {
+		__m256i v = _mm256_loadu_si256((__m256i*) (ptr + 2*i));
+
+		if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) v = _average_avx2(v, _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+		else if (flags & MONO_RIGHT) v = _mm256_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 1, 1));
+		else v = _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 0, 0));
+
+		_mm256_storeu_si256((__m256i*) (ptr + 2*i), v);
+	}
+
+	return n;
+}
+
+__attribute__((target("avx2")))
+static frames_t _cross_avx2(s32_t *ptr, s32_t *cross_ptr, frames_t cnt, s32_t cross_gain_in, s32_t cross_gain_out) {
+	__m256i gin = _mm256_set1_epi32(cross_gain_in), gout = _mm256_set1_epi32(cross_gain_out);
+	frames_t i, n = cnt & ~7;
+
+	for (i = 0; i < n; i += 8) {
+		__m256i a = _gain_avx2(_mm256_loadu_si256((__m256i*) (ptr + i)), gout);
+		__m256i b = _gain_avx2(_mm256_loadu_si256((__m256i*) (cross_ptr + i)), gin);
+		_mm256_storeu_si256((__m256i*) (ptr + i), _mm256_add_epi32(a, b));
+	}
+
+	return n;
+}
+#endif
+
+#if PACK_NEON
+/*---------------------------------------------------------------------------*/
+CPU_NEON_TARGET
+static inline int32x4_t _gain_neon(int32x4_t s, int32x4_t g) {
+	int64x2_t lo = vmull_s32(vget_low_s32(s), vget_low_s32(g));
+	int64x2_t hi = vmull_s32(vget_high_s32(s), vget_high_s32(g));
+	return vcombine_s32(vshrn_n_s64(lo, 16), vshrn_n_s64(hi, 16));
+}
+
+// halving add rounds down, scalar version rounds toward zero
+CPU_NEON_TARGET
+static inline int32x4_t _average_neon(int32x4_t a, int32x4_t b) {
+	int32x4_t f = vhaddq_s32(a, b);
+	int32x4_t odd = vandq_s32(veorq_s32(a, b), vdupq_n_s32(1));
+	return vaddq_s32(f, vandq_s32(odd, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(f), 31))));
+}
+
+CPU_NEON_TARGET
+static frames_t _pack_neon(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, output_format format) {
+	int32x4_t g = vcombine_s32(vcreate_s32((u32_t) gainL | (u64_t) (u32_t) gainR << 32), vcreate_s32((u32_t) gainL | (u64_t) (u32_t) gainR << 32));
+	bool unity = gainL == FIXED_ONE && gainR == FIXED_ONE;
+	frames_t i, n = cnt & ~3;
+
+	for (i = 0; i < n; i += 4) {
+		int32x4_t a = vld1q_s32(inputptr + 2*i);
+		int32x4_t b = vld1q_s32(inputptr + 2*i + 4);
+
+		if (!unity) {
+			a = _gain_neon(a, g);
+			b = _gain_neon(b, g);
+		}
+
+		if (format == S16_LE) {
+			vst1q_s16((s16_t*) outputptr + 2*i, vcombine_s16(vshrn_n_s32(a, 16), vshrn_n_s32(b, 16)));
+		} else {
+			if (format == S24_LE) {
+				a = vshrq_n_s32(a, 8);
+				b = vshrq_n_s32(b, 8);
+			}
+			vst1q_s32((s32_t*) outputptr + 2*i, a);
+			vst1q_s32((s32_t*) outputptr + 2*i + 4, b);
+		}
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static frames_t _mono_neon(s32_t *ptr, frames_t cnt, u8_t flags) {
+	frames_t i, n = cnt & ~1;
+
+	for (i = 0; i < n; i += 2) {
+		int32x4_t v = vld1q_s32(ptr + 2*i);
+
+		if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) v = _average_neon(v, vrev64q_s32(v));
+		else if (flags & MONO_RIGHT) v = vtrnq_s32(v, v).val[1];
+		else v = vtrnq_s32(v, v).val[0];
+
+		vst1q_s32(ptr + 2*i, v);
+	}
+
+	return n;
+}
+
+CPU_NEON_TARGET
+static frames_t _cross_neon(s32_t *ptr, s32_t *cross_ptr, frames_t cnt, s32_t cross_gain_in, s32_t cross_gain_out) {
+	int32x4_t gin = vdupq_n_s32(cross_gain_in), gout = vdupq_n_s32(cross_gain_out);
+	frames_t i, n = cnt & ~3;
+
+	for (i = 0; i < n; i += 4) {
+		int32x4_t a = _gain_neon(vld1q_s32(ptr + i), gout);
+		int32x4_t b = _gain_neon(vld1q_s32(cross_ptr + i), gin);
+		vst1q_s32(ptr + i, vaddq_s32(a, b));
+	}
+
+	return n;
+}
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+void output_pack_init(void) {
+#if PACK_X86
+	if (cpu_features() & CPU_HAS_AVX2) {
+		pack_kernels.name = "avx2";
+		pack_kernels.pack = _pack_avx2;
+		pack_kernels.mono = _mono_avx2;
+		pack_kernels.cross = _cross_avx2;
+	} else if (cpu_features() & CPU_HAS_SSE2) {
+		pack_kernels.name = "sse2";
+		pack_kernels.pack = _pack_sse2;
+		pack_kernels.mono = _mono_sse2;
+		pack_kernels.cross = _cross_sse2;
+	}
+#elif PACK_NEON
+	if (cpu_features() & CPU_HAS_NEON) {
+		pack_kernels.name = "neon";
+		pack_kernels.pack = _pack_neon;
+		pack_kernels.mono = _mono_neon;
+		pack_kernels.cross = _cross_neon;
+	}
+#endif
+	cpu_set_kernel("pack", pack_kernels.name);
+	LOG_INFO("using %s kernels for scale and pack", pack_kernels.name);
+}
+
+/*---------------------------------------------------------------------------*/
+void _scale_and_pack_frames(void *outputptr, ISAMPLE_T *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format) {
+	frames_t done = 0;
+
+	if (pack_kernels.mono && (flags & (MONO_LEFT | MONO_RIGHT))) {
+		done = pack_kernels.mono(inputptr, cnt, flags);
+	}
+
 	// in-place copy input samples if mono/combined is used (never happens with DSD active)
 	if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
-		s32_t *ptr = inputptr;
-		frames_t count = cnt;
+		ISAMPLE_T *ptr = inputptr + done * 2;
+		frames_t count = cnt - done;
 		while (count--) {
 			// use 64 bit integers for purists but should really not care
 			*ptr = *(ptr + 1) = ((s64_t) *ptr + (s64_t) *(ptr + 1)) /2;
@@ -61,43 +368,56 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		}
         }
 	else if (flags & MONO_RIGHT) {
-		s32_t *ptr = inputptr +1;
-		frames_t count = cnt;
+		ISAMPLE_T *ptr = inputptr + done * 2 + 1;
+		frames_t count = cnt - done;
 		while (count--) {
 			*(ptr - 1 ) = *ptr;
 			ptr += 2;
 		}
         }
 	else if (flags & MONO_LEFT) {
-		s32_t *ptr = inputptr;
-		frames_t count = cnt;
+		ISAMPLE_T *ptr = inputptr + done * 2;
+		frames_t count = cnt - done;
 		while (count--) {
 			*(ptr + 1) = *ptr;
 			ptr += 2;
 		}
 	}
 
+	// S24_3LE and S32_LE memcpy stay scalar
+	if (pack_kernels.pack && GAIN_IS_SIMPLE(gainL) && GAIN_IS_SIMPLE(gainR) &&
+		(format == S16_LE || format == S24_LE || (format == S32_LE && (gainL != FIXED_ONE || gainR != FIXED_ONE)))) {
+		done = pack_kernels.pack(outputptr, inputptr, cnt, gainL, gainR, format);
+		outputptr = (u8_t*) outputptr + done * (format == S16_LE ? 4 : 8);
+		inputptr += done * 2;
+		cnt -= done;
+	}
+
 	switch (format) {
 		case S16_LE: {
 				u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
 				if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+#if BYTES_PER_FRAME == 4
+					memcpy(outputptr, inputptr, cnt * BYTES_PER_FRAME);
+#else
 					while (cnt--) {
 						*(optr++) = (*(inputptr) >> 16 & 0x0000ffff) | (*(inputptr + 1) & 0xffff0000);
 						inputptr += 2;
 					}
+#endif
 				}
 				else {
 					while (cnt--) {
-						*(optr++) = (gain(gainL, *(inputptr)) >> 16 & 0x0000ffff) | (gain(gainR, *(inputptr + 1)) & 0xffff0000);
+						*(optr++) = (gain(gainL, SAMPLE32(*(inputptr))) >> 16 & 0x0000ffff) | (gain(gainR, SAMPLE32(*(inputptr + 1))) & 0xffff0000);
 						inputptr += 2;
 					}
 				}
 #else
 				if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
 					while (cnt--) {
-						s32_t lsample = *(inputptr++);
-						s32_t rsample = *(inputptr++);
+						s32_t lsample = SAMPLE32(*(inputptr++));
+						s32_t rsample = SAMPLE32(*(inputptr++));
 						*(optr++) =
 							(lsample & 0x00ff0000) << 8 | (lsample & 0xff000000) >>  8 |
 							(rsample & 0x00ff0000) >> 8 | (rsample & 0xff000000) >> 24; 
@@ -105,8 +425,8 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 				}
 				else {
 					while (cnt--) {
-						s32_t lsample = gain(gainL, *(inputptr++));
-						s32_t rsample = gain(gainR. *(inputptr++));
+						s32_t lsample = gain(gainL, SAMPLE32(*(inputptr++)));
+						s32_t rsample = gain(gainR. SAMPLE32(*(inputptr++)));
 						*(optr++) =
 							(lsample & 0x00ff0000) << 8 | (lsample & 0xff000000) >> 8 |
 							(rsample & 0x00ff0000) >> 8 | (rsample & 0xff000000) >> 24;
@@ -120,21 +440,21 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 #if SL_LITTLE_ENDIAN
 				if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
 					while (cnt--) {
-						*(optr++) = *(inputptr++) >> 8;
-						*(optr++) = *(inputptr++) >> 8;
+						*(optr++) = SAMPLE32(*(inputptr++)) >> 8;
+						*(optr++) = SAMPLE32(*(inputptr++)) >> 8;
 					}
 				}
 				else {
 					while (cnt--) {
-						*(optr++) = gain(gainL, *(inputptr++)) >> 8;
-						*(optr++) = gain(gainR, *(inputptr++)) >> 8;
+						*(optr++) = gain(gainL, SAMPLE32(*(inputptr++))) >> 8;
+						*(optr++) = gain(gainR, SAMPLE32(*(inputptr++))) >> 8;
 					}
 				}
 #else
 				if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
 					while (cnt--) {
-						s32_t lsample = *(inputptr++);
-						s32_t rsample = *(inputptr++);
+						s32_t lsample = SAMPLE32(*(inputptr++));
+						s32_t rsample = SAMPLE32(*(inputptr++));
 						*(optr++) =
 							(lsample & 0xff000000) >> 16 | (lsample & 0x00ff0000) | (lsample & 0x0000ff00 << 16);
 						*(optr++) =
@@ -143,8 +463,8 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 				}
 				else {
 					while (cnt--) {
-						s32_t lsample = gain(gainL, *(inputptr++));
-						s32_t rsample = gain(gainR, *(inputptr++));
+						s32_t lsample = gain(gainL, SAMPLE32(*(inputptr++)));
+						s32_t rsample = gain(gainR, SAMPLE32(*(inputptr++)));
 						*(optr++) =
                                                         (lsample & 0xff000000) >> 16 | (lsample & 0x00ff0000) | (lsample & 0x0000ff00 << 16);
                                                 *(optr++) =
@@ -163,8 +483,8 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 						if (((uintptr_t)optr &0x3) == 0 && cnt >= 2) {
 							u32_t *o_ptr = (u32_t *)(void *)optr;
 							while (cnt >= 2) {
-								s32_t l1 = *(inputptr++); s32_t r1 = *(inputptr++);
-								s32_t l2 = *(inputptr++); s32_t r2 = *(inputptr++);
+								s32_t l1 = SAMPLE32(*(inputptr++)); s32_t r1 = SAMPLE32(*(inputptr++));
+								s32_t l2 = SAMPLE32(*(inputptr++)); s32_t r2 = SAMPLE32(*(inputptr++));
 #if SL_LITTLE_ENDIAN
 								*(o_ptr++) = (l1 & 0xffffff00) >>  8 | (r1 & 0x0000ff00) << 16;
 								*(o_ptr++) = (r1 & 0xffff0000) >> 16 | (l2 & 0x00ffff00) <<  8;
@@ -182,8 +502,8 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 							}
 						}
 						else {
-							s32_t lsample = *(inputptr++);
-							s32_t rsample = *(inputptr++);
+							s32_t lsample = SAMPLE32(*(inputptr++));
+							s32_t rsample = SAMPLE32(*(inputptr++));
 							*(optr++) = (lsample & 0x0000ff00) >>  8;
 							*(optr++) = (lsample & 0x00ff0000) >> 16;
 							*(optr++) = (lsample & 0xff000000) >> 24;
@@ -201,8 +521,8 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 						if (((uintptr_t)optr & 0x3) == 0 && cnt >= 2) {
 							u32_t *o_ptr = (u32_t *)(void *)optr;
 							while (cnt >= 2) {
-								s32_t l1 = gain(gainL, *(inputptr++)); s32_t r1 = gain(gainR, *(inputptr++));
-								s32_t l2 = gain(gainL, *(inputptr++)); s32_t r2 = gain(gainR, *(inputptr++));
+								s32_t l1 = gain(gainL, SAMPLE32(*(inputptr++))); s32_t r1 = gain(gainR, SAMPLE32(*(inputptr++)));
+								s32_t l2 = gain(gainL, SAMPLE32(*(inputptr++))); s32_t r2 = gain(gainR, SAMPLE32(*(inputptr++)));
 #if SL_LITTLE_ENDIAN
 								*(o_ptr++) = (l1 & 0xffffff00) >>  8 | (r1 & 0x0000ff00) << 16;
 								*(o_ptr++) = (r1 & 0xffff0000) >> 16 | (l2 & 0x00ffff00) <<  8;
@@ -220,14 +540,15 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 							}
 						}
 						else {
-							s32_t lsample = gain(gainL, *(inputptr++));
-							s32_t rsample = gain(gainR, *(inputptr++));
+							s32_t lsample = gain(gainL, SAMPLE32(*(inputptr++)));
+							s32_t rsample = gain(gainR, SAMPLE32(*(inputptr++)));
 							*(optr++) = (lsample & 0x0000ff00) >>  8;
 							*(optr++) = (lsample & 0x00ff0000) >> 16;
 							*(optr++) = (lsample & 0xff000000) >> 24;
 							*(optr++) = (rsample & 0x0000ff00) >>  8;
 							*(optr++) = (rsample & 0x00ff0000) >> 16;
 							*(optr++) = (rsample & 0xff000000) >> 24;
+							cnt--;
 						}
 					}
 				}
@@ -237,19 +558,26 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 				u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
 				if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+#if BYTES_PER_FRAME == 4
+					while (cnt--) {
+						*(optr++) = SAMPLE32(*(inputptr++));
+						*(optr++) = SAMPLE32(*(inputptr++));
+					}
+#else
 					memcpy(outputptr, inputptr, cnt * BYTES_PER_FRAME);
+#endif
 				}
 				else {
 					while (cnt--) {
-						*(optr++) = gain(gainL, *(inputptr++));
-						*(optr++) = gain(gainR, *(inputptr++));
+						*(optr++) = gain(gainL, SAMPLE32(*(inputptr++)));
+						*(optr++) = gain(gainR, SAMPLE32(*(inputptr++)));
 					}
 				}
 #else
 				if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
 					while (cnt--) {
-						s32_t lsample = *(inputptr++);
-						s32_t rsample = *(inputptr++);
+						s32_t lsample = SAMPLE32(*(inputptr++));
+						s32_t rsample = SAMPLE32(*(inputptr++));
 						*(optr++) =
 							(lsample & 0xff000000) >> 24 | (lsample & 0x00ff0000) >>  8 |
 							(lsample & 0x0000ff00) <<  8 | (lsample & 0x000000ff) << 24;
@@ -260,8 +588,8 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 				}
 				else {
 					while (cnt--) {
-						s32_t lsample = gain(gainL, *(inputptr++));
-						s32_t rsample = gain(gainR, *(inputptr++));
+						s32_t lsample = gain(gainL, SAMPLE32(*(inputptr++)));
+						s32_t rsample = gain(gainR, SAMPLE32(*(inputptr++)));
 						*(optr++) =
 							(lsample & 0xff000000) >> 24 | (lsample & 0x00ff0000) >>  8 |
 							(lsample & 0x0000ff00) <<  8 | (lsample & 0x000000ff) << 24;
@@ -278,18 +606,50 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		}
 }
 
+/*---------------------------------------------------------------------------*/
+// analyzer frames in [-1.0, 1.0[, from outputbuf's float frames (LIGHT_FLOAT) or internal samples
+void _scale_float_frames(float *optr, void *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, bool is_float) {
+	float fL = gainL / (float) FIXED_ONE, fR = gainR / (float) FIXED_ONE;
+
+	if (is_float) {
+		float *iptr = inputptr;
+
+		if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
+			memcpy(optr, iptr, cnt * 2 * sizeof(float));
+		} else while (cnt--) {
+			*optr++ = *iptr++ * fL;
+			*optr++ = *iptr++ * fR;
+		}
+	} else {
+		ISAMPLE_T *iptr = inputptr;
+
+		fL /= 2147483648.0f;
+		fR /= 2147483648.0f;
+		while (cnt--) {
+			*optr++ = SAMPLE32(*iptr++) * fL;
+			*optr++ = SAMPLE32(*iptr++) * fR;
+		}
+	}
+}
 
 
 /*---------------------------------------------------------------------------*/
 #if !WIN
 inline
 #endif
-void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr) {
-	s32_t *ptr = (s32_t *)(void *)outputbuf->readp;
+void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
+	ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp;
 	frames_t count = out_frames * 2;
 
+	// vectorize up to where cross_ptr would wrap, the rest is done below
+	if (pack_kernels.cross && GAIN_IS_SIMPLE(cross_gain_in) && GAIN_IS_SIMPLE(cross_gain_out) && *cross_ptr < (ISAMPLE_T *) outputbuf->wrap) {
+		frames_t done = pack_kernels.cross(ptr, *cross_ptr, min(count, (frames_t) ((ISAMPLE_T *) outputbuf->wrap - *cross_ptr)), cross_gain_in, cross_gain_out);
+		ptr += done; *cross_ptr += done;
+		count -= done;
+	}
+
 	while (count--) {
-		if (*cross_ptr > (s32_t *) outputbuf->wrap) {
+		if (*cross_ptr > (ISAMPLE_T *) outputbuf->wrap) {
 			*cross_ptr -= outputbuf->size / BYTES_PER_FRAME * 2;
 		}
 		*ptr = gain(cross_gain_out, *ptr) + gain(cross_gain_in, **cross_ptr);
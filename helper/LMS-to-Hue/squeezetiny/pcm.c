@@ -24,22 +24,35 @@
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
-#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
-#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#define LOCK_O_not_direct   LOCK_O
+#define UNLOCK_O_not_direct UNLOCK_O
+#else
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct   if (!ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_not_direct if (!ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct
 #define UNLOCK_O_not_direct
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -132,14 +145,14 @@ decode_state pcm_decode(struct thread_ctx_s *ctx) {
 	LOCK_S;
 	LOCK_O_direct;
 
-	if (ctx->stream.state <= DISCONNECT && _buf_used(ctx->streambuf) < p->bytes_per_frame) {
+	if (STREAM_STATE(ctx) <= DISCONNECT && _buf_used(ctx->streambuf) < p->bytes_per_frame) {
 		UNLOCK_O_direct;
 		UNLOCK_S;
 		return DECODE_COMPLETE;
 	}
 
 	IF_DIRECT(
-		out = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
+		out = _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME;
 		optr = ctx->outputbuf->writep;
 	);
 	IF_PROCESS(
@@ -156,8 +169,7 @@ decode_state pcm_decode(struct thread_ctx_s *ctx) {
 
 		LOCK_O_not_direct;
 
-		// don't use next_sample_rate
-		ctx->output.current_sample_rate = decode_newstream(p->sample_rate, ctx->output.supported_rates, ctx);
+		ctx->output.next_sample_rate = decode_newstream(p->sample_rate, ctx->output.supported_rates, ctx);
 		ctx->output.track_start = ctx->outputbuf->writep;
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
@@ -169,7 +181,7 @@ decode_state pcm_decode(struct thread_ctx_s *ctx) {
 		);
 	}
 
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	bytes = _buf_cont_read(ctx->streambuf);
 
 	iptr = (u8_t *)ctx->streambuf->readp;
 	in = bytes / p->bytes_per_frame;
@@ -187,63 +199,19 @@ decode_state pcm_decode(struct thread_ctx_s *ctx) {
 	// stereo, 16 bits
 	if (p->sample_size == 16 && p->channels == 2) {
 		done = true;
-		if (!p->big_endian) memcpy(optr, iptr, frames * BYTES_PER_FRAME);
-		else {
-			// 4 bytes per frames, 1/2 frame(1 channel) at each loop
-			int count = frames * 2;
-			while (count--) {
-				*optr++ = *(iptr + 1);
-				*optr++ = *iptr;
-				iptr += 2;
-			}
-		}
+		_unpack_s16((ISAMPLE_T *) optr, iptr, frames, 2, p->big_endian);
 	}
 
 	// mono, 16 bits
 	if (p->sample_size == 16 && p->channels == 1) {
-		int count = frames;
-
 		done = true;
-		// 2 bytes per sample and mono, expand to stereo, 1 frame per loop
-		if (!p->big_endian) {
-			while (count--) {
-				*optr++ = *iptr;
-				*optr++ = *(iptr + 1);
-				*optr++ = *iptr++;
-				*optr++ = *iptr++;
-			}
-		}
-		else {
-			while (count--) {
-				*optr++ = *(iptr + 1);
-				*optr++ = *iptr;
-				*optr++ = *(iptr + 1);
-				*optr++ = *iptr++;
-				iptr++;
-			}
-		}
+		_unpack_s16((ISAMPLE_T *) optr, iptr, frames, 1, p->big_endian);
 	}
 
 	// 24 bits, the tricky one
 	if (p->sample_size == 24 && p->channels == 2) {
-		int count = frames * 2;
-
 		done = true;
-		// 3 bytes per sample, shrink to 2 and do 1/2 frame (1 channel) per loop
-		if (!p->big_endian) {
-			while (count--) {
-				iptr++;
-				*optr++ = *iptr++;
-				*optr++ = *iptr++;
-			}
-		}
-		else {
-			while (count--) {
-				*optr++ = *(iptr + 1);
-				*optr++ = *iptr;
-				iptr += 3;
-			}
-		}
+		_unpack_s24((ISAMPLE_T *) optr, iptr, frames, p->big_endian);
 	}
 
 	_buf_inc_readp(ctx->streambuf, frames * p->bytes_per_frame);
@@ -30,8 +30,14 @@ static log_level 	*loglevel = &decode_loglevel;
 
 #define LOCK_D   mutex_lock(ctx->decode.mutex);
 #define UNLOCK_D mutex_unlock(ctx->decode.mutex);
+#if LOCKFREE_BUF
+// decoder is outputbuf's writer, see buffer.c
+#define LOCK_O   buf_begin(ctx->outputbuf, BUF_WRITER)
+#define UNLOCK_O buf_end(ctx->outputbuf, BUF_WRITER)
+#else
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#endif
 
 // macros to map to processing functions - currently only resample.c
 // this can be made more generic when multiple processing mechanisms get added
@@ -48,15 +54,15 @@ static log_level 	*loglevel = &decode_loglevel;
 // transfer all processed frames to the output buf
 static void _write_samples(struct thread_ctx_s *ctx) {
 	size_t frames = ctx->process.out_frames;
-	u16_t *iptr   = (u16_t *) ctx->process.outbuf;
+	ISAMPLE_T *iptr = (ISAMPLE_T *) ctx->process.outbuf;
 	unsigned cnt  = 10;
 
 	LOCK_O;
 
 	while (frames > 0) {
 
-		frames_t f = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
-		u16_t *optr = (u16_t *)ctx->outputbuf->writep;
+		frames_t f = _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME;
+		ISAMPLE_T *optr = (ISAMPLE_T *)ctx->outputbuf->writep;
 
 		if (f > 0) {
 
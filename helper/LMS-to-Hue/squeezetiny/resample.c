@@ -64,6 +64,7 @@ struct soxr {
 	double q_passband_end;      /* 0dB pt. bandwidth to preserve; nyquist=1  0.913 */
 	double q_stopband_begin;    /* Aliasing/imaging control; > passband_end   1    */
 	double scale;
+	unsigned threads;           /* soxr threads, 0 lets OpenMP use all cores       */
 	bool max_rate;
 	bool exception;
 };
@@ -145,7 +146,10 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 	unsigned outrate = 0;
 	int i = 0;
 
-	if (r->exception) {
+	if (ctx->decode.light & (LIGHT_LOWRATE | LIGHT_MONO | LIGHT_STREAM)) {
+		// lights follow whatever rate the codec delivers, never resample
+		outrate = raw_sample_rate;
+	} else if (r->exception) {
 		// find direct match - avoid resampling
 		for (i = 0; supported_rates[i]; i++) {
 			if (raw_sample_rate == supported_rates[i]) {
@@ -200,7 +204,11 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 
 		LOG_INFO("[%p]: resampling from %u -> %u", ctx, raw_sample_rate, outrate);
 
+#if BYTES_PER_FRAME == 4
 		io_spec = SOXR(&gr, io_spec, SOXR_INT16_I, SOXR_INT16_I);
+#else
+		io_spec = SOXR(&gr, io_spec, SOXR_INT32_I, SOXR_INT32_I);
+#endif
 		io_spec.scale = r->scale;
 
 		q_spec = SOXR(&gr, quality_spec, r->q_recipe, r->q_flags);
@@ -218,7 +226,7 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 		}
 
 #if RESAMPLE_MP
-		r_spec = SOXR(&gr, runtime_spec, 0); // make use of libsoxr OpenMP support allowing parallel execution if multiple cores
+		r_spec = SOXR(&gr, runtime_spec, r->threads); // make use of libsoxr OpenMP support allowing parallel execution if multiple cores
 #endif
 
 		LOG_DEBUG("[%p]: resampling with soxr_quality_spec_t[precision: %03.1f, passband_end: %03.6f, stopband_begin: %03.6f, "
@@ -278,6 +286,14 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 	r->max_rate = false;
 	// do not rsample if matching !
 	r->exception = true;
+	r->threads = ctx->config.resample_threads;
+
+#if !RESAMPLE_MP
+	if (r->threads != 1) {
+		LOG_WARN("[%p]: resample threads %u needs RESAMPLE_MP build, using 1", ctx, r->threads);
+		r->threads = 1;
+	}
+#endif
 
 	if (opt) {
 		recipe = next_param(opt, ':');
@@ -337,9 +353,9 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 		r->q_phase_response = atof(phase_response);
 	}
 
-	LOG_INFO("[%p]: resampling %s recipe: 0x%02x, flags: 0x%02x, scale: %03.2f, precision: %03.1f, passband_end: %03.5f, stopband_begin: %03.5f, phase_response: %03.1f",
+	LOG_INFO("[%p]: resampling %s recipe: 0x%02x, flags: 0x%02x, scale: %03.2f, precision: %03.1f, passband_end: %03.5f, stopband_begin: %03.5f, phase_response: %03.1f, threads: %u",
 			ctx, r->max_rate ? "async" : "sync",
-			r->q_recipe, r->q_flags, r->scale, r->q_precision, r->q_passband_end, r->q_stopband_begin, r->q_phase_response);
+			r->q_recipe, r->q_flags, r->scale, r->q_precision, r->q_passband_end, r->q_stopband_begin, r->q_phase_response, r->threads);
 
 	return true;
 }
@@ -253,6 +253,7 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 		output_flush(ctx);
 		ctx->status.frames_played = 0;
 		stream_disconnect(ctx);
+		stream_prefetch_drop(ctx);
 		sendSTAT("STMf", 0, ctx);
 		buf_flush(ctx->streambuf);
 		break;
@@ -263,6 +264,7 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 		if (stream_disconnect(ctx)) {
 			sendSTAT("STMf", 0, ctx);
 		}
+		stream_prefetch_drop(ctx);
 		buf_flush(ctx->streambuf);
 		if (ctx->last_command != 'q') ctx_callback(ctx, SQ_STOP, NULL);
 		break;
@@ -358,7 +360,16 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 			// TODO: must be changed if one day direct streaming is enabled
 			ctx_callback(ctx, SQ_CONNECT, NULL);
 
-			stream_sock(ip, port, strm->flags & 0x20, header, header_len, strm->threshold * 1024, ctx->autostart >= 2, ctx);
+			if (ip == LOCAL_PLAYER_IP && port == LOCAL_PLAYER_PORT) {
+				// extension to slimproto for LocalPlayer - header is filename not http header, don't expect cont
+				stream_file(header, header_len, strm->threshold * 1024, ctx);
+				ctx->autostart -= 2;
+			} else {
+				// fast start does not wait for server's buffer threshold, just enough for codec headers
+				stream_sock(ip, port, strm->flags & 0x20, header, header_len,
+							(ctx->config.fast_start ? min(strm->threshold, FAST_START_THRESHOLD) : strm->threshold) * 1024,
+							ctx->autostart >= 2, ctx);
+			}
 
 			sendSTAT("STMc", 0, ctx);
 			ctx->sentSTMu = ctx->sentSTMo = ctx->sentSTMl = ctx->sentSTMd = false;
@@ -388,6 +399,7 @@ static void process_cont(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 			ctx->stream.meta_interval = ctx->stream.meta_next = cont->metaint;
 		}
 		UNLOCK_S;
+		wake_stream(ctx);
 		wake_controller(ctx);
 	}
 }
@@ -546,14 +558,195 @@ static void process(u8_t *pack, int len, struct thread_ctx_s *ctx) {
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+// read what is available, false when connection is lost
+static bool slimproto_recv(struct thread_ctx_s *ctx) {
+	int n;
+
+	if (ctx->slim_run.expect > 0) {
+		n = recv(ctx->sock, ctx->slim_run.buffer + ctx->slim_run.got, ctx->slim_run.expect, 0);
+	} else if (ctx->slim_run.expect == 0) {
+		n = recv(ctx->sock, ctx->slim_run.buffer + ctx->slim_run.got, 2 - ctx->slim_run.got, 0);
+	} else {
+		LOG_ERROR("[%p] FATAL: negative expect", ctx);
+		return false;
+	}
+
+	if (n <= 0) {
+		if (n < 0 && last_error() == ERROR_WOULDBLOCK) return true;
+		LOG_WARN("[%p] error reading from socket: %s", ctx, n ? strerror(last_error()) : "closed");
+		return false;
+	}
+
+	ctx->slim_run.got += n;
+
+	if (ctx->slim_run.expect > 0) {
+		ctx->slim_run.expect -= n;
+		if (ctx->slim_run.expect == 0) {
+			process(ctx->slim_run.buffer, ctx->slim_run.got, ctx);
+			ctx->slim_run.got = 0;
+		}
+	} else if (ctx->slim_run.got == 2) {
+		ctx->slim_run.expect = ctx->slim_run.buffer[0] << 8 | ctx->slim_run.buffer[1]; // length pack 'n'
+		ctx->slim_run.got = 0;
+		if (ctx->slim_run.expect > MAXBUF) {
+			LOG_ERROR("[%p] FATAL: slimproto packet too big: %d > %d", ctx, ctx->slim_run.expect, MAXBUF);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void slimproto_cli(struct thread_ctx_s *ctx) {
+	if (ctx->cli_sock > 0 && (int) (gettime_ms() - ctx->cli_timeout) > 0) {
+		if (!mutex_trylock(ctx->cli_mutex)) {
+			LOG_INFO("[%p] Closing CLI socket %d", ctx, ctx->cli_sock);
+			closesocket(ctx->cli_sock);
+			ctx->cli_sock = -1;
+			mutex_unlock(ctx->cli_mutex);
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// update playback state when woken or every 100ms
+static void slimproto_status(bool wake, struct thread_ctx_s *ctx) {
+	u32_t now = gettime_ms();
+
+	if (wake || now - ctx->slim_run.last > 100 || ctx->slim_run.last > now) {
+		bool _sendSTMs = false;
+		bool _sendDSCO = false;
+		bool _sendRESP = false;
+		bool _sendMETA = false;
+		bool _sendSTMd = false;
+		bool _sendSTMt = false;
+		bool _sendSTMl = false;
+		bool _sendSTMu = false;
+		bool _sendSTMo = false;
+		bool _sendSTMn = false;
+		bool _stream_disconnect = false;
+		bool _stream_prefetch = false;
+		disconnect_code disconnect_code;
+		size_t header_len = 0;
+		ctx->slim_run.last = now;
+
+		LOCK_S;
+		ctx->status.stream_full = _buf_used(ctx->streambuf);
+		ctx->status.stream_size = ctx->streambuf->size;
+		ctx->status.stream_bytes = ctx->stream.bytes;
+		ctx->status.stream_state = ctx->stream.state;
+
+		if (ctx->stream.state == DISCONNECT) {
+			disconnect_code = ctx->stream.disconnect;
+			ctx->stream.state = STOPPED;
+			_sendDSCO = true;
+			_stream_prefetch = (disconnect_code == DISCONNECT_OK);
+		}
+
+		if (!ctx->stream.sent_headers &&
+			(ctx->stream.state == STREAMING_HTTP || ctx->stream.state == STREAMING_WAIT || ctx->stream.state == STREAMING_BUFFERING)) {
+			header_len = ctx->stream.header_len;
+			memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
+			_sendRESP = true;
+			ctx->stream.sent_headers = true;
+		}
+		if (ctx->stream.meta_send) {
+			header_len = ctx->stream.header_len;
+			memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
+			_sendMETA = true;
+			ctx->stream.meta_send = false;
+			ctx_callback(ctx, SQ_METASEND, NULL);
+		}
+		UNLOCK_S;
+
+		LOCK_O;
+		ctx->status.output_full = _buf_used(ctx->outputbuf);
+		ctx->status.output_size = ctx->outputbuf->size;
+		ctx->status.frames_played = ctx->output.frames_played_dmp;
+		ctx->status.current_sample_rate = ctx->output.current_sample_rate;
+		ctx->status.updated = ctx->output.updated;
+		ctx->status.device_frames = ctx->output.device_frames;
+
+		if (ctx->output.track_started) {
+			_sendSTMs = true;
+			ctx->output.track_started = false;
+			ctx->status.stream_start = ctx->output.track_start_time;
+			ctx_callback(ctx, SQ_STARTED, &ctx->output.track_start_time);
+		}
+
+		if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMu && ctx->status.output_full == 0 && ctx->status.stream_state <= DISCONNECT) {
+			_sendSTMu = true;
+			ctx->sentSTMu = true;
+			ctx_callback(ctx, SQ_FINISHED, NULL);
+		}
+		if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMo && ctx->status.output_full == 0 && ctx->status.stream_state == STREAMING_HTTP) {
+			_sendSTMo = true;
+			ctx->sentSTMo = true;
+			LOG_WARN("[%p]: output underrun", ctx);
+		}
+		UNLOCK_O;
+
+		LOCK_D;
+
+		if (ctx->decode.state == DECODE_RUNNING && now - ctx->status.last > 1000) {
+			_sendSTMt = true;
+			ctx->status.last = now;
+		}
+
+		if ((ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE || (ctx->status.stream_state == DISCONNECT && ctx->stream.disconnect == DISCONNECT_OK))
+			&& !ctx->sentSTMl && ctx->decode.state == DECODE_READY) {
+			if (ctx->autostart == 0) {
+				ctx->decode.state = DECODE_RUNNING;
+				wake_decode(ctx);
+				_sendSTMl = true;
+				ctx->sentSTMl = true;
+			} else if (ctx->autostart == 1) {
+				ctx->decode.state = DECODE_RUNNING;
+				wake_decode(ctx);
+				LOCK_O;
+				if (ctx->output.state == OUTPUT_STOPPED) {
+					ctx->output.state = OUTPUT_BUFFER;
+				}
+				UNLOCK_O;
+			}
+			// autostart 2 and 3 require cont to be received first
+		}
+		if (ctx->decode.state == DECODE_COMPLETE || ctx->decode.state == DECODE_ERROR) {
+			if (ctx->decode.state == DECODE_COMPLETE) _sendSTMd = true;
+			if (ctx->decode.state == DECODE_ERROR)    _sendSTMn = true;
+			ctx->decode.state = DECODE_STOPPED;
+			if (ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE) {
+				_stream_disconnect = true;
+			}
+		}
+		UNLOCK_D;
+
+		if (_stream_disconnect) stream_disconnect(ctx);
+		if (_stream_prefetch) stream_prefetch(ctx);
+
+		// send packets once locks released as packet sending can block
+		if (_sendDSCO) sendDSCO(disconnect_code, ctx->sock);
+		if (_sendSTMs) sendSTAT("STMs", 0, ctx);
+		if (_sendSTMt) sendSTAT("STMt", 0, ctx);
+		if (_sendSTMl) sendSTAT("STMl", 0, ctx);
+		if (_sendSTMd) sendSTAT("STMd", 0, ctx);
+		if (_sendSTMu) sendSTAT("STMu", 0, ctx);
+		if (_sendSTMo) sendSTAT("STMo", 0, ctx);
+		if (_sendSTMn) sendSTAT("STMn", 0, ctx);
+		if (_sendRESP) sendRESP(ctx->slim_run.header, header_len, ctx->sock);
+		if (_sendMETA) sendMETA(ctx->slim_run.header, header_len, ctx->sock);
+	}
+}
+
+#if !STREAM_REACTOR
 /*---------------------------------------------------------------------------*/
 static void slimproto_run(struct thread_ctx_s *ctx) {
-	int  expect = 0;
-	int  got    = 0;
-	u32_t now;
 	event_handle ehandles[2];
 	int timeouts = 0;
 
+	ctx->slim_run.expect = ctx->slim_run.got = 0;
 	set_readwake_handles(ehandles, ctx->sock, ctx->wake_e);
 
 	while (ctx->running && !ctx->new_server) {
@@ -562,61 +755,13 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 
 		if ((ev = wait_readwake(ehandles, 1000)) != EVENT_TIMEOUT) {
 
-			if (ev == EVENT_READ) {
-
-				if (expect > 0) {
-					int n = recv(ctx->sock, ctx->slim_run.buffer + got, expect, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_WARN("[%p] error reading from socket: %s", ctx, n ? strerror(last_error()) : "closed");
-						return;
-					}
-					expect -= n;
-					got += n;
-					if (expect == 0) {
-						process(ctx->slim_run.buffer, got, ctx);
-						got = 0;
-					}
-				} else if (expect == 0) {
-					int n = recv(ctx->sock, ctx->slim_run.buffer + got, 2 - got, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_WARN("[%p] error reading from socket: %s", ctx, n ? strerror(last_error()) : "closed");
-						return;
-					}
-					got += n;
-					if (got == 2) {
-						expect = ctx->slim_run.buffer[0] << 8 | ctx->slim_run.buffer[1]; // length pack 'n'
-						got = 0;
-						if (expect > MAXBUF) {
-							LOG_ERROR("[%p] FATAL: slimproto packet too big: %d > %d", ctx, expect, MAXBUF);
-							return;
-						}
-					}
-				} else {
-					LOG_ERROR("[%p] FATAL: negative expect", ctx);
-					return;
-				}
-
-			}
+			if (ev == EVENT_READ && !slimproto_recv(ctx)) return;
 
 			if (ev == EVENT_WAKE) {
 				wake = true;
 			}
 
-			if (ctx->cli_sock > 0 && (int) (gettime_ms() - ctx->cli_timeout) > 0) {
-				if (!mutex_trylock(ctx->cli_mutex)) {
-					LOG_INFO("[%p] Closing CLI socket %d", ctx, ctx->cli_sock);
-					closesocket(ctx->cli_sock);
-					ctx->cli_sock = -1;
-					mutex_unlock(ctx->cli_mutex);
-				}
-			}
-
+			slimproto_cli(ctx);
 			timeouts = 0;
 
 		} else if (++timeouts > 35) {
@@ -626,129 +771,10 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			return;
 		}
 
-		// update playback state when woken or every 100ms
-		now = gettime_ms();
-
-		if (wake || now - ctx->slim_run.last > 100 || ctx->slim_run.last > now) {
-			bool _sendSTMs = false;
-			bool _sendDSCO = false;
-			bool _sendRESP = false;
-			bool _sendMETA = false;
-			bool _sendSTMd = false;
-			bool _sendSTMt = false;
-			bool _sendSTMl = false;
-			bool _sendSTMu = false;
-			bool _sendSTMo = false;
-			bool _sendSTMn = false;
-			bool _stream_disconnect = false;
-			disconnect_code disconnect_code;
-			size_t header_len = 0;
-			ctx->slim_run.last = now;
-
-			LOCK_S;
-			ctx->status.stream_full = _buf_used(ctx->streambuf);
-			ctx->status.stream_size = ctx->streambuf->size;
-			ctx->status.stream_bytes = ctx->stream.bytes;
-			ctx->status.stream_state = ctx->stream.state;
-
-			if (ctx->stream.state == DISCONNECT) {
-				disconnect_code = ctx->stream.disconnect;
-				ctx->stream.state = STOPPED;
-				_sendDSCO = true;
-			}
-
-			if (!ctx->stream.sent_headers &&
-				(ctx->stream.state == STREAMING_HTTP || ctx->stream.state == STREAMING_WAIT || ctx->stream.state == STREAMING_BUFFERING)) {
-				header_len = ctx->stream.header_len;
-				memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
-				_sendRESP = true;
-				ctx->stream.sent_headers = true;
-			}
-			if (ctx->stream.meta_send) {
-				header_len = ctx->stream.header_len;
-				memcpy(ctx->slim_run.header, ctx->stream.header, header_len);
-				_sendMETA = true;
-				ctx->stream.meta_send = false;
-				ctx_callback(ctx, SQ_METASEND, NULL);
-			}
-			UNLOCK_S;
-
-			LOCK_O;
-			ctx->status.output_full = _buf_used(ctx->outputbuf);
-			ctx->status.output_size = ctx->outputbuf->size;
-			ctx->status.frames_played = ctx->output.frames_played_dmp;
-			ctx->status.current_sample_rate = ctx->output.current_sample_rate;
-			ctx->status.updated = ctx->output.updated;
-			ctx->status.device_frames = ctx->output.device_frames;
-
-			if (ctx->output.track_started) {
-				_sendSTMs = true;
-				ctx->output.track_started = false;
-				ctx->status.stream_start = ctx->output.track_start_time;
-				ctx_callback(ctx, SQ_STARTED, &ctx->output.track_start_time);
-			}
-
-			if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMu && ctx->status.output_full == 0 && ctx->status.stream_state <= DISCONNECT) {
-				_sendSTMu = true;
-				ctx->sentSTMu = true;
-				ctx_callback(ctx, SQ_FINISHED, NULL);
-			}
-			if (ctx->output.state == OUTPUT_RUNNING && !ctx->sentSTMo && ctx->status.output_full == 0 && ctx->status.stream_state == STREAMING_HTTP) {
-				_sendSTMo = true;
-				ctx->sentSTMo = true;
-				LOG_WARN("[%p]: output underrun", ctx);
-			}
-			UNLOCK_O;
-
-			LOCK_D;
-
-			if (ctx->decode.state == DECODE_RUNNING && now - ctx->status.last > 1000) {
-				_sendSTMt = true;
-				ctx->status.last = now;
-			}
-
-			if ((ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE || (ctx->status.stream_state == DISCONNECT && ctx->stream.disconnect == DISCONNECT_OK))
-				&& !ctx->sentSTMl && ctx->decode.state == DECODE_READY) {
-				if (ctx->autostart == 0) {
-					ctx->decode.state = DECODE_RUNNING;
-					_sendSTMl = true;
-					ctx->sentSTMl = true;
-				} else if (ctx->autostart == 1) {
-					ctx->decode.state = DECODE_RUNNING;
-					LOCK_O;
-					if (ctx->output.state == OUTPUT_STOPPED) {
-						ctx->output.state = OUTPUT_BUFFER;
-					}
-					UNLOCK_O;
-				}
-				// autostart 2 and 3 require cont to be received first
-			}
-			if (ctx->decode.state == DECODE_COMPLETE || ctx->decode.state == DECODE_ERROR) {
-				if (ctx->decode.state == DECODE_COMPLETE) _sendSTMd = true;
-				if (ctx->decode.state == DECODE_ERROR)    _sendSTMn = true;
-				ctx->decode.state = DECODE_STOPPED;
-				if (ctx->status.stream_state == STREAMING_HTTP || ctx->status.stream_state == STREAMING_FILE) {
-					_stream_disconnect = true;
-				}
-			}
-			UNLOCK_D;
-
-			if (_stream_disconnect) stream_disconnect(ctx);
-
-			// send packets once locks released as packet sending can block
-			if (_sendDSCO) sendDSCO(disconnect_code, ctx->sock);
-			if (_sendSTMs) sendSTAT("STMs", 0, ctx);
-			if (_sendSTMt) sendSTAT("STMt", 0, ctx);
-			if (_sendSTMl) sendSTAT("STMl", 0, ctx);
-			if (_sendSTMd) sendSTAT("STMd", 0, ctx);
-			if (_sendSTMu) sendSTAT("STMu", 0, ctx);
-			if (_sendSTMo) sendSTAT("STMo", 0, ctx);
-			if (_sendSTMn) sendSTAT("STMn", 0, ctx);
-			if (_sendRESP) sendRESP(ctx->slim_run.header, header_len, ctx->sock);
-			if (_sendMETA) sendMETA(ctx->slim_run.header, header_len, ctx->sock);
-		}
+		slimproto_status(wake, ctx);
 	}
 }
+#endif
 
  /*---------------------------------------------------------------------------*/
 // called from other threads to wake state machine above
@@ -756,19 +782,22 @@ void wake_controller(struct thread_ctx_s *ctx) {
 	wake_signal(ctx->wake_e);
 }
 
-void discover_server(struct thread_ctx_s *ctx) {
-	struct sockaddr_in d;
-	struct sockaddr_in s;
-	char buf[32], vers[] = "VERS", port[] = "JSON", clip[] = "CLIP";
-	struct pollfd pollinfo;
-	u8_t len;
-	int disc_sock = socket(AF_INET, SOCK_DGRAM, 0);
+/*---------------------------------------------------------------------------*/
+static sockfd discover_open(struct thread_ctx_s *ctx) {
+	sockfd disc_sock = socket(AF_INET, SOCK_DGRAM, 0);
 	socklen_t enable = 1;
 
 	ctx->cli_port = 9090;
-
 	setsockopt(disc_sock, SOL_SOCKET, SO_BROADCAST, (const void *)&enable, sizeof(enable));
 
+	return disc_sock;
+}
+
+static void discover_send(sockfd disc_sock, struct thread_ctx_s *ctx) {
+	struct sockaddr_in d;
+	char buf[32], vers[] = "VERS", port[] = "JSON", clip[] = "CLIP";
+	u8_t len;
+
 	len = sprintf(buf,"e%s%c%s%c%s", vers, '\0', port, '\0', clip) + 1;
 
 	memset(&d, 0, sizeof(d));
@@ -777,47 +806,44 @@ void discover_server(struct thread_ctx_s *ctx) {
 	if (!ctx->slimproto_ip) d.sin_addr.s_addr = htonl(INADDR_BROADCAST);
 	else d.sin_addr.s_addr = ctx->slimproto_ip;
 
-	pollinfo.fd = disc_sock;
-	pollinfo.events = POLLIN;
+	LOG_DEBUG("[%p] sending discovery", ctx);
 
-	do {
-		LOG_DEBUG("[%p] sending discovery", ctx);
-		memset(&s, 0, sizeof(s));
+	if (sendto(disc_sock, buf, len, 0, (struct sockaddr *)&d, sizeof(d)) < 0) {
+		LOG_WARN("[%p] error sending discovery", ctx);
+	}
+}
 
-		if (sendto(disc_sock, buf, len, 0, (struct sockaddr *)&d, sizeof(d)) < 0) {
-			LOG_WARN("[%p] error sending discovery", ctx);
-		}
+// true when a server answered, it is then the one to connect to
+static bool discover_recv(sockfd disc_sock, struct thread_ctx_s *ctx) {
+	struct sockaddr_in s;
+	char readbuf[128], *p, vers[] = "VERS", port[] = "JSON", clip[] = "CLIP";
+	socklen_t slen = sizeof(s);
 
-		if (poll(&pollinfo, 1, 5000) == 1) {
-			char readbuf[128], *p;
+	memset(&s, 0, sizeof(s));
+	memset(readbuf, 0, sizeof(readbuf));
+	recvfrom(disc_sock, readbuf, sizeof(readbuf) - 1, 0, (struct sockaddr *)&s, &slen);
 
-			socklen_t slen = sizeof(s);
-			memset(readbuf, 0, sizeof(readbuf));
-			recvfrom(disc_sock, readbuf, sizeof(readbuf) - 1, 0, (struct sockaddr *)&s, &slen);
+	if ((p = strstr(readbuf, vers)) != NULL) {
+		p += strlen(vers);
+		strncpy(ctx->server_version, p + 1, min(SERVER_VERSION_LEN, *p));
+		ctx->server_version[min(SERVER_VERSION_LEN, *p)] = '\0';
+	}
 
-			if ((p = strstr(readbuf, vers)) != NULL) {
-				p += strlen(vers);
-				strncpy(ctx->server_version, p + 1, min(SERVER_VERSION_LEN, *p));
-				ctx->server_version[min(SERVER_VERSION_LEN, *p)] = '\0';
-			}
+	 if ((p = strstr(readbuf, port)) != NULL) {
+		p += strlen(port);
+		strncpy(ctx->server_port, p + 1, min(5, *p));
+		ctx->server_port[min(6, *p)] = '\0';
+	}
 
-			 if ((p = strstr(readbuf, port)) != NULL) {
-				p += strlen(port);
-				strncpy(ctx->server_port, p + 1, min(5, *p));
-				ctx->server_port[min(6, *p)] = '\0';
-			}
+	if ((p = strstr(readbuf, clip)) != NULL) {
+		p += strlen(clip);
+		ctx->cli_port = atoi(p + 1);
+	}
 
-			if ((p = strstr(readbuf, clip)) != NULL) {
-				p += strlen(clip);
-				ctx->cli_port = atoi(p + 1);
-			}
+	strcpy(ctx->server_ip, inet_ntoa(s.sin_addr));
+	LOG_DEBUG("[%p] got response from: %s:%d", ctx, inet_ntoa(s.sin_addr), ntohs(s.sin_port));
 
-			strcpy(ctx->server_ip, inet_ntoa(s.sin_addr));
-			LOG_DEBUG("[%p] got response from: %s:%d", ctx, inet_ntoa(s.sin_addr), ntohs(s.sin_port));
-		}
-	} while (s.sin_addr.s_addr == 0 && ctx->running);
-
-	closesocket(disc_sock);
+	if (s.sin_addr.s_addr == 0) return false;
 
 	ctx->slimproto_ip =  s.sin_addr.s_addr;
 	ctx->slimproto_port = ntohs(s.sin_port);
@@ -825,6 +851,58 @@ void discover_server(struct thread_ctx_s *ctx) {
 	ctx->serv_addr.sin_port = s.sin_port;
 	ctx->serv_addr.sin_addr.s_addr = s.sin_addr.s_addr;
 	ctx->serv_addr.sin_family = AF_INET;
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void slimproto_hello(bool reconnect, struct thread_ctx_s *ctx) {
+	LOG_INFO("[%p] connected", ctx);
+
+	ctx->var_cap[0] = '\0';
+
+	// add on any capablity to be sent to the new server
+	if (ctx->new_server_cap) {
+		strcat(ctx->var_cap, ctx->new_server_cap);
+		free(ctx->new_server_cap);
+		ctx->new_server_cap = NULL;
+	}
+
+	sendHELO(reconnect, ctx->fixed_cap, ctx->var_cap, ctx->config.mac, ctx);
+}
+
+static void slimproto_hangup(struct thread_ctx_s *ctx) {
+	mutex_lock(ctx->cli_mutex);
+	if (ctx->cli_sock != -1) {
+		closesocket(ctx->cli_sock);
+		ctx->cli_sock = -1;
+	}
+	mutex_unlock(ctx->cli_mutex);
+	closesocket(ctx->sock);
+	ctx->sock = -1;
+
+	if (ctx->new_server_cap)	{
+		free(ctx->new_server_cap);
+		ctx->new_server_cap = NULL;
+	}
+}
+
+#if !STREAM_REACTOR
+/*---------------------------------------------------------------------------*/
+static void discover_server(struct thread_ctx_s *ctx) {
+	struct pollfd pollinfo;
+	sockfd disc_sock = discover_open(ctx);
+	bool found = false;
+
+	pollinfo.fd = disc_sock;
+	pollinfo.events = POLLIN;
+
+	do {
+		discover_send(disc_sock, ctx);
+		if (poll(&pollinfo, 1, 5000) == 1) found = discover_recv(disc_sock, ctx);
+	} while (!found && ctx->running);
+
+	closesocket(disc_sock);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -864,19 +942,8 @@ static void slimproto(struct thread_ctx_s *ctx) {
 
 		} else {
 
-			LOG_INFO("[%p] connected", ctx);
-
-			ctx->var_cap[0] = '\0';
 			failed_connect = 0;
-
-			// add on any capablity to be sent to the new server
-			if (ctx->new_server_cap) {
-				strcat(ctx->var_cap, ctx->new_server_cap);
-				free(ctx->new_server_cap);
-				ctx->new_server_cap = NULL;
-			}
-
-			sendHELO(reconnect, ctx->fixed_cap, ctx->var_cap, ctx->config.mac, ctx);
+			slimproto_hello(reconnect, ctx);
 
 			slimproto_run(ctx);
 
@@ -887,36 +954,190 @@ static void slimproto(struct thread_ctx_s *ctx) {
 			usleep(100000);
 		}
 
-		mutex_lock(ctx->cli_mutex);
-		if (ctx->cli_sock != -1) {
-			closesocket(ctx->cli_sock);
-			ctx->cli_sock = -1;
+		slimproto_hangup(ctx);
+	}
+}
+
+#else
+/*---------------------------------------------------------------------------*/
+/*
+ With STREAM_REACTOR, slimproto() above becomes a state machine stepped by the
+ stream reactor thread (see stream.c), so there is no thread per player. The
+ discovery, connect and back-off never block: they wait for slim_run.fd or for
+ slim_run.timeout, which reactor checks at least every POLL_WAIT. Handlers only
+ queue work to other threads or to sq_callback, which does not block either
+*/
+static void slimproto_wait(u32_t delay, bool discover, struct thread_ctx_s *ctx) {
+	ctx->slim_run.state = SLIM_WAIT;
+	ctx->slim_run.fd = -1;
+	ctx->slim_run.discover = discover;
+	ctx->slim_run.timeout = gettime_ms() + delay;
+}
+
+static void slimproto_connect(struct thread_ctx_s *ctx) {
+	LOG_INFO("[%p] connecting to %s:%d", ctx, inet_ntoa(ctx->serv_addr.sin_addr), ntohs(ctx->serv_addr.sin_port));
+
+	ctx->sock = socket(AF_INET, SOCK_STREAM, 0);
+	set_nonblock(ctx->sock);
+	set_nosigpipe(ctx->sock);
+
+	ctx->slim_run.state = SLIM_CONNECTING;
+	ctx->slim_run.fd = ctx->sock;
+	ctx->slim_run.timeout = gettime_ms() + 5*1000;
+
+	// immediate failure is handled by timeout
+	if (connect_async(ctx->sock, (struct sockaddr *) &ctx->serv_addr, sizeof(ctx->serv_addr)) < 0) {
+		ctx->slim_run.timeout = gettime_ms();
+	}
+}
+
+static void slimproto_failed(struct thread_ctx_s *ctx) {
+	bool discover = false;
+
+	LOG_WARN("[%p] unable to connect to server %u", ctx, ctx->slim_run.failed_connect);
+	slimproto_hangup(ctx);
+
+	// rediscover server if it was not set at startup
+	if (!strcmp(ctx->config.server, "?") && ++ctx->slim_run.failed_connect > 5) {
+		ctx->slimproto_ip = 0;
+		discover = true;
+	}
+
+	slimproto_wait(5*1000, discover, ctx);
+}
+
+static void slimproto_lost(struct thread_ctx_s *ctx) {
+	ctx->slim_run.reconnect = true;
+	slimproto_hangup(ctx);
+	slimproto_wait(100, false, ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+// called by reactor on events or on sweep, returns events to wait for on slim_run.fd
+int slimproto_step(struct thread_ctx_s *ctx, short revents, bool wake) {
+	u32_t now = gettime_ms();
+
+	if (!ctx->running) return 0;
+
+	switch (ctx->slim_run.state) {
+	case SLIM_WAIT:
+		if ((int) (now - ctx->slim_run.timeout) < 0) break;
+		if (ctx->new_server) {
+			ctx->slimproto_ip = ctx->new_server;
+			ctx->new_server = 0;
+			ctx->slim_run.reconnect = false;
+			ctx->slim_run.discover = true;
+			LOG_INFO("[%p] switching server", ctx);
+		}
+		if (ctx->slim_run.discover) {
+			ctx->slim_run.state = SLIM_DISCOVER;
+			ctx->slim_run.fd = discover_open(ctx);
+			ctx->slim_run.timeout = now;
+		} else {
+			slimproto_connect(ctx);
+			break;
 		}
-		mutex_unlock(ctx->cli_mutex);
-		closesocket(ctx->sock);
+		// fall through
+	case SLIM_DISCOVER:
+		if ((revents & POLLIN) && discover_recv(ctx->slim_run.fd, ctx)) {
+			closesocket(ctx->slim_run.fd);
+			slimproto_connect(ctx);
+		} else if ((int) (now - ctx->slim_run.timeout) >= 0) {
+			discover_send(ctx->slim_run.fd, ctx);
+			ctx->slim_run.timeout = now + 5*1000;
+		}
+		break;
+	case SLIM_CONNECTING:
+		if (revents) {
+			int error = 0;
+			socklen_t len = sizeof(error);
 
-		if (ctx->new_server_cap)	{
-			free(ctx->new_server_cap);
-			ctx->new_server_cap = NULL;
+			getsockopt(ctx->sock, SOL_SOCKET, SO_ERROR, (void*) &error, &len);
+
+			if (error) {
+				slimproto_failed(ctx);
+			} else {
+				ctx->slim_run.failed_connect = 0;
+				ctx->slim_run.state = SLIM_RUNNING;
+				ctx->slim_run.expect = ctx->slim_run.got = 0;
+				ctx->slim_run.last_recv = now;
+				slimproto_hello(ctx->slim_run.reconnect, ctx);
+			}
+		} else if ((int) (now - ctx->slim_run.timeout) >= 0) {
+			slimproto_failed(ctx);
+		}
+		break;
+	case SLIM_RUNNING:
+		if (revents) {
+			if (!slimproto_recv(ctx)) {
+				slimproto_lost(ctx);
+				break;
+			}
+			ctx->slim_run.last_recv = now;
+		}
+
+		if (revents || wake) slimproto_cli(ctx);
+
+		// expect message from server every 5 seconds, but 30 seconds on mysb.com so timeout after 35 seconds
+		if (now - ctx->slim_run.last_recv > 35*1000) {
+			LOG_WARN("[%p] No messages from server - connection dead", ctx);
+			slimproto_lost(ctx);
+		} else if (ctx->new_server) {
+			slimproto_lost(ctx);
+		} else {
+			slimproto_status(wake, ctx);
 		}
+		break;
 	}
-}
 
+	switch (ctx->slim_run.state) {
+	case SLIM_DISCOVER:
+	case SLIM_RUNNING:
+		return POLLIN;
+	case SLIM_CONNECTING:
+		return POLLOUT;
+	default:
+		return 0;
+	}
+}
+#endif
 
 /*---------------------------------------------------------------------------*/
 void slimproto_close(struct thread_ctx_s *ctx) {
 	LOG_INFO("[%p] slimproto stop for %s", ctx, ctx->config.name);
 	ctx->running = false;
+#if STREAM_REACTOR
+	reactor_del_slimproto(ctx);
+	if (ctx->slim_run.state == SLIM_DISCOVER) closesocket(ctx->slim_run.fd);
+	else if (ctx->slim_run.state != SLIM_WAIT) slimproto_hangup(ctx);
+#else
 	wake_controller(ctx);
 	pthread_join(ctx->thread, NULL);
+#endif
 	mutex_destroy(ctx->mutex);
 	mutex_destroy(ctx->cli_mutex);
 }
 
 
+/*---------------------------------------------------------------------------*/
+static void _add_codec_cap(const char *codec, struct thread_ctx_s *ctx) {
+	int i;
+
+	for (i = 0; i < MAX_CODECS; i++) {
+		// codecs whose library failed to load are not advertised anymore
+		if (codecs[i] && codecs[i]->id && codecs[i]->loaded >= 0 && strstr(codecs[i]->types, codec)) {
+			strcat(ctx->fixed_cap, ",");
+			strcat(ctx->fixed_cap, codec);
+			break;
+		}
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 void slimproto_thread_init(struct thread_ctx_s *ctx) {
+#if !STREAM_REACTOR
 	pthread_attr_t attr;
+#endif
 	char *codec, *buf;
 
 	wake_create(ctx->wake_e);
@@ -937,21 +1158,24 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 	ctx->new_server_cap = NULL;
 
 	LOCK_O;
-	sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", soxr_loaded ? ctx->config.sample_rate : 44100);
+	/*
+	 analysis stream: cap the rate and list pcm first so that server transcodes
+	 down to plain low-rate PCM. There is no channel count capability in HELO,
+	 mono is left to LIGHT_MONO when decoding
+	*/
+	if (ctx->output.light & LIGHT_STREAM) {
+		sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", ctx->config.analysis_rate);
+		if (strstr(ctx->config.codecs, "pcm")) _add_codec_cap("pcm", ctx);
+	} else {
+		sprintf(ctx->fixed_cap, ",MaxSampleRate=%u", soxr_loaded ? ctx->config.sample_rate : 44100);
+	}
 
 	codec = buf = strdup(ctx->config.codecs);
 	while (codec && *codec ) {
 		char *p = strchr(codec, ',');
-		int i;
 
 		if (p) *p = '\0';
-		for (i = 0; i < MAX_CODECS; i++) {
-			if (codecs[i] && codecs[i]->id && strstr(codecs[i]->types, codec)) {
-				strcat(ctx->fixed_cap, ",");
-				strcat(ctx->fixed_cap, codec);
-				break;
-			}
-		}
+		if (!(ctx->output.light & LIGHT_STREAM) || strcmp(codec, "pcm")) _add_codec_cap(codec, ctx);
 		codec = (p) ? p + 1 : NULL;
 	}
 	free(buf);
@@ -960,10 +1184,19 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 
 	ctx->new_server = 0;
 
+#if STREAM_REACTOR
+	LOG_INFO("squeezelite [%p] <=> player [%p]", ctx, ctx->MR);
+	ctx->slim_run.reconnect = false;
+	ctx->slim_run.failed_connect = 0;
+	slimproto_wait(0, true, ctx);
+	reactor_add_slimproto(ctx);
+	wake_controller(ctx);
+#else
 	pthread_attr_init(&attr);
 	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + SLIMPROTO_THREAD_STACK_SIZE);
 	pthread_create(&ctx->thread, &attr, (void *(*)(void*)) slimproto, ctx);
 	pthread_attr_destroy(&attr);
+#endif
 }
 
 
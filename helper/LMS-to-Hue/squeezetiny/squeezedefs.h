@@ -40,6 +40,52 @@
 #define LOOPBACK 1
 #endif
 
+// internal samples are s32 (8) or s16 (4), the later halves buffers memory
+#if !defined(BYTES_PER_FRAME)
+#define BYTES_PER_FRAME 8
+#elif BYTES_PER_FRAME != 4 && BYTES_PER_FRAME != 8
+#error BYTES_PER_FRAME must be 4 or 8
+#endif
+
+// ring buffers mapped twice so that reads and writes never wrap
+#if LINUX && !defined(MIRROR_BUF)
+#define MIRROR_BUF 1
+#endif
+
+// local files are mapped and decoded in place instead of read in streambuf
+#if (LINUX || OSX || FREEBSD) && !defined(MMAP_FILE)
+#define MMAP_FILE 1
+#endif
+
+// ring buffers are single producer/single consumer without mutex, which is
+// left to flush, resize and swap that wait for both sides (see buffer.c)
+#if !defined(LOCKFREE_BUF)
+#if defined(__GNUC__)
+#define LOCKFREE_BUF 1
+#else
+#define LOCKFREE_BUF 0
+#endif
+#endif
+
+// one epoll thread serves the slimproto and stream sockets of all players (Linux only)
+#if !defined(STREAM_REACTOR)
+#define STREAM_REACTOR 0
+#elif STREAM_REACTOR && !LINUX
+#error STREAM_REACTOR requires epoll
+#endif
+
+// TLS sessions can be handed to the kernel for decryption once established
+#if !defined(KTLS)
+#define KTLS (LINUX && USE_SSL)
+#elif KTLS && !(LINUX && USE_SSL)
+#error KTLS requires Linux and USE_SSL
+#endif
+
+// a pool of decoders (one per CPU) serves all players instead of one thread each
+#if !defined(DECODE_POOL)
+#define DECODE_POOL 0
+#endif
+
 #define STREAM_THREAD_STACK_SIZE (1024 * 64)
 #define DECODE_THREAD_STACK_SIZE (1024 * 128)
 #define OUTPUT_THREAD_STACK_SIZE (1024 * 64)
@@ -54,6 +100,11 @@
 #define thread_type pthread_t
 #define mutex_timedlock(m, t) _mutex_timedlock(&m, t)
 int _mutex_timedlock(mutex_type *m, u32_t wait);
+#define cond_type pthread_cond_t
+#define cond_create(c) pthread_cond_init(&c, NULL)
+#define cond_signal(c) pthread_cond_signal(&c)
+#define cond_timedwait(c, m, t) pthread_cond_reltimedwait(&c, &m, t)
+#define cond_destroy(c) pthread_cond_destroy(&c)
 
 #if LINUX || OSX || FREEBSD || SUNOS
 
@@ -40,7 +40,7 @@ typedef	sq_action_t sq_event_t;
 #define MAX_SUPPORTED_SAMPLERATES   2
 
 #define STREAMBUF_SIZE              (2 * 1024 * 1024)
-#define OUTPUTBUF_SIZE              (44100 * 8 * 10)
+#define OUTPUTBUF_SIZE              (44100 * BYTES_PER_FRAME * 10)
 
 typedef enum { SQ_RATE_384000 = 384000, SQ_RATE_352000 = 352000,
                SQ_RATE_192000 = 192000, SQ_RATE_176400 = 176400,
@@ -60,6 +60,7 @@ typedef struct sq_metadata_s {
     char    *title;
     char    *genre;
     char    *artwork;
+    char    *url;
     u32_t   index;
     u32_t   track;
     u32_t   duration;
@@ -75,10 +76,18 @@ typedef	struct sq_dev_param_s {
     char        name[_STR_LEN_];
     u8_t        mac[6];
     bool        soft_volume;
+    bool        analysis_only;
+    bool        fast_start;
+    bool        light_decode;
+    u32_t       analysis_rate;
+    bool        ktls;
+    u8_t        resume_retries;
+    bool        prefetch;
     u32_t       sample_rate;
 #if defined(RESAMPLE)
     bool        resample;
     char        resample_options[_STR_LEN_];
+    u8_t        resample_threads;
 #endif
     struct {
                 char server[_STR_LEN_];
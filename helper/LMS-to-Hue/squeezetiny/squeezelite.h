@@ -145,6 +145,7 @@
 #define OUTPUTBUF_SIZE_CROSSFADE (OUTPUTBUF_SIZE * 12 / 10)
 
 #define MAX_HEADER 4096 // do not reduce as icy-meta max is 4080
+#define FAST_START_THRESHOLD 4 // kB of stream before decoding when fast start is set
 
 #define SL_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
 
@@ -178,6 +179,7 @@ typedef int sockfd;
 #define wake_signal(e) eventfd_write(e, 1)
 #define wake_clear(e) eventfd_t val; eventfd_read(e, &val)
 #define wake_close(e) close(e)
+#define wake_fd(e) e
 #endif
 
 #if SELFPIPE
@@ -187,6 +189,7 @@ typedef int sockfd;
 #define wake_signal(e) write(e.fds[1], ".", 1)
 #define wake_clear(e) char c[10]; read(e, &c, 10)
 #define wake_close(e) close(e.fds[0]); close(e.fds[1])
+#define wake_fd(e) e.fds[0]
 struct wake { 
 	int fds[2];
 };
@@ -199,6 +202,7 @@ struct wake {
 #define wake_signal(e) send(e.fds[1], ".", 1, 0)
 #define wake_clear(e) char c; recv(e, &c, 1, 0)
 #define wake_close(e) closesocket(e.mfds); closesocket(e.fds[0]); closesocket(e.fds[1])
+#define wake_fd(e) e.fds[0]
 struct wake {
 	int mfds;
 	int fds[2];
@@ -229,12 +233,19 @@ void _wake_create(event_event*);
 #define FIXED_ONE  0x10000
 #define MONO_FLAG  0x20000
 
-#define BYTES_PER_FRAME 8
-
+// align decoded samples of n bits on internal sample size
 #if BYTES_PER_FRAME == 8
 #define ISAMPLE_T s32_t
+#define ALIGN8(n)  ((n) << 24)
+#define ALIGN16(n) ((n) << 16)
+#define ALIGN24(n) ((n) << 8)
+#define ALIGN32(n) (n)
 #else
 #define ISAMPLE_T s16_t
+#define ALIGN8(n)  ((n) << 8)
+#define ALIGN16(n) (n)
+#define ALIGN24(n) ((n) >> 8)
+#define ALIGN32(n) ((n) >> 16)
 #endif
 
 // utils.c (non logging)
@@ -245,6 +256,7 @@ char *next_param(char *src, char c);
 u32_t gettime_ms(void);
 void get_mac(u8_t *mac);
 void set_nonblock(sockfd s);
+int connect_async(sockfd sock, const struct sockaddr *addr, socklen_t addrlen);
 int connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen, int timeout);
 void server_addr(char *server, in_addr_t *ip_ptr, unsigned *port_ptr);
 void set_readwake_handles(event_handle handles[], sockfd s, event_event e);
@@ -280,9 +292,23 @@ struct buffer {
 	u8_t *wrap;
 	size_t size;
 	size_t base_size;
-	mutex_type mutex;
+	bool mirror;               // pages mapped twice, see MIRROR_BUF
+	struct {                   // ring saved while a file is mapped, see MMAP_FILE
+		u8_t *buf;
+		size_t size, base_size;
+		bool mirror;
+	} ring;
+	mutex_type mutex;          // members from here on are not swapped by _buf_swap
+#if LOCKFREE_BUF
+	int busy[2];               // BUF_READER and BUF_WRITER are using the buffer
+	int hold;                  // pending holders, sides can't enter (see buffer.c)
+#endif
 };
 
+#define BUF_READER	0
+#define BUF_WRITER	1
+#define BUF_BOTH	2
+
 // _* called with mutex locked
 unsigned _buf_used(struct buffer *buf);
 unsigned _buf_space(struct buffer *buf);
@@ -290,13 +316,25 @@ unsigned _buf_cont_read(struct buffer *buf);
 unsigned _buf_cont_write(struct buffer *buf);
 void _buf_inc_readp(struct buffer *buf, unsigned by);
 void _buf_inc_writep(struct buffer *buf, unsigned by);
+unsigned buf_used(struct buffer *buf);
+unsigned buf_space(struct buffer *buf);
 unsigned _buf_read(void *dst, struct buffer *src, unsigned btes);
 int	 _buf_seek(struct buffer *src, unsigned from, unsigned by);
 void _buf_move(struct buffer *buf, unsigned by);
 void _buf_unwrap(struct buffer *buf, size_t cont);
 void buf_flush(struct buffer *buf);
+bool _buf_map(struct buffer *buf, int fd);
 void buf_adjust(struct buffer *buf, size_t mod);
 void _buf_resize(struct buffer *buf, size_t size);
+void _buf_swap(struct buffer *a, struct buffer *b);
+void _buf_hold(struct buffer *buf, int side);
+void _buf_release(struct buffer *buf);
+#if LOCKFREE_BUF
+void buf_begin(struct buffer *buf, int side);
+bool buf_try_begin(struct buffer *buf, int side);
+void buf_end(struct buffer *buf, int side);
+#endif
+unsigned _buf_write(struct buffer *buf, void *src, unsigned size);
 void buf_init(struct buffer *buf, size_t size);
 void buf_destroy(struct buffer *buf);
 
@@ -307,10 +345,14 @@ void slimproto_thread_init(struct thread_ctx_s *ctx);
 void wake_controller(struct thread_ctx_s *ctx);
 void send_packet(u8_t *packet, size_t len, sockfd sock);
 void wake_controller(struct thread_ctx_s *ctx);
+#if STREAM_REACTOR
+typedef enum { SLIM_WAIT = 0, SLIM_DISCOVER, SLIM_CONNECTING, SLIM_RUNNING } slim_state;
+int  slimproto_step(struct thread_ctx_s *ctx, short revents, bool wake);
+#endif
 
 // stream.c
 typedef enum { STOPPED = 0, DISCONNECT, STREAMING_WAIT,
-			   STREAMING_BUFFERING, STREAMING_FILE, STREAMING_HTTP, SEND_HEADERS, RECV_HEADERS } stream_state;
+			   STREAMING_BUFFERING, STREAMING_FILE, STREAMING_HTTP, SEND_HEADERS, RECV_HEADERS, CONNECTING } stream_state;
 typedef enum { DISCONNECT_OK = 0, LOCAL_DISCONNECT = 1, REMOTE_DISCONNECT = 2, UNREACHABLE = 3, TIMEOUT = 4 } disconnect_code;
 
 struct streamstate {
@@ -331,22 +373,97 @@ struct streamstate {
 	size_t header_mlen;
 	struct sockaddr_in addr;
 	char host[256];
+	bool use_ssl;              // connection is (to be) TLS
+	int connect_events;        // socket events CONNECTING waits for
+	u32_t connect_end;         // CONNECTING gives up after that
+	event_event wake_e;
+	bool wait_space;           // stream thread is idle because streambuf is full
+	u32_t fd_gen;              // bumped when others replace fd, see _fill_end
+	char *body;                // body received along with headers
+	size_t body_len;
+	char *request;             // request as sent by LMS, replayed with a Range to resume
+	size_t request_len;
+	u64_t offset;              // position in resource of first body byte
+	u64_t length;              // resource size when server allows ranges, 0 otherwise
+	stream_state resume_state; // state to restore once resumed, STOPPED when not resuming
+	u8_t resume_left;          // resume attempts left for this track
+	u32_t resumes;             // successful resumes since start
+	u32_t resume_fails;        // failed resumes since start
+#if STREAM_REACTOR
+	bool reactor;              // served by reactor, see STREAM_REACTOR
+	bool reactor_busy;         // more rounds to run without waiting
+	int reactor_fd;            // socket as registered in epoll
+	int reactor_events;
+	bool sock_connect;         // CONNECTING for stream_sock, failure is UNREACHABLE
+	bool sock_plain;           // and it can be tried again without TLS
+#endif
+};
+
+// decoder reads state without LOCK_S, before sizing streambuf so that once it
+// sees DISCONNECT, all what has been received is there
+#if LOCKFREE_BUF
+#define STREAM_STATE(ctx)		__atomic_load_n(&(ctx)->stream.state, __ATOMIC_ACQUIRE)
+#define STREAM_STATE_SET(ctx, s)	__atomic_store_n(&(ctx)->stream.state, (s), __ATOMIC_RELEASE)
+#else
+#define STREAM_STATE(ctx)		((ctx)->stream.state)
+#define STREAM_STATE_SET(ctx, s)	(ctx)->stream.state = (s)
+#endif
+
+typedef enum { PREFETCH_IDLE = 0, PREFETCH_RUNNING, PREFETCH_READY } prefetch_state;
+
+struct prefetchstate {
+	mutex_type mutex;          // protects state and abort
+	prefetch_state state;
+	bool abort;                // tells thread to stop
+	bool joinable;
+	thread_type thread;
+	struct buffer buf;         // storage swapped with streambuf when used
+	size_t size;
+	char *request;             // request sent, response in second half
+	char *response;
+	size_t response_len;
+	struct sockaddr_in addr;
+	sockfd fd;                 // handed over to stream thread when used
+	u64_t bytes;
 };
 
 bool stream_thread_init(unsigned buf_size, struct thread_ctx_s *ctx);
 void stream_close(struct thread_ctx_s *ctx);
 void stream_file(const char *header, size_t header_len, unsigned threshold, struct thread_ctx_s *ctx);
+void wake_stream(struct thread_ctx_s *ctx);
+void wake_stream_space(struct thread_ctx_s *ctx);
 void 		stream_sock(u32_t ip, u16_t port, bool use_ssl, const char *header, size_t header_len, unsigned threshold, bool cont_wait, struct thread_ctx_s *ctx);
 bool stream_disconnect(struct thread_ctx_s *ctx);
+void stream_prefetch(struct thread_ctx_s *ctx);
+void stream_prefetch_drop(struct thread_ctx_s *ctx);
+#if STREAM_REACTOR
+void reactor_add_slimproto(struct thread_ctx_s *ctx);
+void reactor_del_slimproto(struct thread_ctx_s *ctx);
+#endif
 
 // decode.c
 typedef enum { DECODE_STOPPED = 0, DECODE_READY, DECODE_RUNNING, DECODE_COMPLETE, DECODE_ERROR } decode_state;
 
+// reduced fidelity a codec may use when output only feeds the light analyzer
+#define LIGHT_LOWRATE	0x01	// decode at half the source sample rate
+#define LIGHT_MONO		0x02	// analyzer downmixes anyway, decode a single channel
+#define LIGHT_STREAM	0x04	// server was asked for a low-rate PCM analysis stream
+#define LIGHT_FLOAT		0x08	// float codecs may leave float frames in outputbuf
+
 struct decodestate {
 	decode_state state;
 	bool new_stream;
 	mutex_type mutex;
+	mutex_type wake_mutex;     // protects wake, waiting and wait_* only
+	cond_type wake_cond;       // with pool, signals a worker is done with a closing player
+	bool wake, waiting;
+	size_t wait_bytes, wait_space;
+#if DECODE_POOL
+	bool queued, busy;         // in pool's queue or being run by a worker
+	struct thread_ctx_s *next;
+#endif
 	void *handle;
+	u8_t light;                // LIGHT_* reductions for the codec being opened
 #if PROCESS
 	void *process_handle;
 	bool direct;
@@ -372,6 +489,8 @@ struct codec {
 	void (*open)(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx);
 	void (*close)(struct thread_ctx_s *ctx);
 	decode_state (*decode)(struct thread_ctx_s *ctx);
+	bool (*load)(void);		// resolves library on first open, NULL if none
+	int loaded;				// 0 until first open, then 1 or -1 on failure
 };
 
 void decode_init(void);
@@ -379,8 +498,25 @@ void decode_end(void);
 void decode_thread_init(struct thread_ctx_s *ctx);
 
 void decode_close(struct thread_ctx_s *ctx);
+void decode_wake_close(struct thread_ctx_s *ctx);
 void decode_flush(struct thread_ctx_s *ctx);
+void wake_decode(struct thread_ctx_s *ctx);
+void wake_decode_bytes(size_t bytes, struct thread_ctx_s *ctx);
+void wake_decode_space(size_t space, struct thread_ctx_s *ctx);
 unsigned decode_newstream(unsigned sample_rate, int supported_rates[], struct thread_ctx_s *ctx);
+
+// decode_pack.c
+void decode_pack_init(void);
+void _unpack_s16(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, unsigned channels, bool big_endian);
+void _unpack_s24(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool big_endian);
+void _unpack_s32(ISAMPLE_T *optr, u8_t *iptr, frames_t frames, bool big_endian);
+void _interleave_planar(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned bits);
+void _interleave_fixed(ISAMPLE_T *optr, s32_t *lptr, s32_t *rptr, frames_t frames, unsigned fracbits);
+void _interleave_shift(ISAMPLE_T *optr, ISAMPLE_T *iptr, frames_t frames, unsigned channels, unsigned shift);
+void _interleave_float(ISAMPLE_T *optr, float *iptr, frames_t frames, unsigned channels);
+void _interleave_float_planar(ISAMPLE_T *optr, float *lptr, float *rptr, frames_t frames);
+void _store_float(float *optr, float *iptr, frames_t frames, unsigned channels);
+void _store_float_planar(float *optr, float *lptr, float *rptr, frames_t frames);
 bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx);
 
 #if PROCESS
@@ -421,7 +557,7 @@ struct outputstate {
 	output_format format;
 	void *device;
 	bool  track_started;
-	int (* write_cb)(struct thread_ctx_s *ctx, frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags, s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr);
+	int (* write_cb)(struct thread_ctx_s *ctx, frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
 	unsigned start_frames;
 	unsigned frames_played;
 	unsigned frames_played_dmp;// frames played at the point delay is measured
@@ -440,6 +576,9 @@ struct outputstate {
 		u32_t start_at;
 	};
 	u8_t  *track_start;        // set in decode thread
+	unsigned next_sample_rate; // set in decode thread, current one changes at track_start
+	bool next_float;           // same, track frames in outputbuf are float (LIGHT_FLOAT)
+	bool current_float;
 	bool  detect_start_time;   // use in audio extractor
 	u32_t gainL;               // set by slimproto
 	u32_t gainR;               // set by slimproto
@@ -454,8 +593,13 @@ struct outputstate {
 	unsigned fade_secs;        // set by slimproto
 	bool delay_active;
 	int buf_frames;
-	s16_t *buf;
+	s16_t *buf;                // S16_LE frames, or float frames with analysis_only
 	u8_t channels;
+	bool analysis_only;        // no gain nor packing, lights only
+	u32_t silent_frames;       // silence span not materialized in buf
+	bool fast_start;           // start after one block, ignore server threshold
+	bool underrun;
+	u8_t light;                // LIGHT_* fidelity reductions granted to codecs
 };
 
 void output_init(const char *device, unsigned output_buf_size, unsigned rates[], struct thread_ctx_s *ctx);
@@ -472,8 +616,10 @@ bool output_huebridge_thread_init(struct huebridgecl_s *huebridgecl, unsigned ou
 void output_close_common(struct thread_ctx_s *ctx);
 
 // output_pack.c
-void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format);
-void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, s32_t **cross_ptr);
+void output_pack_init(void);
+void _scale_and_pack_frames(void *outputptr, ISAMPLE_T *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format);
+void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
+void _scale_float_frames(float *optr, void *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, bool is_float);
 s32_t gain(s32_t gain, s32_t value);
 s32_t to_gain(float f);
 
@@ -513,6 +659,7 @@ struct thread_ctx_s {
 	char	fixed_cap[128], var_cap[128];
 	status_t			status;
 	struct streamstate	stream;
+	struct prefetchstate prefetch;
 	struct outputstate 	output;
 	struct decodestate 	decode;
 #if PROCESS
@@ -533,6 +680,7 @@ struct thread_ctx_s {
 	sockfd 		sock, fd, cli_sock;
 #if USE_SSL
 	void		*ssl;
+	bool		ktls;			// kernel decrypts, records are read with recv
 #endif
 	char		cli_id[18];		// (6*2)+(5*':')+NULL
 	mutex_type	cli_mutex;
@@ -552,6 +700,19 @@ struct thread_ctx_s {
 		 u8_t 	buffer[MAXBUF];
 		 u32_t	last;
 		 char	header[MAX_HEADER];
+		 int	expect, got;	// packet being received
+#if STREAM_REACTOR
+		 slim_state state;		// see slimproto_step
+		 sockfd	fd;				// socket waited for, discovery's or sock
+		 u32_t	timeout;		// end of WAIT, CONNECTING or next discovery
+		 u32_t	last_recv;		// RUNNING gives up after 35s of silence
+		 bool	reconnect;		// for HELO
+		 bool	discover;		// WAIT ends with discovery
+		 int	failed_connect;
+		 bool	reactor;		// served by reactor, see STREAM_REACTOR
+		 int	reactor_fd;		// socket as registered in epoll
+		 int	reactor_events;
+#endif
 	} slim_run;
 	sq_callback_t	callback;
 	void			*MR;
@@ -25,9 +25,18 @@
 
 #include <fcntl.h>
 
+#if STREAM_REACTOR
+#include <sys/epoll.h>
+#endif
+
 #if USE_SSL
 #include "openssl/ssl.h"
 #include "openssl/err.h"
+// kTLS needs OpenSSL 3 headers, silently disabled with older ones
+#if KTLS && !defined(SSL_OP_ENABLE_KTLS)
+#undef KTLS
+#define KTLS 0
+#endif
 #endif
 
 extern log_level	stream_loglevel;
@@ -35,6 +44,44 @@ static log_level 	*loglevel = &stream_loglevel;
 
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
+#define LOCK_P   mutex_lock(pf->buf.mutex)
+#define UNLOCK_P mutex_unlock(pf->buf.mutex)
+
+// wake event is polled with the socket, except with WINEVENT where it can't
+#if WINEVENT
+#define POLL_FDS	1
+#define IDLE_WAIT	100
+#define POLL_WAIT	100
+#else
+#define POLL_FDS	2
+#define IDLE_WAIT	-1
+#define POLL_WAIT	1000
+#endif
+
+// when streambuf is full, decoder wakes us up once that much is free
+#define RESUME_SPACE (64 * 1024)
+
+// what _stream_prepare can return besides socket events
+#define STREAM_IDLE		0
+#define STREAM_AGAIN	-1
+
+#if STREAM_REACTOR
+// rounds given to a player before serving others, epoll tags are player
+// index * REACTOR_SLOTS + slot
+#define REACTOR_ROUNDS	16
+#define REACTOR_TAG(ctx, slot)	((u32_t) ((ctx) - thread_ctx) * REACTOR_SLOTS + (slot))
+#define REACTOR_EXIT	UINT32_MAX
+
+enum { REACTOR_STREAM_WAKE = 0, REACTOR_STREAM, REACTOR_SLIM_WAKE, REACTOR_SLIM, REACTOR_SLOTS };
+
+static int 			reactor_fd = -1;
+static int 			reactor_count = 0;
+static bool 		reactor_running;
+static pthread_t 	reactor_thread;
+static mutex_type 	reactor_mutex;
+static event_event 	reactor_wake;
+static u32_t		reactor_sweep;
+#endif
 
 #if USE_SSL
 #define _last_error() ERROR_WOULDBLOCK
@@ -42,9 +89,92 @@ static log_level 	*loglevel = &stream_loglevel;
 static SSL_CTX *SSLctx = NULL;
 static int SSLcount = 0;
 
+/*
+ Servers are remembered by host:port for all players: the last TLS session to
+ resume handshake and the fact that TLS is needed, so that plain connection is
+ not tried first. Least recently used entry is recycled
+*/
+#define SSL_CACHE_SIZE	16
+
+static struct {
+	char key[256+6+1];
+	SSL_SESSION *session;
+	u32_t last;
+} SSLcache[SSL_CACHE_SIZE];
+static mutex_type SSLmutex;
+
+static void _ssl_cache_key(char *key, struct thread_ctx_s *ctx) {
+	sprintf(key, "%s:%u", *ctx->stream.host ? ctx->stream.host : inet_ntoa(ctx->stream.addr.sin_addr),
+			ntohs(ctx->stream.addr.sin_port));
+}
+
+// called with SSLmutex
+static int _ssl_cache_find(char *key, bool create) {
+	int i, lru = 0;
+
+	for (i = 0; i < SSL_CACHE_SIZE; i++) {
+		if (!strcmp(SSLcache[i].key, key)) return i;
+		if (SSLcache[i].last < SSLcache[lru].last) lru = i;
+	}
+
+	if (!create) return -1;
+
+	if (SSLcache[lru].session) SSL_SESSION_free(SSLcache[lru].session);
+	SSLcache[lru].session = NULL;
+	strcpy(SSLcache[lru].key, key);
+
+	return lru;
+}
+
+static bool _ssl_cache_needed(struct thread_ctx_s *ctx) {
+	char key[sizeof(SSLcache[0].key)];
+	int i;
+
+	_ssl_cache_key(key, ctx);
+	mutex_lock(SSLmutex);
+	if ((i = _ssl_cache_find(key, false)) >= 0) SSLcache[i].last = gettime_ms();
+	mutex_unlock(SSLmutex);
+
+	return i >= 0;
+}
+
+// offer last session for resumption, to be called before handshake
+static void _ssl_cache_resume(struct thread_ctx_s *ctx) {
+	char key[sizeof(SSLcache[0].key)];
+	int i;
+
+	_ssl_cache_key(key, ctx);
+	mutex_lock(SSLmutex);
+	if ((i = _ssl_cache_find(key, false)) >= 0 && SSLcache[i].session) SSL_set_session(ctx->ssl, SSLcache[i].session);
+	mutex_unlock(SSLmutex);
+}
+
+// after handshake and again before closing as TLS 1.3 tickets come later
+static void _ssl_cache_update(struct thread_ctx_s *ctx) {
+	char key[sizeof(SSLcache[0].key)];
+	SSL_SESSION *session = SSL_get1_session(ctx->ssl);
+	int i;
+
+	_ssl_cache_key(key, ctx);
+	mutex_lock(SSLmutex);
+	i = _ssl_cache_find(key, true);
+	if (SSLcache[i].session) SSL_SESSION_free(SSLcache[i].session);
+	SSLcache[i].session = session;
+	SSLcache[i].last = gettime_ms();
+	mutex_unlock(SSLmutex);
+}
+
 static int _recv(struct thread_ctx_s *ctx, void *buffer, size_t bytes, int options) {
 	int n;
 	if (!ctx->ssl) return recv(ctx->fd, buffer, bytes, options);
+#if KTLS
+	// application data comes decrypted, other records (alerts, tickets) fail
+	// with EIO and are left to OpenSSL which reads them with their type
+	if (ctx->ktls) {
+		n = recv(ctx->fd, buffer, bytes, options);
+		if (n >= 0 || errno != EIO) return n;
+	}
+#endif
 	n = SSL_read(ctx->ssl, (u8_t*) buffer, bytes);
 	if (n <= 0 && SSL_get_error(ctx->ssl, n) == SSL_ERROR_ZERO_RETURN) return 0;
 	return n;
@@ -70,18 +200,18 @@ be no frame available. As well select (poll) < 0 does not mean that there is
 no data pending
 */
 static int _poll(struct thread_ctx_s *ctx, struct pollfd *pollinfo, int timeout) {
-	if (!ctx->ssl) return poll(pollinfo, 1, timeout);
+	if (!ctx->ssl) return poll(pollinfo, POLL_FDS, timeout);
 	if (pollinfo->events & POLLIN && SSL_pending(ctx->ssl)) {
 		if (pollinfo->events & POLLOUT) poll(pollinfo, 1, 0);
 		pollinfo->revents = POLLIN;
 		return 1;
 	}
-	return poll(pollinfo, 1, timeout);
+	return poll(pollinfo, POLL_FDS, timeout);
 }
 #else
 #define _recv(ctx, buf, n, opt) recv(ctx->fd, buf, n, opt)
 #define _send(ctx, buf, n, opt) send(ctx->fd, buf, n, opt)
-#define _poll(ctx, pollinfo, timeout) poll(pollinfo, 1, timeout)
+#define _poll(ctx, pollinfo, timeout) poll(pollinfo, POLL_FDS, timeout)
 #define _last_error() last_error()
 #endif
 
@@ -117,8 +247,12 @@ static bool send_header(struct thread_ctx_s *ctx) {
 bool stream_disconnect(struct thread_ctx_s *ctx) {
 	bool disc = false;
 	LOCK_S;
+	// stream thread might be receiving with fd and ssl
+	_buf_hold(ctx->streambuf, BUF_WRITER);
+	ctx->stream.fd_gen++;
 #if USE_SSL
 	if (ctx->ssl) {
+		_ssl_cache_update(ctx);
 		SSL_shutdown(ctx->ssl);
 		SSL_free(ctx->ssl);
 		ctx->ssl = NULL;
@@ -129,16 +263,20 @@ bool stream_disconnect(struct thread_ctx_s *ctx) {
 		ctx->fd = -1;
 		disc = true;
 	}
-	ctx->stream.state = STOPPED;
+	STREAM_STATE_SET(ctx, STOPPED);
+	_buf_release(ctx->streambuf);
 	UNLOCK_S;
+	wake_stream(ctx);
+	wake_decode(ctx);
 	return disc;
 }
 
 static void _disconnect(stream_state state, disconnect_code disconnect, struct thread_ctx_s *ctx) {
-	ctx->stream.state = state;
+	STREAM_STATE_SET(ctx, state);
 	ctx->stream.disconnect = disconnect;
 #if USE_SSL
 	if (ctx->ssl) {
+		_ssl_cache_update(ctx);
 		SSL_shutdown(ctx->ssl);
 		SSL_free(ctx->ssl);
 		ctx->ssl = NULL;
@@ -146,9 +284,71 @@ static void _disconnect(stream_state state, disconnect_code disconnect, struct t
 #endif
 	closesocket(ctx->fd);
 	ctx->fd = -1;
+	ctx->stream.body_len = 0;
+	ctx->stream.resume_state = STOPPED;
 	wake_controller(ctx);
+	wake_decode(ctx);
+}
+
+#if USE_SSL
+/*---------------------------------------------------------------------------*/
+// set TLS on a connected socket, handshake is left to _ssl_handshake
+static void _ssl_open(int sock, struct thread_ctx_s *ctx) {
+	ctx->ssl = SSL_new(SSLctx);
+	SSL_set_fd(ctx->ssl, sock);
+	ctx->ktls = false;
+
+#if KTLS
+	// OpenSSL installs kernel keys after handshake if cipher and kernel allow
+	if (ctx->config.ktls && OpenSSL_version_num() >= 0x30000000) SSL_set_options(ctx->ssl, SSL_OP_ENABLE_KTLS);
+#endif
+
+	// add SNI
+	if (*ctx->stream.host) SSL_set_tlsext_host_name(ctx->ssl, ctx->stream.host);
+	_ssl_cache_resume(ctx);
+}
+
+// one handshake step (socket is non-blocking), returns 1 when done, 0 when
+// events must be waited for and -1 on error, in which case SSL is freed
+static int _ssl_handshake(struct thread_ctx_s *ctx, int *events) {
+	int status, err = 0;
+
+	ERR_clear_error();
+	status = SSL_connect(ctx->ssl);
+
+	// error or non-blocking requires more time
+	if (status < 0) {
+		err = SSL_get_error(ctx->ssl, status);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+			*events = err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+			return 0;
+		}
+	}
+
+	if (status != 1) {
+		LOG_WARN("[%p] unable to open SSL socket %d (%d)", ctx, status, err);
+		SSL_free(ctx->ssl);
+		ctx->ssl = NULL;
+		return -1;
+	}
+
+	LOG_INFO("[%p] TLS session %s", ctx, SSL_session_reused(ctx->ssl) ? "resumed" : "created");
+	_ssl_cache_update(ctx);
+
+#if KTLS
+	if (ctx->config.ktls) {
+		ctx->ktls = BIO_get_ktls_recv(SSL_get_rbio(ctx->ssl));
+		LOG_INFO("[%p] kernel TLS receive %s", ctx, ctx->ktls ? "enabled" : "not available");
+	}
+#endif
+
+	return 1;
 }
+#endif
 
+#if !STREAM_REACTOR
+/*---------------------------------------------------------------------------*/
+// blocking, for stream_sock on slimproto thread
 static int connect_socket(bool use_ssl, struct thread_ctx_s *ctx) {
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
 
@@ -170,296 +370,1159 @@ static int connect_socket(bool use_ssl, struct thread_ctx_s *ctx) {
 
 #if USE_SSL
 	if (use_ssl) {
-		ctx->ssl = SSL_new(SSLctx);
-		SSL_set_fd(ctx->ssl, sock);
+		int rc, events;
+
+		// caller is allowed to block, so just spin on handshake
+		_ssl_open(sock, ctx);
+		while ((rc = _ssl_handshake(ctx, &events)) == 0);
+
+		if (rc < 0) {
+			closesocket(sock);
+			return -1;
+		}
+	} else ctx->ssl = NULL;
+#endif
+
+	ctx->stream.use_ssl = use_ssl;
+	return sock;
+}
+#endif
 
-		// add SNI
-		if (*ctx->stream.host) SSL_set_tlsext_host_name(ctx->ssl, ctx->stream.host);
+/*---------------------------------------------------------------------------*/
+/*
+ Non-blocking version of connect_socket for the stream thread or reactor,
+ which must not wait for a server. Socket is set in CONNECTING state where
+ TCP connect and TLS handshake progress on socket events, then it moves to
+ SEND_HEADERS. With STREAM_REACTOR, stream_sock connects that way too as it
+ runs on reactor. Called with LOCK_S
+*/
+static bool _connect_start(bool use_ssl, struct thread_ctx_s *ctx) {
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
 
-		// try to connect (socket is non-blocking)
-		while (1) {
-			int status, err = 0;
+	LOG_INFO("[%p] connecting to %s:%d", ctx, inet_ntoa(ctx->stream.addr.sin_addr), ntohs(ctx->stream.addr.sin_port));
 
-			ERR_clear_error();
-			status = SSL_connect(ctx->ssl);
+	if (sock < 0) {
+		LOG_ERROR("[%p] failed to create socket", ctx);
+		return false;
+	}
 
-			// successful negotiation
-			if (status == 1) break;
+	set_nonblock(sock);
+	set_nosigpipe(sock);
 
-			// error or non-blocking requires more time
-			if (status < 0) {
-				err = SSL_get_error(ctx->ssl, status);
-				if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) continue;
-			}
+	if (connect_async(sock, (struct sockaddr *) &ctx->stream.addr, sizeof(ctx->stream.addr)) < 0) {
+		LOG_WARN("[%p] unable to connect to server", ctx);
+		closesocket(sock);
+		return false;
+	}
 
-			LOG_WARN("[%p] unable to open SSL socket %d (%d)", ctx, status, err);
+	ctx->fd = sock;
+	ctx->stream.use_ssl = use_ssl;
+	ctx->stream.connect_events = POLLOUT;
+	ctx->stream.connect_end = gettime_ms() + 10*1000;
+	ctx->stream.state = CONNECTING;
+#if STREAM_REACTOR
+	ctx->stream.sock_connect = ctx->stream.sock_plain = false;
+#endif
 
-			closesocket(sock);
+	return true;
+}
+
+// progress on socket events, returns false when connection failed
+static bool _connect_step(struct thread_ctx_s *ctx) {
+	int error = 0;
+
+#if USE_SSL
+	if (!ctx->ssl) {
+#endif
+		socklen_t len = sizeof(error);
+
+		getsockopt(ctx->fd, SOL_SOCKET, SO_ERROR, (void *) &error, &len);
+		if (error) return false;
+#if USE_SSL
+		if (!ctx->stream.use_ssl) {
+			ctx->stream.state = SEND_HEADERS;
+			return true;
+		}
+		_ssl_open(ctx->fd, ctx);
+	}
+
+	error = _ssl_handshake(ctx, &ctx->stream.connect_events);
+	if (error > 0) ctx->stream.state = SEND_HEADERS;
+	return error >= 0;
+#else
+	ctx->stream.state = SEND_HEADERS;
+	return true;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+// body bytes received with headers are served first
+static int _recv_body(struct thread_ctx_s *ctx, void *buffer, size_t bytes) {
+	if (ctx->stream.body_len) {
+		bytes = min(bytes, ctx->stream.body_len);
+		memcpy(buffer, ctx->stream.body, bytes);
+		ctx->stream.body += bytes;
+		ctx->stream.body_len -= bytes;
+		return bytes;
+	}
+	return _recv(ctx, buffer, bytes, 0);
+}
+
+/*---------------------------------------------------------------------------*/
+// learn from response headers if the resource can be re-entered with a Range
+static void _resume_parse(struct thread_ctx_s *ctx) {
+	char *header = ctx->stream.header, *p, unit[8] = "";
+	unsigned long long start, end, total;
+	int status = 0;
+
+	ctx->stream.offset = ctx->stream.length = 0;
+	sscanf(header, "HTTP/%*s %d", &status);
+
+	// icy meta and chunks are not counted in bytes received
+	if (strcasestr(header, "icy-metaint:") || strcasestr(header, "Transfer-Encoding:")) return;
+
+	if (status == 206) {
+		if ((p = strcasestr(header, "Content-Range:")) != NULL &&
+			sscanf(p + 14, " bytes %llu-%llu/%llu", &start, &end, &total) == 3) {
+			ctx->stream.offset = start;
+			ctx->stream.length = end + 1;
+		}
+	} else if (status == 200 && (p = strcasestr(header, "Accept-Ranges:")) != NULL &&
+			   sscanf(p + 14, " %7s", unit) == 1 && !strcasecmp(unit, "bytes") &&
+			   (p = strcasestr(header, "Content-Length:")) != NULL &&
+			   sscanf(p + 15, " %llu", &total) == 1) {
+		ctx->stream.length = total;
+	}
+
+	LOG_DEBUG("[%p] resumable: %s (%llu-%llu)", ctx, ctx->stream.length ? "yes" : "no", ctx->stream.offset, ctx->stream.length);
+}
+
+/*---------------------------------------------------------------------------*/
+// reconnect a dropped stream where it stopped, returns false if not possible
+static bool _resume(struct thread_ctx_s *ctx) {
+	u64_t pos = ctx->stream.offset + ctx->stream.bytes;
+	char *line, *next, *end = ctx->stream.request + ctx->stream.request_len;
+	size_t len = 0;
+
+	// received headers are overwritten so they must have been sent to LMS
+	if (!ctx->stream.length || pos >= ctx->stream.length || !ctx->stream.sent_headers || !ctx->stream.resume_left) return false;
+
+	LOG_WARN("[%p] stream dropped at %llu/%llu (%u attempts left)", ctx, pos, ctx->stream.length, ctx->stream.resume_left);
+
+#if USE_SSL
+	if (ctx->ssl) {
+		SSL_shutdown(ctx->ssl);
+		SSL_free(ctx->ssl);
+		ctx->ssl = NULL;
+	}
+#endif
+	closesocket(ctx->fd);
+	ctx->fd = -1;
+
+	// replay LMS request with our own Range inserted before the blank line
+	for (line = ctx->stream.request; line < end; line = next) {
+		next = memchr(line, '\n', end - line);
+		next = next ? next + 1 : end;
+		if (!strncasecmp(line, "Range:", 6)) continue;
+		if (*line == '\r' || *line == '\n') len += sprintf(ctx->stream.header + len, "Range: bytes=%llu-\r\n", (unsigned long long) pos);
+		memcpy(ctx->stream.header + len, line, next - line);
+		len += next - line;
+	}
+
+	ctx->stream.header_len = len;
+	ctx->stream.endtok = 0;
+	ctx->stream.resume_state = ctx->stream.state;
+
+	// connection goes on in CONNECTING so that decoder can drain streambuf
+	while (ctx->stream.resume_left) {
+		ctx->stream.resume_left--;
+		if (_connect_start(ctx->stream.use_ssl, ctx)) return true;
+		ctx->stream.resume_fails++;
+	}
+
+	ctx->stream.state = ctx->stream.resume_state;
+	ctx->stream.resume_state = STOPPED;
+	LOG_ERROR("[%p] unable to resume (resumed: %u, failed: %u)", ctx, ctx->stream.resumes, ctx->stream.resume_fails);
+
+	return false;
+}
+
+// a resume attempt failed, try next one
+static void _resume_again(struct thread_ctx_s *ctx) {
+	ctx->stream.resume_fails++;
+	ctx->stream.state = ctx->stream.resume_state;
+	ctx->stream.resume_state = STOPPED;
+	if (!_resume(ctx)) _disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+}
+
+// asynchronous connect did not make it, resume has other attempts
+static void _connect_failed(struct thread_ctx_s *ctx) {
+	LOG_WARN("[%p] unable to connect to server", ctx);
+	if (ctx->stream.resume_state != STOPPED) _resume_again(ctx);
+#if STREAM_REACTOR
+	else if (ctx->stream.sock_connect && ctx->stream.sock_plain) {
+		// as stream_sock does without reactor, one more try in plain
+#if USE_SSL
+		if (ctx->ssl) {
 			SSL_free(ctx->ssl);
 			ctx->ssl = NULL;
-
-			return -1;
 		}
-	} else ctx->ssl = NULL;
 #endif
+		closesocket(ctx->fd);
+		ctx->fd = -1;
+		if (_connect_start(false, ctx)) ctx->stream.sock_connect = true;
+		else _disconnect(DISCONNECT, UNREACHABLE, ctx);
+	} else if (ctx->stream.sock_connect) _disconnect(DISCONNECT, UNREACHABLE, ctx);
+#endif
+	else _disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
+}
 
-	return sock;
+/*---------------------------------------------------------------------------*/
+// wait for socket (if any) or wake event, returns true when socket is ready
+static bool _wait(struct thread_ctx_s *ctx, struct pollfd *pollinfo, int timeout) {
+	pollinfo[0].revents = 0;
+#if !WINEVENT
+	pollinfo[1].fd = wake_fd(ctx->stream.wake_e);
+	pollinfo[1].events = POLLIN;
+	pollinfo[1].revents = 0;
+#endif
+
+	if (_poll(ctx, pollinfo, timeout) <= 0) return false;
+
+#if !WINEVENT
+	if (pollinfo[1].revents) {
+		wake_clear(pollinfo[1].fd);
+	}
+#endif
+
+	return pollinfo[0].revents != 0;
 }
 
-static void *stream_thread(struct thread_ctx_s *ctx) {
+/*---------------------------------------------------------------------------*/
+/*
+ Stream thread is streambuf's writer. With LOCKFREE_BUF, data is received
+ out of LOCK_S, in the writer section. The mutex is released once in it
+ (holders may have it) and taken back after, when the stream can have been
+ changed: others that replace fd, ssl or body hold the writer first and
+ bump fd_gen. Both are called with LOCK_S and return with it, false when
+ nothing shall be done
+*/
+#if LOCKFREE_BUF
+static bool _fill_begin(struct thread_ctx_s *ctx) {
+	if (!buf_try_begin(ctx->streambuf, BUF_WRITER)) return false;
+	UNLOCK_S;
+	return true;
+}
 
-	while (ctx->stream_running) {
+static bool _fill_end(u32_t gen, struct thread_ctx_s *ctx) {
+	buf_end(ctx->streambuf, BUF_WRITER);
+	LOCK_S;
+	return ctx->stream.fd_gen == gen;
+}
+#else
+#define _fill_begin(ctx) true
+#define _fill_end(gen, ctx) ((void) (gen), true)
+#endif
+
+/*---------------------------------------------------------------------------*/
+// handle socket events, the only place where network is read or written
+static void _stream_process(struct thread_ctx_s *ctx, short revents) {
+	size_t space;
 
-		struct pollfd pollinfo;
-		size_t space;
+	LOCK_S;
 
-		LOCK_S;
+	// check socket has not been closed while in poll
+	if (ctx->fd < 0) {
+		UNLOCK_S;
+		return;
+	}
+
+	if (ctx->stream.state == CONNECTING) {
+		if (!_connect_step(ctx)) _connect_failed(ctx);
+		UNLOCK_S;
+		return;
+	}
+
+	if ((revents & POLLOUT) && ctx->stream.state == SEND_HEADERS) {
+		if (send_header(ctx)) ctx->stream.state = RECV_HEADERS;
+		ctx->stream.header_mlen = ctx->stream.header_len;
+		ctx->stream.header_len = 0;
+		UNLOCK_S;
+		return;
+	}
+
+	if (revents & (POLLIN | POLLHUP)) {
+
+		// get response headers
+		if (ctx->stream.state == RECV_HEADERS) {
+
+			// read a chunk and look for end of headers, rest is body
+			char *p = ctx->stream.header + ctx->stream.header_len;
+			int i, n = _recv(ctx, p, MAX_HEADER - 1 - ctx->stream.header_len, 0);
+			if (n <= 0) {
+				if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
+					UNLOCK_S;
+					return;
+				}
+				LOG_WARN("[%p] error reading headers: %s", ctx, n ? strerror(last_error()) : "closed");
+
+				// a resume that fails can try again
+				if (ctx->stream.resume_state != STOPPED) {
+					_resume_again(ctx);
+					UNLOCK_S;
+					return;
+				}
+#if USE_SSL
+				if (!ctx->ssl && !ctx->stream.header_len) {
+					// let's restart with SSL this time
+					ctx->stream.header_len = ctx->stream.header_mlen;
+					closesocket(ctx->fd);
+					ctx->fd = -1;
+					LOG_INFO("[%p] now attempting with SSL", ctx);
+
+					// can't block here (reactor serves all players)
+					if (_connect_start(true, ctx)) {
+						UNLOCK_S;
+						return;
+					}
+				}
+#endif
+				_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
+				UNLOCK_S;
+				return;
+			}
+
+			for (i = 0; i < n; i++) {
+				ctx->stream.header_len++;
+				if (ctx->stream.header_len > 1 && (p[i] == '\r' || p[i] == '\n')) {
+					if (++ctx->stream.endtok == 4) break;
+				} else {
+					ctx->stream.endtok = 0;
+				}
+			}
+
+			if (ctx->stream.endtok == 4) {
+				// body that came along is kept aside and consumed before socket
+				ctx->stream.body_len = n - (i + 1);
+				ctx->stream.body = ctx->stream.header + MAX_HEADER;
+				memcpy(ctx->stream.body, p + i + 1, ctx->stream.body_len);
+
+				*(ctx->stream.header + ctx->stream.header_len) = '\0';
+				LOG_INFO("[%p] headers: len: %d (body: %u)\n%s", ctx, ctx->stream.header_len, ctx->stream.body_len, ctx->stream.header);
+
+				if (ctx->stream.resume_state != STOPPED) {
+					u64_t pos = ctx->stream.offset + ctx->stream.bytes;
+					stream_state state = ctx->stream.resume_state;
+
+					// LMS and decoder shall not notice, only continuation is accepted
+					_resume_parse(ctx);
+					if (ctx->stream.length && ctx->stream.offset == pos) {
+						ctx->stream.state = state;
+						ctx->stream.resume_state = STOPPED;
+						ctx->stream.offset -= ctx->stream.bytes;
+						ctx->stream.resumes++;
+						LOG_INFO("[%p] stream resumed at %llu (resumed: %u, failed: %u)", ctx, pos, ctx->stream.resumes, ctx->stream.resume_fails);
+					} else {
+						ctx->stream.resume_fails++;
+						LOG_ERROR("[%p] server did not resume at %llu (resumed: %u, failed: %u)", ctx, pos, ctx->stream.resumes, ctx->stream.resume_fails);
+						_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+					}
+				} else {
+					_resume_parse(ctx);
+					ctx->stream.state = ctx->stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
+					wake_controller(ctx);
+				}
+			} else if (ctx->stream.header_len >= MAX_HEADER - 1) {
+				LOG_ERROR("[%p] received headers too long: %u", ctx, ctx->stream.header_len);
+				_disconnect(DISCONNECT, LOCAL_DISCONNECT, ctx);
+			}
 
-		/*
-		It is required to use min with buf_space as it is the full space - 1,
-		otherwise, a write to full would be authorized and the write pointer
-		would wrap to the read pointer, making impossible to know if the buffer
-		is full or empty. This as the consequence, though, that the buffer can
-		never be totally full and can only wrap once the read pointer has moved
-		so it is impossible to count on having a proper multiply of any number
-		of bytes in the buffer
-		*/
-		space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
-
-		if (ctx->fd < 0 || !space || ctx->stream.state <= STREAMING_WAIT) {
 			UNLOCK_S;
-			usleep(100000);
-			continue;
+			return;
 		}
 
-		if (ctx->stream.state == STREAMING_FILE) {
+		// receive icy meta data
+
+		if (ctx->stream.meta_interval && ctx->stream.meta_next == 0) {
+			if (ctx->stream.meta_left == 0) {
+				// read meta length
+				u8_t c;
+				int n = _recv_body(ctx, &c, 1);
+				if (n <= 0) {
+					if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
+						UNLOCK_S;
+						return;
+					}
+					LOG_WARN("[%p] error reading icy meta: %s", ctx, n ? strerror(last_error()) : "closed");
+					_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
+					UNLOCK_S;
+					return;
+				}
+				ctx->stream.meta_left = 16 * c;
+				ctx->stream.header_len = 0; // amount of received meta data
+				// MAX_HEADER must be more than meta max of 16 * 255
+			}
+
+			if (ctx->stream.meta_left) {
+				int n = _recv_body(ctx, ctx->stream.header + ctx->stream.header_len, ctx->stream.meta_left);
+				if (n <= 0) {
+					if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
+						UNLOCK_S;
+						return;
+					}
+					LOG_WARN("[%p] error reading icy meta: %s", ctx, n ? strerror(last_error()) : "closed");
+					_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
+					UNLOCK_S;
+					return;
+				}
+				ctx->stream.meta_left -= n;
+				ctx->stream.header_len += n;
+			}
+
+			if (ctx->stream.meta_left == 0) {
+				if (ctx->stream.header_len) {
+					*(ctx->stream.header + ctx->stream.header_len) = '\0';
+					LOG_INFO("[%p] icy meta: len: %u\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
+					ctx->stream.meta_send = true;
+					wake_controller(ctx);
+				}
+				ctx->stream.meta_next = ctx->stream.meta_interval;
+				UNLOCK_S;
+				return;
+			}
+
+		// stream body into streambuf
+		} else {
+			u32_t gen = ctx->stream.fd_gen;
+			int n;
 
-			int n = read(ctx->fd, ctx->streambuf->writep, space);
-			if (n == 0) {
-				LOG_INFO("[%p] end of stream", ctx);
+			// a holder is waiting for us, come back when it's done
+			if (!_fill_begin(ctx)) {
+				UNLOCK_S;
+				return;
+			}
+
+			space = _buf_cont_write(ctx->streambuf);
+
+			if (ctx->stream.meta_interval) {
+				space = min(space, ctx->stream.meta_next);
+			}
+
+			n = _recv_body(ctx, ctx->streambuf->writep, space);
+			if (n > 0) _buf_inc_writep(ctx->streambuf, n);
+
+			// stream might have been disconnected or replaced meanwhile
+			if (!_fill_end(gen, ctx)) {
+				UNLOCK_S;
+				return;
+			}
+
+			if (n == 0 && !_resume(ctx)) {
+				LOG_INFO("[%p] end of stream (t:%lld)", ctx, ctx->stream.bytes);
 				_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
 			}
+			if (n < 0 && last_error() != ERROR_WOULDBLOCK) {
+				LOG_WARN("[%p] error reading: %s", ctx, strerror(last_error()));
+				if (!_resume(ctx)) _disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+			}
+
 			if (n > 0) {
-				_buf_inc_writep(ctx->streambuf, n);
 				ctx->stream.bytes += n;
-				LOG_SDEBUG("[%p] ctx->streambuf read %d bytes", ctx, n);
+				wake_output(ctx);
+				wake_decode_bytes(_buf_used(ctx->streambuf), ctx);
+				if (ctx->stream.meta_interval) {
+					ctx->stream.meta_next -= n;
+				}
+			} else {
+				UNLOCK_S;
+				return;
 			}
-			if (n < 0) {
-				LOG_WARN("[%p] error reading: %s", ctx, strerror(last_error()));
-				_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+
+			if (ctx->stream.state == STREAMING_BUFFERING && ctx->stream.bytes > ctx->stream.threshold) {
+				ctx->stream.state = STREAMING_HTTP;
+				wake_controller(ctx);
 			}
 
+			LOG_DEBUG("[%p] streambuf read %d bytes", ctx, n);
+		}
+	}
+
+	UNLOCK_S;
+}
+
+/*---------------------------------------------------------------------------*/
+/*
+ One round of the stream state machine up to the point where it has to wait.
+ Returns the socket events to wait for, STREAM_IDLE when there is nothing to
+ wait for but a wake or STREAM_AGAIN when a new round can start right away
+*/
+static int _stream_prepare(struct thread_ctx_s *ctx) {
+	size_t space;
+	int events;
+
+	LOCK_S;
+
+	/*
+	It is required to use min with buf_space as it is the full space - 1,
+	otherwise, a write to full would be authorized and the write pointer
+	would wrap to the read pointer, making impossible to know if the buffer
+	is full or empty. This as the consequence, though, that the buffer can
+	never be totally full and can only wrap once the read pointer has moved
+	so it is impossible to count on having a proper multiply of any number
+	of bytes in the buffer
+	*/
+	space = _buf_cont_write(ctx->streambuf);
+
+	// connection in progress is only given up on timeout
+	if (ctx->stream.state == CONNECTING && ctx->fd >= 0) {
+		events = ctx->stream.connect_events;
+		if (gettime_ms() > ctx->stream.connect_end) {
+			LOG_WARN("[%p] timeout connecting to server", ctx);
+			_connect_failed(ctx);
+			events = STREAM_AGAIN;
+		}
+		UNLOCK_S;
+		return events;
+	}
+
+	if (ctx->fd < 0 || !space || ctx->stream.state <= STREAMING_WAIT) {
+		ctx->stream.wait_space = !space;
+		UNLOCK_S;
+		return STREAM_IDLE;
+	}
+
+	if (ctx->stream.state == STREAMING_FILE) {
+		u32_t gen = ctx->stream.fd_gen;
+		int n;
+
+		if (!_fill_begin(ctx)) {
+			UNLOCK_S;
+			return STREAM_AGAIN;
+		}
+
+		space = _buf_cont_write(ctx->streambuf);
+		n = read(ctx->fd, ctx->streambuf->writep, space);
+		if (n > 0) _buf_inc_writep(ctx->streambuf, n);
+
+		if (!_fill_end(gen, ctx)) {
 			UNLOCK_S;
+			return STREAM_AGAIN;
+		}
+
+		if (n == 0) {
+			LOG_INFO("[%p] end of stream", ctx);
+			_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
+		}
+		if (n > 0) {
+			ctx->stream.bytes += n;
+			wake_decode_bytes(_buf_used(ctx->streambuf), ctx);
+			LOG_SDEBUG("[%p] ctx->streambuf read %d bytes", ctx, n);
+		}
+		if (n < 0) {
+			LOG_WARN("[%p] error reading: %s", ctx, strerror(last_error()));
+			_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+		}
+
+		UNLOCK_S;
+		return STREAM_AGAIN;
+	}
+
+	events = POLLIN;
+	if (ctx->stream.state == SEND_HEADERS) {
+		events |= POLLOUT;
+	}
+
+	UNLOCK_S;
+
+	// no need to wait for socket when body bytes are pending
+	if (ctx->stream.body_len && ctx->stream.state > STREAMING_WAIT) {
+		_stream_process(ctx, POLLIN);
+		return STREAM_AGAIN;
+	}
+
+	return events;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *stream_thread(struct thread_ctx_s *ctx) {
+
+	while (ctx->stream_running) {
+
+		struct pollfd pollinfo[2];
+		int events = _stream_prepare(ctx);
+
+		if (events == STREAM_AGAIN) continue;
+
+		if (events == STREAM_IDLE) {
+			// sleep until stream_sock/file, cont, decoder or close tell otherwise
+			pollinfo[0].fd = -1;
+			pollinfo[0].events = 0;
+#if WINEVENT
+			usleep(IDLE_WAIT * 1000);
+#else
+			_wait(ctx, pollinfo, IDLE_WAIT);
+#endif
 			continue;
+		}
+
+		pollinfo[0].fd = ctx->fd;
+		pollinfo[0].events = events;
 
+		if (_wait(ctx, pollinfo, POLL_WAIT)) {
+			_stream_process(ctx, pollinfo[0].revents);
 		} else {
+			LOG_SDEBUG("[%p] poll timeout or wake", ctx);
+		}
+	}
 
-			pollinfo.fd = ctx->fd;
-			pollinfo.events = POLLIN;
-			if (ctx->stream.state == SEND_HEADERS) {
-				pollinfo.events |= POLLOUT;
-			}
+	return 0;
+}
+
+#if STREAM_REACTOR
+/*---------------------------------------------------------------------------*/
+// set socket epoll registration to what a state machine waits for
+static void _reactor_update(int fd, int events, int *reg_fd, int *reg_events, u32_t tag) {
+	struct epoll_event ev;
+
+	// a closed socket has left epoll by itself, only current one can be changed
+	if (fd < 0 || fd != *reg_fd) *reg_fd = -1;
+	if (fd < 0 || (fd == *reg_fd && events == *reg_events)) return;
+
+	// an idle socket must leave epoll or hang-ups would spin
+	if (events <= 0) {
+		if (*reg_fd >= 0) epoll_ctl(reactor_fd, EPOLL_CTL_DEL, fd, NULL);
+		*reg_fd = -1;
+		return;
+	}
+
+	ev.events = ((events & POLLIN) ? EPOLLIN : 0) | ((events & POLLOUT) ? EPOLLOUT : 0);
+	ev.data.u32 = tag;
+
+	if (fd != *reg_fd || epoll_ctl(reactor_fd, EPOLL_CTL_MOD, fd, &ev)) {
+		if (epoll_ctl(reactor_fd, EPOLL_CTL_ADD, fd, &ev) && errno == EEXIST) {
+			epoll_ctl(reactor_fd, EPOLL_CTL_MOD, fd, &ev);
 		}
+	}
 
-		UNLOCK_S;
+	*reg_fd = fd;
+	*reg_events = events;
+}
+
+/*---------------------------------------------------------------------------*/
+// run player's state machine until it has to wait, called with reactor_mutex
+static void _reactor_step(struct thread_ctx_s *ctx, short revents) {
+	int events = STREAM_IDLE, rounds;
+
+	for (rounds = 0; rounds < REACTOR_ROUNDS; rounds++) {
+		events = _stream_prepare(ctx);
+		if (events == STREAM_AGAIN) continue;
+		if (events > 0 && (revents & (events | POLLHUP | POLLERR))) {
+			// readiness is consumed, level-triggered epoll tells if there is more
+			_stream_process(ctx, revents);
+			revents = 0;
+			continue;
+		}
+		break;
+	}
 
-		if (_poll(ctx, &pollinfo, 100)) {
+	ctx->stream.reactor_busy = (rounds == REACTOR_ROUNDS);
+	_reactor_update(ctx->fd, events, &ctx->stream.reactor_fd, &ctx->stream.reactor_events, REACTOR_TAG(ctx, REACTOR_STREAM));
+}
 
-			LOCK_S;
+// slimproto does little per event, one step is enough
+static void _reactor_slim_step(struct thread_ctx_s *ctx, short revents, bool wake) {
+	int events = slimproto_step(ctx, revents, wake);
+	_reactor_update(ctx->slim_run.fd, events, &ctx->slim_run.reactor_fd, &ctx->slim_run.reactor_events, REACTOR_TAG(ctx, REACTOR_SLIM));
+}
 
-			// check socket has not been closed while in poll
-			if (ctx->fd < 0) {
-				UNLOCK_S;
+/*---------------------------------------------------------------------------*/
+static void *reactor_thread_fn(void *arg) {
+	struct epoll_event events[MAX_PLAYER * REACTOR_SLOTS + 1];
+	bool busy = false;
+
+	while (reactor_running) {
+		int i, n = epoll_wait(reactor_fd, events, MAX_PLAYER * REACTOR_SLOTS + 1, busy ? 0 : POLL_WAIT);
+		u32_t now = gettime_ms();
+		// timeouts must be checked even when some sockets are always ready
+		bool sweep = !n || now - reactor_sweep >= POLL_WAIT;
+
+		mutex_lock(reactor_mutex);
+
+		for (i = 0; i < n; i++) {
+			u32_t tag = events[i].data.u32;
+			short revents = events[i].events & (EPOLLIN | EPOLLOUT | EPOLLHUP | EPOLLERR);
+			struct thread_ctx_s *ctx;
+
+			if (tag == REACTOR_EXIT) {
+				wake_clear(wake_fd(reactor_wake));
 				continue;
 			}
 
-			if ((pollinfo.revents & POLLOUT) && ctx->stream.state == SEND_HEADERS) {
-				if (send_header(ctx)) ctx->stream.state = RECV_HEADERS;
-				ctx->stream.header_mlen = ctx->stream.header_len;
-				ctx->stream.header_len = 0;
-				UNLOCK_S;
-				continue;
+			// player might have been closed since epoll_wait
+			ctx = thread_ctx + tag / REACTOR_SLOTS;
+
+			switch (tag % REACTOR_SLOTS) {
+			case REACTOR_STREAM_WAKE:
+				if (ctx->stream.reactor) {
+					wake_clear(wake_fd(ctx->stream.wake_e));
+					_reactor_step(ctx, 0);
+				}
+				break;
+			case REACTOR_STREAM:
+				if (ctx->stream.reactor) _reactor_step(ctx, revents);
+				break;
+			case REACTOR_SLIM_WAKE:
+				if (ctx->slim_run.reactor) {
+					wake_clear(wake_fd(ctx->wake_e));
+					_reactor_slim_step(ctx, 0, true);
+				}
+				break;
+			case REACTOR_SLIM:
+				if (ctx->slim_run.reactor) _reactor_slim_step(ctx, revents, false);
+				break;
 			}
+		}
 
-			if (pollinfo.revents & (POLLIN | POLLHUP)) {
+		// give busy players another go and, every POLL_WAIT, re-check everybody
+		if (sweep) reactor_sweep = now;
 
-				// get response headers
-				if (ctx->stream.state == RECV_HEADERS) {
+		for (busy = false, i = 0; i < MAX_PLAYER; i++) {
+			struct thread_ctx_s *ctx = thread_ctx + i;
+			if (sweep && ctx->slim_run.reactor) _reactor_slim_step(ctx, 0, false);
+			if (!ctx->stream.reactor || (!sweep && !ctx->stream.reactor_busy)) continue;
+			_reactor_step(ctx, 0);
+			busy |= ctx->stream.reactor_busy;
+		}
 
-					// read one byte at a time to catch end of header
-					char c;
+		mutex_unlock(reactor_mutex);
+	}
 
-					int n = _recv(ctx, &c, 1, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							UNLOCK_S;
-							continue;
-						}
-						LOG_WARN("[%p] error reading headers: %s", ctx, n ? strerror(last_error()) : "closed");
-#if USE_SSL
-						if (!ctx->ssl && !ctx->stream.header_len) {
-							int sock;
-
-							// let's restart with SSL this time
-							ctx->stream.header_len = ctx->stream.header_mlen;
-							closesocket(ctx->fd);
-							ctx->fd = -1;
-							LOG_INFO("[%p] now attempting with SSL", ctx);
-
-							// stay locked for slimproto (I know it can be long)
-							sock = connect_socket(true, ctx);
-
-							if (sock >= 0) {
-								ctx->fd = sock;
-								ctx->stream.state = SEND_HEADERS;
-								UNLOCK_S;
-								continue;
-							}
-						}
-#endif
-						_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
-						UNLOCK_S;
-						continue;
-					}
+	return NULL;
+}
 
-					*(ctx->stream.header + ctx->stream.header_len) = c;
-					ctx->stream.header_len++;
+/*---------------------------------------------------------------------------*/
+static bool _reactor_open(struct thread_ctx_s *ctx) {
+	struct epoll_event ev;
 
-					if (ctx->stream.header_len > MAX_HEADER - 1) {
-						LOG_ERROR("[%p] received headers too long: %u", ctx, ctx->stream.header_len);
-						_disconnect(DISCONNECT, LOCAL_DISCONNECT, ctx);
-					}
+	if (!reactor_count) {
+		pthread_attr_t attr;
 
-					if (ctx->stream.header_len > 1 && (c == '\r' || c == '\n')) {
-						ctx->stream.endtok++;
-						if (ctx->stream.endtok == 4) {
-							*(ctx->stream.header + ctx->stream.header_len) = '\0';
-							LOG_INFO("[%p] headers: len: %d\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
-							ctx->stream.state = ctx->stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
-							wake_controller(ctx);
-						}
-					} else {
-						ctx->stream.endtok = 0;
-					}
+		if ((reactor_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+			LOG_ERROR("[%p] unable to create epoll: %s", ctx, strerror(errno));
+			return false;
+		}
 
-					UNLOCK_S;
-					continue;
-				}
+		mutex_create(reactor_mutex);
+		wake_create(reactor_wake);
+		ev.events = EPOLLIN;
+		ev.data.u32 = REACTOR_EXIT;
+		epoll_ctl(reactor_fd, EPOLL_CTL_ADD, wake_fd(reactor_wake), &ev);
 
-				// receive icy meta data
-
-				if (ctx->stream.meta_interval && ctx->stream.meta_next == 0) {
-					if (ctx->stream.meta_left == 0) {
-						// read meta length
-						u8_t c;
-						int n = _recv(ctx, &c, 1, 0);
-						if (n <= 0) {
-							if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-								UNLOCK_S;
-								continue;
-							}
-							LOG_WARN("[%p] error reading icy meta: %s", ctx, n ? strerror(last_error()) : "closed");
-							_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
-							UNLOCK_S;
-							continue;
-						}
-						ctx->stream.meta_left = 16 * c;
-						ctx->stream.header_len = 0; // amount of received meta data
-						// MAX_HEADER must be more than meta max of 16 * 255
-					}
+		reactor_running = true;
+		reactor_sweep = gettime_ms();
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + STREAM_THREAD_STACK_SIZE);
+		pthread_create(&reactor_thread, &attr, reactor_thread_fn, NULL);
+		pthread_attr_destroy(&attr);
 
-					if (ctx->stream.meta_left) {
-						int n = _recv(ctx, ctx->stream.header + ctx->stream.header_len, ctx->stream.meta_left, 0);
-						if (n <= 0) {
-							if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-								UNLOCK_S;
-								continue;
-							}
-							LOG_WARN("[%p] error reading icy meta: %s", ctx, n ? strerror(last_error()) : "closed");
-							_disconnect(STOPPED, LOCAL_DISCONNECT, ctx);
-							UNLOCK_S;
-							continue;
-						}
-						ctx->stream.meta_left -= n;
-						ctx->stream.header_len += n;
-					}
+		LOG_INFO("[%p] stream reactor started", ctx);
+	}
 
-					if (ctx->stream.meta_left == 0) {
-						if (ctx->stream.header_len) {
-							*(ctx->stream.header + ctx->stream.header_len) = '\0';
-							LOG_INFO("[%p] icy meta: len: %u\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
-							ctx->stream.meta_send = true;
-							wake_controller(ctx);
-						}
-						ctx->stream.meta_next = ctx->stream.meta_interval;
-						UNLOCK_S;
-						continue;
-					}
+	reactor_count++;
 
-				// stream body into streambuf
-				} else {
-					int n;
+	mutex_lock(reactor_mutex);
+	ctx->stream.reactor = true;
+	ctx->stream.reactor_busy = false;
+	ctx->stream.reactor_fd = -1;
+	ctx->stream.reactor_events = 0;
+	ev.events = EPOLLIN;
+	ev.data.u32 = REACTOR_TAG(ctx, REACTOR_STREAM_WAKE);
+	epoll_ctl(reactor_fd, EPOLL_CTL_ADD, wake_fd(ctx->stream.wake_e), &ev);
+	mutex_unlock(reactor_mutex);
 
-					space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
+	return true;
+}
 
-					if (ctx->stream.meta_interval) {
-						space = min(space, ctx->stream.meta_next);
-					}
+/*---------------------------------------------------------------------------*/
+static void _reactor_close(struct thread_ctx_s *ctx) {
+	mutex_lock(reactor_mutex);
+	ctx->stream.reactor = false;
+	epoll_ctl(reactor_fd, EPOLL_CTL_DEL, wake_fd(ctx->stream.wake_e), NULL);
+	if (ctx->stream.reactor_fd >= 0 && ctx->stream.reactor_fd == ctx->fd) {
+		epoll_ctl(reactor_fd, EPOLL_CTL_DEL, ctx->fd, NULL);
+	}
+	mutex_unlock(reactor_mutex);
 
-					n = _recv(ctx, ctx->streambuf->writep, space, 0);
-					if (n == 0) {
-						LOG_INFO("[%p] end of stream (t:%lld)", ctx, ctx->stream.bytes);
-						_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
-					}
-					if (n < 0 && last_error() != ERROR_WOULDBLOCK) {
-						LOG_WARN("[%p] error reading: %s", ctx, strerror(last_error()));
-						_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
-					}
+	if (--reactor_count) return;
 
-					if (n > 0) {
-						_buf_inc_writep(ctx->streambuf, n);
-						ctx->stream.bytes += n;
-						wake_output(ctx);
-						if (ctx->stream.meta_interval) {
-							ctx->stream.meta_next -= n;
-						}
-					} else {
-						UNLOCK_S;
-						continue;
-					}
+	reactor_running = false;
+	wake_signal(reactor_wake);
+	pthread_join(reactor_thread, NULL);
+	wake_close(reactor_wake);
+	mutex_destroy(reactor_mutex);
+	close(reactor_fd);
+	reactor_fd = -1;
 
-					if (ctx->stream.state == STREAMING_BUFFERING && ctx->stream.bytes > ctx->stream.threshold) {
-						ctx->stream.state = STREAMING_HTTP;
-						wake_controller(ctx);
-					}
+	LOG_INFO("[%p] stream reactor stopped", ctx);
+}
 
-					LOG_DEBUG("[%p] streambuf read %d bytes", ctx, n);
-				}
-			}
+/*---------------------------------------------------------------------------*/
+// slimproto state machine is served along with stream, between stream_thread_init and stream_close
+void reactor_add_slimproto(struct thread_ctx_s *ctx) {
+	struct epoll_event ev;
+
+	mutex_lock(reactor_mutex);
+	ctx->slim_run.reactor = true;
+	ctx->slim_run.reactor_fd = -1;
+	ctx->slim_run.reactor_events = 0;
+	ev.events = EPOLLIN;
+	ev.data.u32 = REACTOR_TAG(ctx, REACTOR_SLIM_WAKE);
+	epoll_ctl(reactor_fd, EPOLL_CTL_ADD, wake_fd(ctx->wake_e), &ev);
+	mutex_unlock(reactor_mutex);
+}
 
-			UNLOCK_S;
+// once returned, slimproto is not stepped anymore
+void reactor_del_slimproto(struct thread_ctx_s *ctx) {
+	mutex_lock(reactor_mutex);
+	ctx->slim_run.reactor = false;
+	epoll_ctl(reactor_fd, EPOLL_CTL_DEL, wake_fd(ctx->wake_e), NULL);
+	if (ctx->slim_run.reactor_fd >= 0 && ctx->slim_run.reactor_fd == ctx->slim_run.fd) {
+		epoll_ctl(reactor_fd, EPOLL_CTL_DEL, ctx->slim_run.fd, NULL);
+	}
+	mutex_unlock(reactor_mutex);
+}
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+void wake_stream(struct thread_ctx_s *ctx) {
+	wake_signal(ctx->stream.wake_e);
+}
+
+/*---------------------------------------------------------------------------*/
+void wake_stream_space(struct thread_ctx_s *ctx) {
+	LOCK_S;
+	if (ctx->stream.wait_space && _buf_space(ctx->streambuf) >= min(RESUME_SPACE, ctx->streambuf->size / 2)) {
+		ctx->stream.wait_space = false;
+		wake_stream(ctx);
+	}
+	UNLOCK_S;
+}
+
+/*---------------------------------------------------------------------------*/
+/*---------------------------------------------------------------------------*/
+/*
+ Next track prefetch. Once current stream is fully received, LMS is asked for
+ the next playlist entry and when it's a remote http track, that LMS lets the
+ player fetch directly, it is read in a spare buffer. If strm s comes with the
+ same request, buffers are swapped and the connection handed over to stream
+ thread, otherwise the prefetch is dropped. TLS sources are not prefetched.
+ Thread polls abort every PREFETCH_POLL so that it's never long to join once
+ ready and a thread still connecting is left to end by itself
+*/
+#define PREFETCH_POLL		100
+#define PREFETCH_CONNECT	(5*1000)
+#define PREFETCH_KEEP		(15*60*1000)
 
+static bool _prefetch_aborted(struct prefetchstate *pf) {
+	bool abort;
+
+	mutex_lock(pf->mutex);
+	abort = pf->abort;
+	mutex_unlock(pf->mutex);
+
+	return abort;
+}
+
+static bool _prefetch_open(struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+	char host[256+6+1] = "", *path = NULL;
+	sq_metadata_t metadata;
+	unsigned port = 80;
+	in_addr_t ip = 0;
+	u32_t wait;
+	size_t len;
+
+	// tracks without duration are live ones
+	sq_get_metadata(ctx->self, &metadata, true);
+	if (metadata.remote && metadata.duration && metadata.url && !strncasecmp(metadata.url, "http://", 7)) {
+		sscanf(metadata.url + 7, "%262[^/]", host);
+		path = strchr(metadata.url + 7, '/');
+	}
+
+	if (!*host || !path || strlen(path) > MAX_HEADER / 2) {
+		LOG_INFO("[%p] next track can't be prefetched: %s", ctx, metadata.url ? metadata.url : "");
+		sq_free_metadata(&metadata);
+		return false;
+	}
+
+	len = sprintf(pf->request, "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
+	sq_free_metadata(&metadata);
+
+	server_addr(host, &ip, &port);
+	memset(&pf->addr, 0, sizeof(pf->addr));
+	pf->addr.sin_family = AF_INET;
+	pf->addr.sin_addr.s_addr = ip;
+	pf->addr.sin_port = htons(port);
+
+	if (!ip || (pf->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		LOG_WARN("[%p] unable to resolve %s", ctx, host);
+		return false;
+	}
+
+	set_nonblock(pf->fd);
+	set_nosigpipe(pf->fd);
+
+	LOG_INFO("[%p] prefetching from %s:%u\n%s", ctx, host, port, pf->request);
+
+	// connection is polled so that it can be aborted
+	if (connect_async(pf->fd, (struct sockaddr *) &pf->addr, sizeof(pf->addr)) == 0) {
+		for (wait = 0; wait < PREFETCH_CONNECT && !_prefetch_aborted(pf); wait += PREFETCH_POLL) {
+			struct pollfd pollinfo = { pf->fd, POLLOUT, 0 };
+			int error = 0;
+			socklen_t optlen = sizeof(error);
+
+			if (poll(&pollinfo, 1, PREFETCH_POLL) <= 0) continue;
+
+			getsockopt(pf->fd, SOL_SOCKET, SO_ERROR, (void *) &error, &optlen);
+			if (!error && send(pf->fd, pf->request, len, MSG_NOSIGNAL) == (ssize_t) len) return true;
+			break;
+		}
+	}
+
+	LOG_WARN("[%p] unable to prefetch from %s", ctx, host);
+	closesocket(pf->fd);
+	pf->fd = -1;
+
+	return false;
+}
+
+// get headers, returns false when there is nothing to prefetch
+static bool _prefetch_headers(struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+	int endtok = 0;
+	u32_t wait;
+
+	for (wait = 0; wait < PREFETCH_KEEP && !_prefetch_aborted(pf); wait += PREFETCH_POLL) {
+		struct pollfd pollinfo = { pf->fd, POLLIN, 0 };
+		char *p = pf->response + pf->response_len;
+		int i, n, status = 0;
+		bool ready;
+
+		if (poll(&pollinfo, 1, PREFETCH_POLL) <= 0) continue;
+
+		n = recv(pf->fd, p, MAX_HEADER - 1 - pf->response_len, 0);
+		if (n < 0 && last_error() == ERROR_WOULDBLOCK) continue;
+		if (n <= 0) return false;
+
+		for (i = 0; i < n && endtok < 4; i++) {
+			pf->response_len++;
+			if (pf->response_len > 1 && (p[i] == '\r' || p[i] == '\n')) endtok++;
+			else endtok = 0;
+		}
+
+		if (endtok < 4) {
+			if (pf->response_len >= MAX_HEADER - 1) return false;
+			continue;
+		}
+
+		// spare buffer only exists while a prefetch is ready
+		buf_init(&pf->buf, pf->size);
+		if (!pf->buf.buf) {
+			LOG_ERROR("[%p] unable to malloc prefetch buffer", ctx);
+			return false;
+		}
+
+		// body that came along is saved before headers are terminated
+		LOCK_P;
+		pf->bytes = _buf_write(&pf->buf, p + i, n - i);
+		UNLOCK_P;
+		pf->response[pf->response_len] = '\0';
+
+		// only a plain body can be taken as is
+		sscanf(pf->response, "HTTP/%*s %d", &status);
+		if (status != 200 || strcasestr(pf->response, "icy-metaint:") || strcasestr(pf->response, "Transfer-Encoding:")) return false;
+
+		LOG_INFO("[%p] prefetch headers: len: %d\n%s", ctx, pf->response_len, pf->response);
+
+		mutex_lock(pf->mutex);
+		ready = !pf->abort;
+		if (ready) pf->state = PREFETCH_READY;
+		mutex_unlock(pf->mutex);
+
+		return ready;
+	}
+
+	return false;
+}
+
+// close connection and free buffer, thread must be gone or be the caller
+static void _prefetch_release(struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+
+	if (pf->fd >= 0) closesocket(pf->fd);
+	pf->fd = -1;
+	buf_destroy(&pf->buf);
+
+	mutex_lock(pf->mutex);
+	pf->state = PREFETCH_IDLE;
+	mutex_unlock(pf->mutex);
+}
+
+static void *prefetch_thread(struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+	u32_t wait;
+
+	pf->response_len = 0;
+	pf->bytes = 0;
+
+	if (!_prefetch_open(ctx) || !_prefetch_headers(ctx)) {
+		LOG_WARN("[%p] prefetch failed", ctx);
+		_prefetch_release(ctx);
+		return NULL;
+	}
+
+	// fill buffer then keep connection for stream thread, but not forever
+	for (wait = 0; wait < PREFETCH_KEEP && !_prefetch_aborted(pf); wait += PREFETCH_POLL) {
+		struct pollfd pollinfo = { pf->fd, POLLIN, 0 };
+		int n;
+
+		if (!buf_space(&pf->buf) || poll(&pollinfo, 1, PREFETCH_POLL) <= 0) {
+			if (!buf_space(&pf->buf)) usleep(PREFETCH_POLL * 1000);
+			continue;
+		}
+
+		LOCK_P;
+		n = recv(pf->fd, pf->buf.writep, _buf_cont_write(&pf->buf), 0);
+		if (n > 0) {
+			_buf_inc_writep(&pf->buf, n);
+			pf->bytes += n;
 		}
-		else {
-			LOG_SDEBUG("[%p] poll timeout", ctx);
+		UNLOCK_P;
+
+		// end of stream or error is for stream thread to find
+		if (n == 0 || (n < 0 && last_error() != ERROR_WOULDBLOCK)) {
+			LOG_INFO("[%p] prefetched %lld bytes (%s)", ctx, pf->bytes, n ? "error" : "complete");
+			for (; wait < PREFETCH_KEEP && !_prefetch_aborted(pf); wait += PREFETCH_POLL) usleep(PREFETCH_POLL * 1000);
+			break;
 		}
 	}
 
-#if USE_SSL
-	if (!--SSLcount) {
-		SSL_CTX_free(SSLctx);
-		SSLctx = NULL;
+	// unless someone waits to take it, prefetch is dropped
+	if (!_prefetch_aborted(pf)) {
+		LOG_INFO("[%p] prefetch not used in time", ctx);
+		_prefetch_release(ctx);
 	}
-#endif
 
-	return 0;
+	return NULL;
 }
 
+// tell thread to stop, returns true if there is a ready prefetch to join
+static bool _prefetch_abort(struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+	bool ready;
+
+	if (!pf->joinable) return false;
+
+	mutex_lock(pf->mutex);
+	pf->abort = true;
+	ready = pf->state == PREFETCH_READY;
+	mutex_unlock(pf->mutex);
+
+	return ready;
+}
+
+// wait for a thread that has been told to stop
+static void _prefetch_join(struct thread_ctx_s *ctx) {
+	if (!ctx->prefetch.joinable) return;
+	pthread_join(ctx->prefetch.thread, NULL);
+	ctx->prefetch.joinable = false;
+}
+
+// check if prefetch is what LMS now requests (same server and request line)
+static bool _prefetch_match(u32_t ip, u16_t port, const char *header, size_t header_len, struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+	size_t len;
+
+	// a thread not ready yet ends by itself, it's not waited for
+	if (!_prefetch_abort(ctx)) return false;
+
+	// ready one might have given up just before
+	_prefetch_join(ctx);
+	if (pf->state != PREFETCH_READY) return false;
+
+	len = strstr(pf->request, " HTTP/") - pf->request + 1;
+	if (pf->addr.sin_addr.s_addr == ip && pf->addr.sin_port == port && header_len > len && !strncmp(header, pf->request, len)) return true;
+
+	LOG_INFO("[%p] prefetched track not requested", ctx);
+	_prefetch_release(ctx);
+	return false;
+}
+
+// hand prefetch over to stream thread, called with LOCK_S once stream_sock has set up
+static void _prefetch_use(struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+
+	LOCK_P;
+	_buf_swap(ctx->streambuf, &pf->buf);
+	UNLOCK_P;
+
+	memcpy(ctx->stream.header, pf->response, pf->response_len + 1);
+	ctx->stream.header_len = pf->response_len;
+	ctx->stream.bytes = pf->bytes;
+	_resume_parse(ctx);
+
+	if (ctx->stream.cont_wait) ctx->stream.state = STREAMING_WAIT;
+	else ctx->stream.state = ctx->stream.bytes > ctx->stream.threshold ? STREAMING_HTTP : STREAMING_BUFFERING;
+
+	LOG_INFO("[%p] using prefetched stream (%lld bytes)", ctx, pf->bytes);
+
+	// connection now belongs to stream thread and spare buffer has previous storage
+	pf->fd = -1;
+	_prefetch_release(ctx);
+	wake_controller(ctx);
+}
 
 /*---------------------------------------------------------------------------*/
-bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
+// called by controller once current stream has been fully received
+void stream_prefetch(struct thread_ctx_s *ctx) {
+	struct prefetchstate *pf = &ctx->prefetch;
+	pthread_attr_t attr;
+
+	if (!ctx->config.prefetch) return;
+
+	// previous one has been left to end by itself or is unused
+	stream_prefetch_drop(ctx);
+	_prefetch_join(ctx);
+
+	if (!pf->request) {
+		pf->request = malloc(MAX_HEADER * 2);
+		pf->response = pf->request + MAX_HEADER;
+	}
+
+	pf->abort = false;
+	pf->state = PREFETCH_RUNNING;
+	pf->size = ctx->streambuf->base_size;
+	pf->joinable = true;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + STREAM_THREAD_STACK_SIZE);
+	pthread_create(&pf->thread, &attr, (void *(*)(void*)) prefetch_thread, ctx);
+	pthread_attr_destroy(&attr);
+}
 
+// LMS won't ask for the prefetched track (stop, flush), release it now
+void stream_prefetch_drop(struct thread_ctx_s *ctx) {
+	if (!_prefetch_abort(ctx)) return;
+	_prefetch_join(ctx);
+	_prefetch_release(ctx);
+}
+
+/*---------------------------------------------------------------------------*/
+bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
+#if !STREAM_REACTOR
 	pthread_attr_t attr;
+#endif
 
 	LOG_DEBUG("[%p] streambuf size: %u", ctx, streambuf_size);
 
@@ -475,6 +1538,7 @@ bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
 	if (!SSLctx) {
 		SSLctx = SSL_CTX_new(SSLv23_client_method());
 		if (SSLctx) SSL_CTX_set_options(SSLctx, SSL_OP_NO_SSLv2);
+		mutex_create(SSLmutex);
 	}
 	SSLcount++;
 	ctx->ssl = NULL;
@@ -482,7 +1546,21 @@ bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
 
 	ctx->stream_running = true;
 	ctx->stream.state = STOPPED;
-	ctx->stream.header = malloc(MAX_HEADER);
+	ctx->stream.wait_space = false;
+	wake_create(ctx->stream.wake_e);
+	// second half stashes body received along with headers
+	ctx->stream.header = malloc(MAX_HEADER * 2);
+	ctx->stream.request = malloc(MAX_HEADER);
+	ctx->stream.body_len = 0;
+	ctx->stream.resume_state = STOPPED;
+	ctx->stream.resumes = ctx->stream.resume_fails = 0;
+	ctx->stream.fd_gen = 0;
+	ctx->prefetch.state = PREFETCH_IDLE;
+	ctx->prefetch.joinable = false;
+	ctx->prefetch.buf.buf = NULL;
+	ctx->prefetch.request = NULL;
+	ctx->prefetch.fd = -1;
+	mutex_create(ctx->prefetch.mutex);
 	*ctx->stream.header = '\0';
 
 	ctx->fd = -1;
@@ -491,10 +1569,18 @@ bool stream_thread_init(unsigned streambuf_size, struct thread_ctx_s *ctx) {
 	touch_memory(ctx->streambuf->buf, ctx->streambuf->size);
 #endif
 
+#if STREAM_REACTOR
+	if (!_reactor_open(ctx)) {
+		ctx->stream_running = false;
+		wake_close(ctx->stream.wake_e);
+		return false;
+	}
+#else
 	pthread_attr_init(&attr);
 	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + STREAM_THREAD_STACK_SIZE);
 	pthread_create(&ctx->stream_thread, &attr, (void *(*)(void*)) stream_thread, ctx);
 	pthread_attr_destroy(&attr);
+#endif
 
 	return true;
 }
@@ -504,8 +1590,32 @@ void stream_close(struct thread_ctx_s *ctx) {
 	LOCK_S;
 	ctx->stream_running = false;
 	UNLOCK_S;
+#if STREAM_REACTOR
+	_reactor_close(ctx);
+#else
+	wake_stream(ctx);
 	pthread_join(ctx->stream_thread, NULL);
+#endif
+	wake_close(ctx->stream.wake_e);
+#if USE_SSL
+	if (!--SSLcount) {
+		int i;
+		for (i = 0; i < SSL_CACHE_SIZE; i++) {
+			if (SSLcache[i].session) SSL_SESSION_free(SSLcache[i].session);
+		}
+		memset(SSLcache, 0, sizeof(SSLcache));
+		mutex_destroy(SSLmutex);
+		SSL_CTX_free(SSLctx);
+		SSLctx = NULL;
+	}
+#endif
+	_prefetch_abort(ctx);
+	_prefetch_join(ctx);
+	_prefetch_release(ctx);
+	mutex_destroy(ctx->prefetch.mutex);
+	free(ctx->prefetch.request);
 	free(ctx->stream.header);
+	free(ctx->stream.request);
 	buf_destroy(ctx->streambuf);
 }
 
@@ -513,6 +1623,8 @@ void stream_file(const char *header, size_t header_len, unsigned threshold, stru
 	buf_flush(ctx->streambuf);
 
 	LOCK_S;
+	_buf_hold(ctx->streambuf, BUF_WRITER);
+	ctx->stream.fd_gen++;
 
 	ctx->stream.header_len = header_len;
 	memcpy(ctx->stream.header, header, header_len);
@@ -541,11 +1653,22 @@ void stream_file(const char *header, size_t header_len, unsigned threshold, stru
 	ctx->stream.sent_headers = false;
 	ctx->stream.bytes = 0;
 	ctx->stream.threshold = threshold;
+	ctx->stream.body_len = 0;
+
+	// whole file is available at once, nothing left for stream_thread
+	if (ctx->fd >= 0 && _buf_map(ctx->streambuf, ctx->fd)) {
+		ctx->stream.bytes = _buf_used(ctx->streambuf);
+		LOG_INFO("[%p] mapped local file (%lld bytes)", ctx, ctx->stream.bytes);
+		_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
+	}
 
+	_buf_release(ctx->streambuf);
 	UNLOCK_S;
+	wake_stream(ctx);
 }
 
 void stream_sock(u32_t ip, u16_t port, bool use_ssl, const char *header, size_t header_len, unsigned threshold, bool cont_wait, struct thread_ctx_s *ctx) {
+	bool prefetched;
 	int sock;
 	char *p;
 
@@ -560,8 +1683,24 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, const char *header, size_t
 		if ((p = strchr(ctx->stream.host, ':')) != NULL) *p = '\0';
 	}
 
+	// next track might have been fetched already
+	prefetched = _prefetch_match(ip, port, header, header_len, ctx);
+
 	port = ntohs(port);
-	sock = connect_socket(use_ssl || port == 443, ctx);
+#if USE_SSL
+	// server already known to need TLS, don't try plain first
+	if (!prefetched && !use_ssl && port != 443 && _ssl_cache_needed(ctx)) use_ssl = true;
+	if (prefetched) {
+		ctx->ssl = NULL;
+		ctx->ktls = false;
+		ctx->stream.use_ssl = false;
+	}
+#endif
+#if STREAM_REACTOR
+	// reactor can't wait for server, connection is started once all is set
+	sock = prefetched ? ctx->prefetch.fd : -1;
+#else
+	sock = prefetched ? ctx->prefetch.fd : connect_socket(use_ssl || port == 443, ctx);
 
 	// try one more time with plain socket
 	if (sock < 0 && port == 443 && !use_ssl) sock = connect_socket(false, ctx);
@@ -573,10 +1712,13 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, const char *header, size_t
 		UNLOCK_S;
 		return;
 	}
+#endif
 
 	buf_flush(ctx->streambuf);
 
 	LOCK_S;
+	_buf_hold(ctx->streambuf, BUF_WRITER);
+	ctx->stream.fd_gen++;
 
 	ctx->fd = sock;
 	ctx->stream.state = SEND_HEADERS;
@@ -591,11 +1733,31 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, const char *header, size_t
 
 	LOG_INFO("[%p] header: %s", ctx, ctx->stream.header);
 
+	memcpy(ctx->stream.request, header, header_len);
+	ctx->stream.request_len = header_len;
+	ctx->stream.length = 0;
+	ctx->stream.resume_state = STOPPED;
+	ctx->stream.resume_left = ctx->config.resume_retries;
+
 	ctx->stream.sent_headers = false;
 	ctx->stream.bytes = 0;
 	ctx->stream.threshold = threshold;
+	ctx->stream.body_len = 0;
+
+	if (prefetched) _prefetch_use(ctx);
+#if STREAM_REACTOR
+	else if (_connect_start(use_ssl || port == 443, ctx)) {
+		ctx->stream.sock_connect = true;
+		ctx->stream.sock_plain = port == 443 && !use_ssl;
+	} else {
+		ctx->stream.state = DISCONNECT;
+		ctx->stream.disconnect = UNREACHABLE;
+	}
+#endif
 
+	_buf_release(ctx->streambuf);
 	UNLOCK_S;
+	wake_stream(ctx);
 }
 
 
@@ -228,11 +228,8 @@ void set_nonblock(sockfd s) {
 #endif
 }
 
-// connect for socket already set to non blocking with timeout in ms
-int connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen, int timeout) {
-	fd_set w, e;
-	struct timeval tval;
-
+// start connect for socket already set to non blocking, completion is signalled by writability
+int connect_async(sockfd sock, const struct sockaddr *addr, socklen_t addrlen) {
 	if (connect(sock, addr, addrlen) < 0) {
 #if !WIN
 		if (last_error() != EINPROGRESS) {
@@ -243,6 +240,16 @@ int connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen,
 		}
 	}
 
+	return 0;
+}
+
+// connect for socket already set to non blocking with timeout in ms
+int connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen, int timeout) {
+	fd_set w, e;
+	struct timeval tval;
+
+	if (connect_async(sock, addr, addrlen) < 0) return -1;
+
 	FD_ZERO(&w);
 	FD_SET(sock, &w);
 	e = w;
@@ -39,6 +39,7 @@ static struct {
 	int (* ov_clear)(OggVorbis_File *vf);
 	long (* ov_read)(OggVorbis_File *vf, char *buffer, int length, int bigendianp, int word, int sgned, int *bitstream);
 	long (* ov_read_tremor)(OggVorbis_File *vf, char *buffer, int length, int *bitstream);
+	long (* ov_read_float)(OggVorbis_File *vf, float ***pcm_channels, int samples, int *bitstream);
 	int (* ov_open_callbacks)(void *datasource, OggVorbis_File *vf, const char *initial, long ibytes, ov_callbacks callbacks);
 } gv;
 #endif
@@ -52,22 +53,35 @@ struct vorbis {
 extern log_level decode_loglevel;
 static log_level *loglevel = &decode_loglevel;
 
-#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
-#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+#if LOCKFREE_BUF
+// decoder is streambuf's reader and outputbuf's writer, mutex is for output state
+#define LOCK_S   buf_begin(ctx->streambuf, BUF_READER)
+#define UNLOCK_S buf_end(ctx->streambuf, BUF_READER)
+#define LOCK_O_direct   IF_DIRECT(buf_begin(ctx->outputbuf, BUF_WRITER);)
+#define UNLOCK_O_direct buf_end(ctx->outputbuf, BUF_WRITER)
+#define LOCK_O_not_direct   LOCK_O
+#define UNLOCK_O_not_direct UNLOCK_O
+#else
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #if PROCESS
 #define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct   if (!ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_not_direct if (!ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
 #else
 #define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_O_not_direct
 #define UNLOCK_O_not_direct
+#endif
+#endif
+#if PROCESS
+#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
+#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
+#else
 #define IF_DIRECT(x)    { x }
 #define IF_PROCESS(x)
 #endif
@@ -76,12 +90,14 @@ static log_level *loglevel = &decode_loglevel;
 #if LINKALL
 #define OV(h, fn, ...) (ov_ ## fn)(__VA_ARGS__)
 #define TREMOR(h)      0
+#define FLOAT(h)       1
 #if !WIN
 extern int ov_read_tremor(); // needed to enable compilation, not linked
 #endif
 #else
 #define OV(h, fn, ...) (h)->ov_##fn(__VA_ARGS__)
 #define TREMOR(h)      (h)->ov_read_tremor
+#define FLOAT(h)       (h)->ov_read_float
 #endif
 
 // called with mutex locked within vorbis_decode to avoid locking O before S
@@ -89,7 +105,7 @@ static size_t _read_cb(void *ptr, size_t size, size_t nmemb, void *datasource) {
 	size_t bytes;
 	struct thread_ctx_s *ctx = datasource;
 
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	bytes = _buf_cont_read(ctx->streambuf);
 	bytes = min(bytes, size * nmemb);
 
 	memcpy(ptr, ctx->streambuf->readp, bytes);
@@ -108,18 +124,20 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 	frames_t frames;
 	int bytes, s, n;
 	u8_t *write_buf;
+	stream_state state;
 
 	LOCK_S;
 	LOCK_O_direct;
+	state = STREAM_STATE(ctx);
 
 	IF_DIRECT(
-		frames = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
+		frames = _buf_cont_write(ctx->outputbuf) / BYTES_PER_FRAME;
 	);
 	IF_PROCESS(
 		frames = ctx->process.max_in_frames;
 	);
 
-	if (!frames && ctx->stream.state <= DISCONNECT) {
+	if (!frames && state <= DISCONNECT) {
 		UNLOCK_O_direct;
 		UNLOCK_S;
 		return DECODE_COMPLETE;
@@ -151,8 +169,8 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 
 		LOG_INFO("[%p]: setting track_start", ctx);
 		LOCK_O_not_direct;
-		// don't use next_sample_rate
-		ctx->output.current_sample_rate = decode_newstream(info->rate, ctx->output.supported_rates, ctx);
+		ctx->output.next_sample_rate = decode_newstream(info->rate, ctx->output.supported_rates, ctx);
+		ctx->output.next_float = FLOAT(&gv) && (ctx->decode.light & LIGHT_FLOAT);
 		ctx->output.track_start = ctx->outputbuf->writep;
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
@@ -181,8 +199,14 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		write_buf = ctx->process.inbuf;
 	);
 
-	// write the 16 bits decoded frames into outputbuf even when they are mono
-	if (!TREMOR(&gv)) {
+	if (FLOAT(&gv)) {
+		float **pcm;
+		// float samples are clipped and interleaved straight into outputbuf
+		n = OV(&gv, read_float, v->vf, &pcm, frames, &s);
+		if (n > 0 && ctx->output.next_float) _store_float_planar((float *) write_buf, pcm[0], pcm[v->channels - 1], n);
+		else if (n > 0) _interleave_float_planar((ISAMPLE_T *) write_buf, pcm[0], pcm[v->channels - 1], n);
+	} else if (!TREMOR(&gv)) {
+		// write the 16 bits decoded frames into outputbuf even when they are mono
 #if SL_LITTLE_ENDIAN
 		n = OV(&gv, read, v->vf, (char *)write_buf, bytes, 0, 2, 1, &s);
 #else
@@ -196,24 +220,29 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 
 	if (n > 0) {
 
-		frames_t count;
-		s16_t *iptr, *optr;
-
-		frames = n / 2 / v->channels;
-		count = frames * v->channels;
-
-		// work backward although no unpack is needed
-		iptr = (s16_t *)write_buf + count;
-		optr = (s16_t *)write_buf + frames * 2;
-
-		if (v->channels == 2) {
-			while (count--) {
-				*--optr = *--iptr;
-			}
-		} else if (v->channels == 1) {
-			while (count--) {
-				*--optr = *--iptr;
-				*--optr = *iptr;
+		if (FLOAT(&gv)) {
+			frames = n;
+		} else {
+			frames_t count;
+			s16_t *iptr;
+			ISAMPLE_T *optr;
+
+			frames = n / 2 / v->channels;
+			count = frames * v->channels;
+
+			// work backward to expand 16 bits samples in place
+			iptr = (s16_t *)write_buf + count;
+			optr = (ISAMPLE_T *)write_buf + frames * 2;
+
+			if (v->channels == 2) {
+				while (count--) {
+					*--optr = ALIGN16(*--iptr);
+				}
+			} else if (v->channels == 1) {
+				while (count--) {
+					*--optr = ALIGN16(*--iptr);
+					*--optr = ALIGN16(*iptr);
+				}
 			}
 		}
 
@@ -228,7 +257,7 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 
 	} else if (n == 0) {
 
-		if (ctx->stream.state <= DISCONNECT) {
+		if (state <= DISCONNECT) {
 			LOG_INFO("[%p]: partial decode", ctx);
 			UNLOCK_O_direct;
 			UNLOCK_S;
@@ -315,6 +344,10 @@ static bool load_vorbis(void) {
 		return false;
 	}
 
+	// optional, tremor is fixed point only
+	gv.ov_read_float = tremor ? NULL : dlsym(gv.handle, "ov_read_float");
+	dlerror();
+
 	LOG_INFO("loaded %s", tremor ? LIBTREMOR : LIBVORBIS);
 #endif
 
@@ -330,12 +363,9 @@ struct codec *register_vorbis(void) {
 		vorbis_open,  // open
 		vorbis_close, // close
 		vorbis_decode,// decode
+		load_vorbis,  // load
 	};
 
-	if (!load_vorbis()) {
-		return NULL;
-	}
-
 	LOG_INFO("using vorbis to decode ogg", NULL);
 	return &ret;
 }
@@ -0,0 +1,87 @@
+/*
+ *  cpu features detection and kernels dispatch
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include "cpu_util.h"
+
+#if CPU_NEON && defined(__linux__)
+#include <sys/auxv.h>
+#if defined(__aarch64__) && !defined(HWCAP_ASIMD)
+#define HWCAP_ASIMD	(1 << 1)
+#elif !defined(__aarch64__) && !defined(HWCAP_NEON)
+#define HWCAP_NEON	(1 << 12)
+#endif
+#endif
+
+#define MAX_KERNELS	16
+
+static struct {
+	char *kernel, *variant;
+} kernels[MAX_KERNELS];
+
+static u32_t features;
+static bool  detected;
+
+/*----------------------------------------------------------------------------*/
+u32_t cpu_features(void) {
+	if (detected) return features;
+
+#if CPU_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) features |= CPU_HAS_SSE2;
+	if (__builtin_cpu_supports("avx2")) features |= CPU_HAS_AVX2;
+	if (__builtin_cpu_supports("fma")) features |= CPU_HAS_FMA;
+#elif CPU_NEON && defined(__linux__)
+#if defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_ASIMD) features |= CPU_HAS_NEON;
+#else
+	if (getauxval(AT_HWCAP) & HWCAP_NEON) features |= CPU_HAS_NEON;
+#endif
+#elif CPU_NEON && (defined(__aarch64__) || defined(__ARM_NEON))
+	// no hwcap to probe, only trust what the build targets
+	features |= CPU_HAS_NEON;
+#endif
+
+	detected = true;
+	return features;
+}
+
+/*----------------------------------------------------------------------------*/
+void cpu_set_kernel(char *kernel, char *variant) {
+	int i;
+
+	for (i = 0; i < MAX_KERNELS && kernels[i].kernel && strcmp(kernels[i].kernel, kernel); i++);
+
+	if (i == MAX_KERNELS) return;
+
+	kernels[i].kernel = kernel;
+	kernels[i].variant = variant;
+}
+
+/*----------------------------------------------------------------------------*/
+void cpu_print_kernels(FILE *out) {
+	u32_t f = cpu_features();
+	int i;
+
+	fprintf(out, "CPU features:%s%s%s%s%s\n", f & CPU_HAS_SSE2 ? " SSE2" : "", f & CPU_HAS_AVX2 ? " AVX2" : "",
+			f & CPU_HAS_FMA ? " FMA" : "", f & CPU_HAS_NEON ? " NEON" : "", f ? "" : " none");
+
+	for (i = 0; i < MAX_KERNELS && kernels[i].kernel; i++) {
+		fprintf(out, "  %-12s %s\n", kernels[i].kernel, kernels[i].variant);
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ *  cpu features detection and kernels dispatch
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __CPU_UTIL_H
+#define __CPU_UTIL_H
+
+#include <stdio.h>
+#include "platform.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CPU_X86 1
+#elif defined(__GNUC__) && (defined(__aarch64__) || (defined(__arm__) && defined(__ARM_FP) && (defined(__ARM_NEON) || (!defined(__clang__) && __GNUC__ >= 8)))) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CPU_NEON 1
+#endif
+
+// 32 bits ARM builds (armv6hf) compile NEON kernels anyway, cpu_features() decides
+#if CPU_NEON && !defined(__aarch64__) && !defined(__ARM_NEON)
+#define CPU_NEON_TARGET	__attribute__((target("fpu=neon")))
+#else
+#define CPU_NEON_TARGET
+#endif
+
+#define CPU_HAS_SSE2	0x01
+#define CPU_HAS_AVX2	0x02
+#define CPU_HAS_FMA		0x04
+#define CPU_HAS_NEON	0x08
+
+u32_t cpu_features(void);
+void  cpu_set_kernel(char *kernel, char *variant);
+void  cpu_print_kernels(FILE *out);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ *  benchmark of codecs interleave and convert paths
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ Standalone, built with "make decode_bench". Each codec's call into
+ decode_pack.c is timed with the block size and sample format that codec
+ produces, first with scalar code then with every kernel set that
+ decode_pack_init() selects for a cpu feature mask, as in pack_test.
+ Throughput is in millions of frames per second, written to a buffer that
+ stays in cache like outputbuf's write window does.
+*/
+
+#include <time.h>
+
+// real detection is renamed, dispatchers only see what the current pass allows
+#define cpu_features _cpu_features
+#include "cpu_util.c"
+#undef cpu_features
+
+u32_t cpu_features(void);
+
+#include "decode_pack.c"
+
+log_level decode_loglevel = lERROR;
+
+static u32_t features_mask;
+
+u32_t cpu_features(void) {
+	return _cpu_features() & features_mask;
+}
+
+#define MAX_FRAMES	4608
+#define RUN_MS		200
+
+static u8_t bytes_in[MAX_FRAMES * 8];
+static s32_t left[MAX_FRAMES], right[MAX_FRAMES];
+static float fleft[MAX_FRAMES], fright[MAX_FRAMES], fmixed[MAX_FRAMES * 2];
+static ISAMPLE_T samples[MAX_FRAMES * 2], out[MAX_FRAMES * 2];
+static volatile ISAMPLE_T sink;
+
+// what each codec hands to decode_pack.c, per decoded block
+static struct {
+	char *codec, *path;
+	frames_t frames;
+} paths[] = {
+	{ "flac", "planar 16 bits", 4096 },
+	{ "flac", "planar 24 bits", 4608 },
+	{ "alac", "s16", 4096 },
+	{ "alac", "s24", 4096 },
+	{ "faad", "shift", 1024 },
+	{ "mad", "fixed", 1152 },
+	{ "pcm", "s16 le", 4096 },
+	{ "pcm", "s16 be", 4096 },
+	{ "pcm", "s16 mono", 4096 },
+	{ "pcm", "s24 le", 4096 },
+	{ "vorbis", "float planar", 1024 },
+	{ "opus", "float", 960 },
+};
+
+/*---------------------------------------------------------------------------*/
+static void randomize(void) {
+	int i;
+
+	for (i = 0; i < (int) sizeof(bytes_in); i++) bytes_in[i] = rand();
+	for (i = 0; i < MAX_FRAMES; i++) {
+		// flac right-aligned 24 bits, mad fixed point with a bit of headroom
+		left[i] = (s32_t) ((u32_t) rand() << 8) >> 8;
+		right[i] = (s32_t) ((u32_t) rand() << 4) >> 4;
+		fleft[i] = (float) rand() / RAND_MAX * 2.0f - 1.0f;
+		fright[i] = (float) rand() / RAND_MAX * 2.0f - 1.0f;
+	}
+	for (i = 0; i < MAX_FRAMES * 2; i++) {
+		samples[i] = (ISAMPLE_T) ((u32_t) rand() << 8) >> 8;
+		fmixed[i] = (float) rand() / RAND_MAX * 2.2f - 1.1f;
+	}
+}
+
+static void run(int path, frames_t frames) {
+	switch (path) {
+	case 0: _interleave_planar(out, left, right, frames, 16); break;
+	case 1: _interleave_planar(out, left, right, frames, 24); break;
+	case 2: _unpack_s16(out, bytes_in, frames, 2, false); break;
+	case 3: _unpack_s24(out, bytes_in, frames, false); break;
+	case 4: _interleave_shift(out, samples, frames, 2, BYTES_PER_FRAME == 4 ? 0 : 8); break;
+	case 5: _interleave_fixed(out, left, right, frames, 28); break;
+	case 6: _unpack_s16(out, bytes_in, frames, 2, false); break;
+	case 7: _unpack_s16(out, bytes_in, frames, 2, true); break;
+	case 8: _unpack_s16(out, bytes_in, frames, 1, false); break;
+	case 9: _unpack_s24(out, bytes_in, frames, false); break;
+	case 10: _interleave_float_planar(out, fleft, fright, frames); break;
+	case 11: _interleave_float(out, fmixed, frames, 2); break;
+	}
+
+	// output is never read otherwise
+	sink = out[frames - 1];
+}
+
+/*---------------------------------------------------------------------------*/
+// millions of frames per second
+static double measure(int path) {
+	struct timespec start, now;
+	double ms;
+	u64_t frames = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		int i;
+		for (i = 0; i < 100; i++) run(path, paths[path].frames);
+		frames += 100 * paths[path].frames;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6;
+	} while (ms < RUN_MS);
+
+	return frames / ms / 1e3;
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+	u32_t masks[] = { 0, CPU_HAS_SSE2, CPU_HAS_SSE2 | CPU_HAS_AVX2, CPU_HAS_NEON };
+	typeof(decode_kernels) scalar = decode_kernels, kernels[4];
+	double mfps[4];
+	int i, p, n = 0;
+
+	randomize();
+
+	// keep only kernel sets this cpu and build can run, scalar always first
+	for (i = 0; i < (int) (sizeof(masks) / sizeof(*masks)); i++) {
+		int j;
+
+		decode_kernels = scalar;
+		features_mask = masks[i];
+		if (masks[i]) decode_pack_init();
+
+		for (j = 0; j < n && strcmp(kernels[j].name, decode_kernels.name); j++);
+		if (j == n) kernels[n++] = decode_kernels;
+	}
+
+	printf("%-8s %-16s %6s", "codec", "path", "frames");
+	for (i = 0; i < n; i++) printf(" %12s", kernels[i].name);
+	printf("   (Mframes/s)\n");
+
+	for (p = 0; p < (int) (sizeof(paths) / sizeof(*paths)); p++) {
+		printf("%-8s %-16s %6u", paths[p].codec, paths[p].path, paths[p].frames);
+		for (i = 0; i < n; i++) {
+			decode_kernels = kernels[i];
+			mfps[i] = measure(p);
+			if (i) printf(" %7.1f x%3.1f", mfps[i], mfps[i] / mfps[0]);
+			else printf(" %12.1f", mfps[i]);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
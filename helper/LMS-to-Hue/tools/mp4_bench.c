@@ -0,0 +1,275 @@
+/*
+ *  benchmark of faad mp4 header parsing
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ Standalone, built with "make mp4_bench". faad.c is included with a stub
+ decoder that accepts an AAC-LC config, then each m4a is fed to streambuf in
+ fixed size pieces, the way recv() would, and read_mp4_header() runs after
+ each of them until mdat is reached. It reports the time spent in the parser
+ (skips included) and the peak streambuf occupancy the parser needed. Files
+ given on the command line are used, otherwise m4a with large cover art,
+ iTunSMPB and big sample tables are generated.
+*/
+
+#include "faad.c"
+
+#include <time.h>
+
+struct thread_ctx_s	thread_ctx[MAX_PLAYER];
+log_level 			decode_loglevel = lERROR;
+
+#define ROUNDS	5
+
+static unsigned feeds[] = { 7, 1500, 4093, 65536 };
+
+/*---------------------------------------------------------------------------*/
+// faad2 stub, enough for read_mp4_header()
+static NeAACDecConfiguration config;
+
+NeAACDecHandle NeAACDecOpen(void) { return &config; }
+NeAACDecConfigurationPtr NeAACDecGetCurrentConfiguration(NeAACDecHandle h) { return &config; }
+unsigned char NeAACDecSetConfiguration(NeAACDecHandle h, NeAACDecConfigurationPtr c) { return 1; }
+void NeAACDecClose(NeAACDecHandle h) { }
+char *NeAACDecGetErrorMessage(unsigned char errcode) { return ""; }
+long NeAACDecInit(NeAACDecHandle h, unsigned char *buffer, unsigned long size, unsigned long *samplerate, unsigned char *channels) { return -1; }
+void *NeAACDecDecode(NeAACDecHandle h, NeAACDecFrameInfo *info, unsigned char *buffer, unsigned long size) { return NULL; }
+
+char NeAACDecInit2(NeAACDecHandle h, unsigned char *buffer, unsigned long size, unsigned long *samplerate, unsigned char *channels) {
+	// AAC-LC, 44100, stereo
+	if (size < 2 || buffer[0] != 0x12 || buffer[1] != 0x10) return -1;
+	*samplerate = 44100;
+	*channels = 2;
+	return 0;
+}
+
+unsigned decode_newstream(unsigned sample_rate, int supported_rates[], struct thread_ctx_s *ctx) { return sample_rate; }
+void _checkfade(bool start, struct thread_ctx_s *ctx) { }
+
+/*---------------------------------------------------------------------------*/
+static u8_t *box_open(u8_t *p, char *type) {
+	memcpy(p + 4, type, 4);
+	return p + 8;
+}
+
+static u8_t *box_close(u8_t *box, u8_t *end) {
+	packN((u32_t *) box, end - box);
+	return end;
+}
+
+static u8_t *put32(u8_t *p, u32_t v) {
+	packN((u32_t *) p, v);
+	return p + 4;
+}
+
+static u8_t *full_box(u8_t *p, char *type) {
+	return put32(box_open(p, type), 0);
+}
+
+/*---------------------------------------------------------------------------*/
+// ftyp, moov (one aac trak, udta with cover art and iTunSMPB), mdat
+static u8_t *m4a_make(u32_t cover, u32_t chunks, size_t *len) {
+	static u8_t esds[] = { 0x03, 25, 0, 1, 0, 0x04, 17, 0x40, 0x15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+						   0x05, 2, 0x12, 0x10, 0x06, 1, 2 };
+	static char smpb[] = " 00000000 00000840 000001C4 00000000000FA000 00000000";
+	u8_t *m4a = calloc(1, cover + chunks * 4 + 4096), *p = m4a, *box[8], *stco = NULL;
+	u32_t i, mdat;
+
+	p = box_open(box[0] = p, "ftyp");
+	memcpy(p, "M4A \0\0\0\0", 8);
+	p = box_close(box[0], p + 8);
+
+	p = box_open(box[0] = p, "moov");
+	p = box_open(box[1] = p, "trak");
+	p = box_open(box[2] = p, "mdia");
+	p = box_open(box[3] = p, "minf");
+	p = box_open(box[4] = p, "stbl");
+
+	p = put32(full_box(box[5] = p, "stsd"), 1);
+	p = box_open(box[6] = p, "mp4a");
+	p += 6; p[1] = 1; p += 10;
+	p[1] = 2; p[3] = 16; p += 8;
+	p = put32(p, 44100u << 16);
+	p = full_box(box[7] = p, "esds");
+	memcpy(p, esds, sizeof(esds));
+	p = box_close(box[7], p + sizeof(esds));
+	p = box_close(box[6], p);
+	p = box_close(box[5], p);
+
+	p = put32(full_box(box[5] = p, "stts"), 2);
+	p = put32(put32(p, chunks * 2), 1024);
+	p = box_close(box[5], put32(put32(p, 1), 512));
+
+	p = put32(full_box(box[5] = p, "stsc"), 2);
+	p = put32(put32(put32(p, 1), 3), 1);
+	p = box_close(box[5], put32(put32(put32(p, 5), 2), 1));
+
+	p = put32(full_box(box[5] = p, "stco"), chunks);
+	stco = p;
+	p = box_close(box[5], p + chunks * 4);
+
+	for (i = 4; i >= 1; i--) p = box_close(box[i], p);
+
+	p = box_open(box[1] = p, "udta");
+	p = full_box(box[2] = p, "meta");
+	p = box_open(box[3] = p, "hdlr");
+	p = box_close(box[3], p + 25);
+	p = box_open(box[3] = p, "ilst");
+	p = box_open(box[4] = p, "covr");
+	memset(p, 0xaa, cover);
+	p = box_close(box[4], p + cover);
+	p = box_open(box[4] = p, "----");
+	p = full_box(box[5] = p, "mean");
+	memcpy(p, "com.apple.iTunes", 16);
+	p = box_close(box[5], p + 16);
+	p = full_box(box[5] = p, "name");
+	memcpy(p, "iTunSMPB", 8);
+	p = box_close(box[5], p + 8);
+	p = put32(put32(box_open(box[5] = p, "data"), 1), 0);
+	memcpy(p, smpb, sizeof(smpb) - 1);
+	p = box_close(box[5], p + sizeof(smpb) - 1);
+	for (i = 4; i >= 1; i--) p = box_close(box[i], p);
+	p = box_close(box[0], p);
+
+	// chunks are 10 bytes apart, first one 100 bytes into mdat
+	mdat = p - m4a;
+	for (i = 0; i < chunks; i++) stco = put32(stco, mdat + 8 + 100 + i * 10);
+	p = box_open(box[0] = p, "mdat");
+	memset(p + 100, 0x55, 1000);
+	p = box_close(box[0], p + 1100);
+
+	*len = p - m4a;
+	return m4a;
+}
+
+/*---------------------------------------------------------------------------*/
+static double elapsed(struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// feed m4a by pieces of feed bytes, consume like faad_decode() and parse till mdat
+static int run(u8_t *m4a, size_t len, unsigned feed, double *ms, size_t *peak, unsigned *calls) {
+	struct thread_ctx_s *ctx = thread_ctx;
+	struct faad *a;
+	size_t fed = 0;
+	int found = 0;
+
+	buf_flush(ctx->streambuf);
+	faad_open('5', 0, 0, 0, ctx);
+	a = ctx->decode.handle;
+	*ms = 0;
+	*peak = 0;
+	*calls = 0;
+
+	while (!found) {
+		size_t used, n = min(_buf_cont_write(ctx->streambuf), min(feed, len - fed));
+		struct timespec start;
+
+		memcpy(ctx->streambuf->writep, m4a + fed, n);
+		_buf_inc_writep(ctx->streambuf, n);
+		fed += n;
+		used = _buf_used(ctx->streambuf);
+		*peak = max(*peak, used);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (a->consume) {
+			u32_t consume = min(a->consume, _buf_cont_read(ctx->streambuf));
+			_buf_inc_readp(ctx->streambuf, consume);
+			a->pos += consume;
+			a->consume -= consume;
+		} else {
+			found = read_mp4_header(&a->samplerate, &a->channels, ctx);
+		}
+		*ms += elapsed(&start);
+		(*calls)++;
+
+		// nothing could be fed nor parsed, either a full buffer or end of file
+		if (!found && !n && _buf_used(ctx->streambuf) == used) found = -1;
+	}
+
+	if (found == 1 && (a->samplerate != 44100 || !a->chunkinfo)) found = -1;
+	faad_close(ctx);
+
+	return found;
+}
+
+/*---------------------------------------------------------------------------*/
+static void bench(char *name, u8_t *m4a, size_t len) {
+	int i;
+
+	for (i = 0; i < (int) (sizeof(feeds) / sizeof(*feeds)); i++) {
+		double best = 0;
+		size_t peak;
+		unsigned calls;
+		int round, found = 0;
+
+		for (round = 0; round < ROUNDS; round++) {
+			double ms;
+			found = run(m4a, len, feeds[i], &ms, &peak, &calls);
+			if (!round || ms < best) best = ms;
+		}
+
+		printf("%-16s %8zu bytes feed:%6u %s parse:%9.3fms calls:%7u peak:%8zu bytes\n", name, len, feeds[i],
+				found == 1 ? "mdat" : "FAIL", best, calls, peak);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+	struct { char *name; u32_t cover, chunks; } sets[] = {
+		{ "plain", 0, 1000 }, { "cover-500k", 500 * 1024, 10000 }, { "cover-2M", 2 * 1024 * 1024, 10000 },
+		{ "cover-2M-100k", 2 * 1024 * 1024, 100000 } };
+	struct thread_ctx_s *ctx = thread_ctx;
+	int i;
+
+	ctx->streambuf = &ctx->__s_buf;
+	buf_init(ctx->streambuf, STREAMBUF_SIZE);
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			FILE *f = fopen(argv[i], "rb");
+			u8_t *m4a;
+			long len;
+
+			if (!f || fseek(f, 0, SEEK_END) || (len = ftell(f)) <= 0) {
+				printf("can't read %s\n", argv[i]);
+				if (f) fclose(f);
+				continue;
+			}
+
+			rewind(f);
+			m4a = malloc(len);
+			if (fread(m4a, 1, len, f) == (size_t) len) bench(argv[i], m4a, len);
+			fclose(f);
+			free(m4a);
+		}
+	} else {
+		for (i = 0; i < (int) (sizeof(sets) / sizeof(*sets)); i++) {
+			size_t len;
+			u8_t *m4a = m4a_make(sets[i].cover, sets[i].chunks, &len);
+			bench(sets[i].name, m4a, len);
+			free(m4a);
+		}
+	}
+
+	buf_destroy(ctx->streambuf);
+
+	return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ *  check of vector pack/unpack kernels against scalar code
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ Standalone, built with "make pack_test". Kernel sources are included so
+ that their dispatch tables can be reset to scalar, then every variant
+ selected by output_pack_init() and decode_pack_init() for a set of cpu
+ feature masks is run on random input and compared byte for byte with the
+ scalar path. Lengths cover every tail size around vector widths and gains
+ cover the limits of the vector range and beyond. Exits with 1 on first
+ mismatch. As squeezelite.h can't be included twice, this file is built a
+ second time with PACK_TEST_DECODE for the decode side.
+*/
+
+#if PACK_TEST_DECODE
+#include "decode_pack.c"
+
+log_level decode_loglevel = lERROR;
+#else
+// real detection is renamed, dispatchers only see what the current pass allows
+#define cpu_features _cpu_features
+#include "cpu_util.c"
+#undef cpu_features
+
+u32_t cpu_features(void);
+
+#include "output_pack.c"
+
+log_level output_loglevel = lERROR;
+
+static u32_t features_mask;
+
+u32_t cpu_features(void) {
+	return _cpu_features() & features_mask;
+}
+
+bool pack_test_decode(char **variant);
+#endif
+
+#define MAX_FRAMES	1100
+#define GUARD		64
+#define ROUNDS		50
+
+static u8_t bytes_in[MAX_FRAMES * 8 + GUARD];
+static s32_t left[MAX_FRAMES + GUARD], right[MAX_FRAMES + GUARD];
+static float fleft[MAX_FRAMES + GUARD], fmixed[MAX_FRAMES * 2 + GUARD];
+static ISAMPLE_T samples[MAX_FRAMES * 2 + GUARD];
+
+// output of scalar and vector runs, input too as mono and cross work in place
+static struct {
+	u8_t out[MAX_FRAMES * 8 + GUARD];
+	ISAMPLE_T in[MAX_FRAMES * 2 + GUARD];
+} ref, run;
+
+/*---------------------------------------------------------------------------*/
+static s32_t random32(void) {
+	// extremes are what saturating code gets wrong
+	switch (rand() % 16) {
+	case 0: return 0x7fffffff;
+	case 1: return (s32_t) 0x80000000;
+	case 2: return 0;
+	case 3: return -1;
+	default: return (s32_t) ((u32_t) rand() << 16 ^ (u32_t) rand());
+	}
+}
+
+static float random_float(void) {
+	switch (rand() % 16) {
+	case 0: return 1.0f;
+	case 1: return -1.0f;
+	case 2: return 1.5f;
+	case 3: return -1.5f;
+	case 4: return 0.99999994f;
+	default: return (float) rand() / RAND_MAX * 2.2f - 1.1f;
+	}
+}
+
+static void randomize(void) {
+	int i;
+
+	for (i = 0; i < (int) sizeof(bytes_in); i++) bytes_in[i] = rand();
+	for (i = 0; i < MAX_FRAMES + GUARD; i++) {
+		left[i] = random32();
+		right[i] = random32();
+		fleft[i] = random_float();
+	}
+	for (i = 0; i < MAX_FRAMES * 2 + GUARD; i++) {
+		fmixed[i] = random_float();
+		samples[i] = (ISAMPLE_T) random32();
+	}
+}
+
+#if PACK_TEST_DECODE
+/*---------------------------------------------------------------------------*/
+static void decode_pass(int what, frames_t frames, int offset, unsigned param) {
+	ISAMPLE_T *optr = (ISAMPLE_T *) run.out + offset * 2;
+
+	memset(run.out, 0x55, sizeof(run.out));
+
+	switch (what) {
+	case 0: _unpack_s16(optr, bytes_in + offset, frames, 1 + param % 2, param / 2); break;
+	case 1: _unpack_s24(optr, bytes_in + offset, frames, param % 2); break;
+	case 2: _unpack_s32(optr, bytes_in + offset, frames, param % 2); break;
+	case 3: _interleave_planar(optr, left + offset, right + offset, frames, 8 + param % 25); break;
+	case 4: _interleave_fixed(optr, left + offset, right + offset, frames, 24 + param % 7); break;
+	case 5: _interleave_shift(optr, samples + offset, frames, 1 + param % 2, param % 17); break;
+	case 6: _interleave_float(optr, fmixed + offset, frames, 1 + param % 2); break;
+	case 7: _interleave_float_planar(optr, fleft + offset, fmixed + offset, frames); break;
+	}
+}
+
+static bool check_decode(char *variant) {
+	typeof(decode_kernels) kernels = decode_kernels, scalar = { "scalar" };
+	frames_t frames;
+
+	for (frames = 0; frames < MAX_FRAMES; frames += frames < 70 ? 1 : 97) {
+		int what, offset = rand() % 4;
+		unsigned param;
+
+		for (what = 0; what < 8; what++) for (param = 0; param < 4; param++) {
+			unsigned p = param + rand() % 32 * 4;
+
+			decode_kernels = scalar;
+			decode_pass(what, frames, offset, p);
+			memcpy(ref.out, run.out, sizeof(ref.out));
+
+			decode_kernels = kernels;
+			decode_pass(what, frames, offset, p);
+
+			if (memcmp(ref.out, run.out, sizeof(ref.out))) {
+				printf("FAIL decode/%s: case:%d frames:%u offset:%d param:%u\n", variant, what, frames, offset, p);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// runs with the kernels decode_pack_init() selects for current cpu features
+bool pack_test_decode(char **variant) {
+	static typeof(decode_kernels) scalar = { "scalar" };
+	int round;
+
+	decode_kernels = scalar;
+	decode_pack_init();
+	*variant = decode_kernels.name;
+
+	for (round = 0; round < ROUNDS; round++) {
+		randomize();
+		if (!check_decode(*variant)) return false;
+	}
+
+	return true;
+}
+
+#else
+static s32_t gains[] = { 0, 1, FIXED_ONE / 2, FIXED_ONE - 1, FIXED_ONE, FIXED_ONE + 1, FIXED_ONE * 4, -1 };
+
+/*---------------------------------------------------------------------------*/
+static void output_pass(int what, frames_t frames, int offset, s32_t gainL, s32_t gainR, u8_t flags, output_format format) {
+	memset(run.out, 0x55, sizeof(run.out));
+	memcpy(run.in, samples, sizeof(run.in));
+
+	if (what == 0) {
+		// only 3 bytes samples can be unaligned in output
+		u8_t *optr = run.out + (format == S24_3LE ? offset : offset * 4);
+		_scale_and_pack_frames(optr, run.in + offset * 2, frames, gainL, gainR, flags, format);
+	} else {
+		// fake ring where cross_ptr wraps somewhere in the middle of the run
+		struct buffer buf;
+		ISAMPLE_T *cross_ptr;
+		frames_t size = MAX_FRAMES / 2;
+
+		buf.buf = (u8_t *) run.in;
+		buf.size = size * BYTES_PER_FRAME;
+		buf.wrap = buf.buf + buf.size;
+		buf.readp = (u8_t *) (run.in + size * 2 + offset * 2);
+		cross_ptr = run.in + (size - frames / 2) * 2 + offset % 2;
+		_apply_cross(&buf, min(frames, size / 2), gainL, gainR, &cross_ptr);
+	}
+}
+
+static bool check_output(char *variant) {
+	output_format formats[] = { S32_LE, S24_LE, S24_3LE, S16_LE };
+	u8_t flags[] = { 0, MONO_LEFT, MONO_RIGHT, MONO_LEFT | MONO_RIGHT };
+	typeof(pack_kernels) kernels = pack_kernels;
+	frames_t frames;
+
+	for (frames = 0; frames < MAX_FRAMES; frames += frames < 70 ? 1 : 97) {
+		int what, f, g, m, offset = rand() % 4;
+		s32_t gainL = gains[rand() % (sizeof(gains) / sizeof(*gains))];
+		s32_t gainR = gains[rand() % (sizeof(gains) / sizeof(*gains))];
+
+		for (what = 0; what < 2; what++) for (f = 0; f < 4; f++) for (m = 0; m < 4; m++) for (g = 0; g < 2; g++) {
+			// unity and simple gains both have a vector path
+			s32_t gl = g ? gainL : FIXED_ONE, gr = g ? gainR : FIXED_ONE;
+
+			// crossfade gains always add up to unity
+			if (what) {
+				gl = min(max(gl, 0), FIXED_ONE);
+				gr = FIXED_ONE - gl;
+			}
+
+			pack_kernels.pack = NULL; pack_kernels.mono = NULL; pack_kernels.cross = NULL;
+			output_pass(what, frames, offset, gl, gr, flags[m], formats[f]);
+			ref = run;
+
+			pack_kernels = kernels;
+			output_pass(what, frames, offset, gl, gr, flags[m], formats[f]);
+
+			if (memcmp(&ref, &run, sizeof(ref))) {
+				printf("FAIL pack/%s: %s frames:%u offset:%d gain:%d/%d flags:%u format:%d\n", variant,
+						what ? "cross" : "scale_and_pack", frames, offset, gl, gr, flags[m], formats[f]);
+				return false;
+			}
+
+			if (what) break;
+		}
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+	u32_t masks[] = { CPU_HAS_SSE2, CPU_HAS_SSE2 | CPU_HAS_AVX2, CPU_HAS_NEON };
+	typeof(pack_kernels) scalar = pack_kernels;
+	char *tested[4] = { NULL };
+	int i, n = 0;
+
+	srand(argc > 1 ? atoi(argv[1]) : 1);
+
+	for (i = 0; i < (int) (sizeof(masks) / sizeof(*masks)); i++) {
+		char *variant, *decode_variant;
+		int j, round;
+
+		pack_kernels = scalar;
+		features_mask = masks[i];
+		output_pack_init();
+		variant = pack_kernels.name;
+
+		// a mask the cpu (or build) can't honour falls back to a tested variant
+		for (j = 0; j < n && strcmp(tested[j], variant); j++);
+		if (j < n || !strcmp(variant, "scalar")) continue;
+		tested[n++] = variant;
+
+		for (round = 0; round < ROUNDS; round++) {
+			randomize();
+			if (!check_output(variant)) return 1;
+		}
+
+		if (!pack_test_decode(&decode_variant)) return 1;
+
+		printf("pack/%s decode/%s: OK\n", variant, decode_variant);
+	}
+
+	if (!n) printf("no vector kernels in this build\n");
+
+	return 0;
+}
+#endif
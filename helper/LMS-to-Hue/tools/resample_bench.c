@@ -0,0 +1,152 @@
+/*
+ *  benchmark of soxr resampling against resample_threads
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ Standalone, built with "make resample_bench". resample.c is included and
+ driven as process.c does: resample_init() with the device soxr options and
+ resample_threads, resample_newstream() for a hi-res rate, then blocks of
+ flac's min_space run through resample_samples(). Throughput is in times
+ real time of the input stream, for 1, 2, 4... threads up to the number of
+ cores, then 0 (OpenMP default). Usage: resample_bench [soxr options]
+ [max threads], options as in the "resample" device setting. Builds
+ without RESAMPLE_MP can only run 1 thread.
+*/
+
+#include "resample.c"
+
+#include <time.h>
+
+struct thread_ctx_s	thread_ctx[MAX_PLAYER];
+log_level 			decode_loglevel = lERROR;
+
+#define RUN_MS		1000
+#define IN_FRAMES	(204800 / BYTES_PER_FRAME)
+
+/*---------------------------------------------------------------------------*/
+static bool setup(char *opt, unsigned threads, unsigned in_rate, unsigned out_rate, struct thread_ctx_s *ctx) {
+	int rates[] = { out_rate, 0 };
+	char *copy = opt ? strdup(opt) : NULL;
+	bool active;
+
+	// next_param() cuts the option string
+	ctx->config.resample_threads = threads;
+	active = resample_init(copy, ctx);
+	if (copy) free(copy);
+	if (!active) return false;
+
+	ctx->process.max_in_frames = IN_FRAMES;
+	ctx->process.max_out_frames = (unsigned) (1.1 * IN_FRAMES * out_rate / in_rate) + 1;
+	ctx->process.inbuf = malloc(ctx->process.max_in_frames * BYTES_PER_FRAME);
+	ctx->process.outbuf = malloc(ctx->process.max_out_frames * BYTES_PER_FRAME);
+
+	if (ctx->process.inbuf && resample_newstream(in_rate, rates, ctx)) {
+		ISAMPLE_T *p = (ISAMPLE_T *) ctx->process.inbuf;
+		unsigned i;
+
+		// a loud-ish sine so that the filters have something to chew on
+		for (i = 0; i < IN_FRAMES; i++) {
+			p[2*i] = p[2*i + 1] = (ISAMPLE_T) (sin(2 * M_PI * 1000 * i / in_rate) * 0.5 *
+								  (BYTES_PER_FRAME == 4 ? 0x7fff : 0x7fffffff));
+		}
+		return true;
+	}
+
+	return false;
+}
+
+static void cleanup(struct thread_ctx_s *ctx) {
+	if (ctx->decode.process_handle) {
+		resample_flush(ctx);
+		resample_end(ctx);
+		ctx->decode.process_handle = NULL;
+	}
+	free(ctx->process.inbuf);
+	free(ctx->process.outbuf);
+	ctx->process.inbuf = ctx->process.outbuf = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+// times real time of the input stream
+static double measure(struct thread_ctx_s *ctx) {
+	struct timespec start, now;
+	double ms;
+	u64_t frames = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		ctx->process.in_frames = IN_FRAMES;
+		resample_samples(ctx);
+		frames += IN_FRAMES;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6;
+	} while (ms < RUN_MS);
+
+	return frames / (ms / 1e3) / ctx->process.in_sample_rate;
+}
+
+/*---------------------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+	struct { unsigned in, out; } pairs[] = { { 96000, 48000 }, { 192000, 48000 }, { 176400, 44100 }, { 96000, 44100 } };
+	struct thread_ctx_s *ctx = thread_ctx;
+	char *opt = argc > 1 ? argv[1] : NULL;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned max_threads = argc > 2 ? atoi(argv[2]) : (cores > 0 ? cores : 1);
+	int i;
+
+	if (!register_soxr()) {
+		printf("no soxr\n");
+		return 1;
+	}
+
+#if !RESAMPLE_MP
+	printf("built without RESAMPLE_MP, only 1 thread\n");
+	max_threads = 1;
+#endif
+
+	printf("soxr options: %s, %u cores\n", opt && *opt ? opt : "default", (unsigned) cores);
+
+	for (i = 0; i < (int) (sizeof(pairs) / sizeof(*pairs)); i++) {
+		double single = 0;
+		unsigned threads = 1;
+
+		while (true) {
+			double speed;
+
+			if (!setup(opt, threads, pairs[i].in, pairs[i].out, ctx)) {
+				printf("%6u -> %6u can't resample\n", pairs[i].in, pairs[i].out);
+				cleanup(ctx);
+				break;
+			}
+
+			speed = measure(ctx);
+			if (threads == 1) single = speed;
+			cleanup(ctx);
+
+			printf("%6u -> %6u threads:%3u %8.1fx real time (x%.2f)\n", pairs[i].in, pairs[i].out, threads, speed, speed / single);
+
+			// 0 lets OpenMP use all cores, run it last
+			if (!threads || max_threads == 1) break;
+			threads = threads * 2 <= max_threads ? threads * 2 : 0;
+		}
+	}
+
+	deregister_soxr();
+
+	return 0;
+}
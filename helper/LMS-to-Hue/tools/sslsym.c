@@ -172,6 +172,17 @@ SYMDECL(SSL_set_fd, int, 2, SSL*, s, int, fd);
 SYMDECL(SSL_get_error, int, 2, const SSL*, s, int, ret_code);
 SYMDECL(SSL_ctrl, long, 4, SSL*, ssl, int, cmd, long, larg, void*, parg);
 SYMDECL(SSL_pending, int, 1, const SSL*, s);
+SYMDECL(SSL_get1_session, SSL_SESSION*, 1, SSL*, s);
+SYMDECL(SSL_set_session, int, 2, SSL*, s, SSL_SESSION*, session);
+SYMDECL(SSL_SESSION_free, void, 1, SSL_SESSION*, session);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000
+SYMDECL(SSL_session_reused, int, 1, const SSL*, s);
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+SYMDECL(SSL_set_options, uint64_t, 2, SSL*, s, uint64_t, op);
+SYMDECL(SSL_get_rbio, BIO*, 1, const SSL*, s);
+SYMDECL(BIO_ctrl, long, 4, BIO*, bp, int, cmd, long, larg, void*, parg);
+#endif
 
 SYMDECL(SSL_free, void, 1, SSL*, s);
 SYMDECL(SSL_CTX_free, void, 1, SSL_CTX *, ctx);
@@ -251,6 +262,16 @@ bool load_ssl_symbols(void) {
 	SYMLOAD(SSLhandle, SSL_read);
 	SYMLOAD(SSLhandle, SSL_write);
 	SYMLOAD(SSLhandle, SSL_pending);
+	SYMLOAD(SSLhandle, SSL_get1_session);
+	SYMLOAD(SSLhandle, SSL_set_session);
+	SYMLOAD(SSLhandle, SSL_SESSION_free);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000
+	SYMLOAD(SSLhandle, SSL_session_reused);
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+	SYMLOAD(SSLhandle, SSL_set_options);
+	SYMLOAD(SSLhandle, SSL_get_rbio);
+#endif
 	SYMLOAD(SSLhandle, TLS_client_method);
 	SYMLOAD(SSLhandle, OpenSSL_version_num);
 	SYMLOAD(SSLhandle, _SSLv23_client_method);
@@ -277,6 +298,9 @@ bool load_ssl_symbols(void) {
 	SYMLOAD(CRYPThandle, AES_cbc_encrypt);
 	SYMLOAD(CRYPThandle, BIO_new_mem_buf);
 	SYMLOAD(CRYPThandle, BIO_free);
+#ifdef SSL_OP_ENABLE_KTLS
+	SYMLOAD(CRYPThandle, BIO_ctrl);
+#endif
 	SYMLOAD(CRYPThandle, PEM_read_bio_RSAPrivateKey);
 
 	// managed deprecated functions